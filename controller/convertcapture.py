@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+
+# Open TAS - A Command line interface for the Open TAS Controller.
+# Copyright (C) 2019  Russell Small
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+from argparse import ArgumentParser, FileType
+
+from core.capture import CaptureDecoder, CaptureEncoder, readRawCapture, writeRawCapture
+
+parser = ArgumentParser(description="Converts between .raw text captures and the binary CAPTURE_DATA format.")
+parser.add_argument("input", action="store", help="The file to convert")
+parser.add_argument("output", action="store", help="The file to write")
+parser.add_argument("-d", "--decode", action="store_true", help="Convert binary capture data back into a .raw text capture")
+parser.add_argument("-c", "--collapse", action="store_true", help="Send runs of identical transactions as a repeat count, like RECORDER_COLLAPSE_REPEATS")
+
+def main(arguments):
+	if arguments.decode:
+		with open(arguments.input, "rb") as file:
+			records = CaptureDecoder().decode(file.read())
+		with open(arguments.output, "w") as file:
+			writeRawCapture(file, records)
+	else:
+		with open(arguments.input, "r") as file:
+			records = readRawCapture(file)
+		with open(arguments.output, "wb") as file:
+			file.write(CaptureEncoder(arguments.collapse).encode(records))
+
+	print("Converted {0} transactions.".format(len(records)))
+
+main(parser.parse_args())
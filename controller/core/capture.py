@@ -0,0 +1,181 @@
+# Open TAS - A Command line interface for the Open TAS Controller.
+# Copyright (C) 2019  Russell Small
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Reads and writes CAPTURE_DATA (0xB1) records. See commands.h in the firmware
+# for the layout.
+
+REPEAT_COMMAND = 0x3E
+ESCAPED_COMMAND = 0x3F
+
+# Bytes the console sends after the command byte. Everything else in a
+# transaction is the controller's response.
+N64_REQUEST_BYTES = {
+	0x02: 2,  # Controller Pack Read - address
+	0x03: 34, # Controller Pack Write - address & data
+}
+
+class CaptureRecord:
+	def __init__(self, timestamp, port, command, request, response):
+		self.timestamp = timestamp
+		self.port = port
+		self.command = command
+		self.request = request
+		self.response = response
+
+	def __eq__(self, other):
+		return vars(self) == vars(other)
+
+	def __repr__(self):
+		return "{0:08X},{1},{2:02X},{3},{4}".format(self.timestamp, self.port, self.command, self.request.hex(), self.response.hex())
+
+def readVarint(data, offset):
+	value = 0
+	shift = 0
+	while True:
+		byte = data[offset]
+		offset += 1
+		value |= (byte & 0x7F) << shift
+		shift += 7
+		if byte < 0x80:
+			return (value, offset)
+
+def writeVarint(value):
+	data = bytearray()
+	while value >= 0x80:
+		data.append((value & 0x7F) | 0x80)
+		value >>= 7
+	data.append(value)
+	return data
+
+class CaptureDecoder:
+	"""Timestamps are deltas across frames, so one decoder must see every frame of a session in order."""
+	def __init__(self):
+		self.timestamp = 0
+		self.lastRecords = {}
+
+	def decode(self, payload):
+		records = []
+		offset = 0
+		while offset < len(payload):
+			port = payload[offset] >> 6
+			command = payload[offset] & 0x3F
+			offset += 1
+
+			if command == REPEAT_COMMAND:
+				delta, offset = readVarint(payload, offset)
+				count, offset = readVarint(payload, offset)
+				span, offset = readVarint(payload, offset)
+				self.timestamp = (self.timestamp + delta) & 0xFFFFFFFF
+				records += self.expandRepeats(port, self.timestamp, count, span)
+				continue
+
+			if command == ESCAPED_COMMAND:
+				command = payload[offset]
+				offset += 1
+
+			delta, offset = readVarint(payload, offset)
+			sizes, offset = readVarint(payload, offset)
+			requestSize, responseSize = divmod(sizes, 64)
+
+			# Timestamps come from time_us_32, which wraps.
+			self.timestamp = (self.timestamp + delta) & 0xFFFFFFFF
+			request = bytes(payload[offset:offset + requestSize])
+			response = bytes(payload[offset + requestSize:offset + requestSize + responseSize])
+			offset += requestSize + responseSize
+
+			record = CaptureRecord(self.timestamp, port, command, request, response)
+			self.lastRecords[port] = record
+			records.append(record)
+		return records
+
+	def expandRepeats(self, port, first, count, span):
+		# Only the first and last repeat times are known, the rest are spread evenly.
+		last = self.lastRecords[port]
+		records = []
+		for x in range(count):
+			offset = span * x // (count - 1) if count > 1 else 0
+			records.append(CaptureRecord((first + offset) & 0xFFFFFFFF, port, last.command, last.request, last.response))
+		return records
+
+class CaptureEncoder:
+	def __init__(self, collapseRepeats=False):
+		self.timestamp = 0
+		self.collapseRepeats = collapseRepeats
+
+	def encode(self, records):
+		payload = bytearray()
+		lastRecords = {}
+		repeats = {}
+
+		for record in records:
+			if self.collapseRepeats:
+				last = lastRecords.get(record.port)
+				if last and (last.command, last.request, last.response) == (record.command, record.request, record.response):
+					repeats.setdefault(record.port, []).append(record.timestamp)
+					continue
+				payload += self.encodeRepeats(record.port, repeats.pop(record.port, []))
+				lastRecords[record.port] = record
+
+			if record.command < REPEAT_COMMAND:
+				payload.append((record.port << 6) | record.command)
+			else:
+				payload.append((record.port << 6) | ESCAPED_COMMAND)
+				payload.append(record.command)
+
+			payload += writeVarint((record.timestamp - self.timestamp) & 0xFFFFFFFF)
+			payload += writeVarint(len(record.request) * 64 + len(record.response))
+			payload += record.request + record.response
+			self.timestamp = record.timestamp
+
+		for port, timestamps in repeats.items():
+			payload += self.encodeRepeats(port, timestamps)
+		return payload
+
+	def encodeRepeats(self, port, timestamps):
+		if not timestamps:
+			return b""
+
+		payload = bytearray([(port << 6) | REPEAT_COMMAND])
+		payload += writeVarint((timestamps[0] - self.timestamp) & 0xFFFFFFFF)
+		payload += writeVarint(len(timestamps))
+		payload += writeVarint((timestamps[-1] - timestamps[0]) & 0xFFFFFFFF)
+		self.timestamp = timestamps[0]
+		return payload
+
+def readRawCapture(file):
+	"""Reads the text captures in sample_readings: timestamp, controller, command, reply nibbles, reply"""
+	records = []
+	for line in file:
+		fields = [field.strip() for field in line.strip().split(",")]
+		if len(fields) != 5:
+			continue
+		try:
+			timestamp = int(fields[0], 16)
+			port = int(fields[1])
+			command = int(fields[2], 16)
+			reply = bytes.fromhex(fields[4])
+		except ValueError:
+			continue
+
+		requestSize = min(N64_REQUEST_BYTES.get(command, 0), len(reply))
+		records.append(CaptureRecord(timestamp, port, command, reply[:requestSize], reply[requestSize:]))
+	return records
+
+def writeRawCapture(file, records):
+	file.write("timestamp, controller, command, reply nibbles, reply\n")
+	for record in records:
+		reply = record.request + record.response
+		file.write("{0:08X},{1},{2:02X},{3:02X},{4}\n".format(record.timestamp, record.port, record.command, len(reply) * 2, reply.hex().upper()))
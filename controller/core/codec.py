@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+# Open TAS - A Command line interface for the Open TAS Controller.
+# Copyright (C) 2019  Russell Small
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Packed input streams. Must match include/consoles/n64/input_codec.h.
+TOKEN_REPEAT = 0x00
+TOKEN_STICK = 0x40
+TOKEN_BUTTONS = 0x80
+TOKEN_RAW = 0xC0
+MAX_RUN = 64
+
+def signed(value):
+	return value - 256 if value > 127 else value
+
+def encodeFrame(previous, frame):
+	dx = signed((frame[2] - previous[2]) & 0xFF)
+	dy = signed((frame[3] - previous[3]) & 0xFF)
+	small = -4 <= dx <= 3 and -4 <= dy <= 3
+	stick = ((dx & 0x07) << 3) | (dy & 0x07)
+
+	if small and frame[0:2] == previous[0:2]:
+		return bytes([TOKEN_STICK | stick])
+	if small:
+		return bytes([TOKEN_BUTTONS | stick]) + bytes(frame[0:2])
+	return bytes([TOKEN_RAW]) + bytes(frame)
+
+def encodeRecords(records):
+	"""Packs a list of records, each a list of 4 byte frames in port order."""
+	output = bytearray()
+	previous = [bytes(4)] * len(records[0]) if records else []
+	run = 0
+	for record in records:
+		if list(record) == previous:
+			run += 1
+			if run == MAX_RUN:
+				output.append(TOKEN_REPEAT | (run - 1))
+				run = 0
+			continue
+		if run > 0:
+			output.append(TOKEN_REPEAT | (run - 1))
+			run = 0
+
+		for port, frame in enumerate(record):
+			output += encodeFrame(previous[port], frame)
+		previous = [bytes(frame) for frame in record]
+	if run > 0:
+		output.append(TOKEN_REPEAT | (run - 1))
+	return bytes(output)
@@ -33,7 +33,7 @@ def loadMovie(file):
 	movie = N64Movie(data.rom, data.controllers, data.author, data.description)
 	inputStream = BytesIO(data.inputData)
 	for x in range(data.frames):
-		movie.write([inputStream.read(4)])
+		movie.write([inputStream.read(4) for c in range(data.controllers)])
 	return movie
 
 def saveMovie(file):
@@ -0,0 +1,86 @@
+# Open TAS - A Command line interface for the Open TAS Controller.
+# Copyright (C) 2019  Russell Small
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+# Decodes LOG (0xF1) frames into the same text the firmware sends without
+# IO_BINARY_LOGS. See commands.h and labels.h in the firmware for the layout.
+
+# The frame the message would have been sent as, by ID range.
+LEVELS = [0xFC, 0xFD, 0xFE, 0xFF]
+
+# Message ID: name, then its arguments. b - byte, h - short, i - int,
+# s - string, r - the remaining bytes.
+MESSAGES = {
+	0x00: ("PORT_INFO", "bbr"),
+	0x40: ("DEVICE_INIT", "ss"),
+	0x41: ("FLASH_MOVIE_END", "i"),
+	0x42: ("RUMBLE", "bb"),
+	0x80: ("OP_NOT_IMPLEMENTED", "s"),
+	0x81: ("NO_DEVICE_SETUP", "s"),
+	0x82: ("UNKNOWN_CONSOLE_CMD", "b"),
+	0x83: ("PACK_ADDRESS_CRC", "i"),
+	0xC0: ("NO_DEVICE_SETUP", "b"),
+	0xC1: ("SUPPORT_DISABLED", ""),
+	0xC2: ("UNKNOWN_DEVICE", ""),
+	0xC3: ("UNKNOWN_MODE", "sb"),
+	0xC4: ("BUFFER_UNDERFLOW", "s"),
+	0xC5: ("BUFFER_OVERFLOW", "s"),
+	0xC6: ("NO_CONTROLLER_PACK", "b"),
+	0xC7: ("FLASH_OFFSET", "i"),
+	0xC8: ("NO_FLASH_MOVIE", ""),
+	0xC9: ("UNSUPPORTED_DEVICE", "s"),
+}
+
+SIZES = {"b": 1, "h": 2, "i": 4}
+
+def formatArguments(spec, data):
+	parts = []
+	offset = 0
+	for kind in spec:
+		if kind == "s":
+			end = data.find(b"\x00", offset)
+			end = len(data) if end == -1 else end
+			parts.append(data[offset:end].decode("utf-8", "replace"))
+			offset = end + 1
+		elif kind == "r":
+			parts.append(data[offset:].hex().upper())
+			offset = len(data)
+		else:
+			size = SIZES[kind]
+			value = int.from_bytes(data[offset:offset + size], "little")
+			parts.append("{0:0{1}X}".format(value, size * 2))
+			offset += size
+	return parts
+
+def decodeLog(payload):
+	"""Returns (frame command, text) for each message. Repeats are counted."""
+	messages = []
+	dropped = payload[0] | (payload[1] << 8)
+	offset = 2
+	while offset + 4 <= len(payload):
+		id, length = payload[offset], payload[offset + 1]
+		count = payload[offset + 2] | (payload[offset + 3] << 8)
+		data = payload[offset + 4:offset + 4 + length]
+		offset += 4 + length
+
+		name, spec = MESSAGES.get(id, ("MESSAGE_{0:02X}".format(id), "r"))
+		text = " ".join([name] + formatArguments(spec, data))
+		if count > 1:
+			text += " (x{0})".format(count)
+		messages.append((LEVELS[id >> 6], text))
+
+	if dropped:
+		messages.append((0xFE, "LOG_DROPPED {0}".format(dropped)))
+	return messages
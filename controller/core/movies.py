@@ -17,6 +17,11 @@
 
 from math import floor
 
+from core.services import readFrame, writeControllerPack
+from core.capture import CaptureDecoder
+from core.codec import encodeRecords
+from core.logs import decodeLog
+
 PREFIX = {
 	0xFC: "[DEBUG] ",
 	0xFD: "[INFO]  ",
@@ -52,34 +57,66 @@ class Movie:
 class N64Movie(Movie):
 	def __init__(self, game, controllers, author, description):
 		super().__init__("Nintendo 64", game, controllers, author, description)
-		self.inputs = ([],) * controllers
+		self.inputs = tuple([] for _ in range(controllers))
+
+	def records(self):
+		return [[inputs[x] for inputs in self.inputs] for x in range(self.frames)]
 
-	def play(self, connection, statusFunction = None):
+	def play(self, connection, statusFunction = None, controllerPack = None, packed = True):
 		connection.write(bytearray([0x80])) #Set Device
 		connection.write(b"N64")
 		connection.write(bytearray([0x03])) #Datastream Playback Mode
 
 		connection.write(bytearray([0xD1])) #Controller Config Raw Cmd
-		connection.write(bytearray([0x01, 0x05, 0x00, 0x02]))
-		connection.write(bytearray([0x00, 0x00, 0x00, 0x00]))
-		connection.write(bytearray([0x00, 0x00, 0x00, 0x00]))
-		connection.write(bytearray([0x00, 0x00, 0x00, 0x00]))
+		connection.write(bytearray([0x01, 0x05, 0x00, 0x01 if controllerPack else 0x02]))
+		for port in range(1, 4):
+			connection.write(bytearray([0x01, 0x05, 0x00, 0x02] if port < self.controllers else [0x00, 0x00, 0x00, 0x00]))
 
-		frame = 0
-		while True:
-			command = connection.read(1)[0]
-			if command in [0xFC, 0xFD, 0xFE, 0xFF]:
-				data = connection.read_until(b"\n")[:-1]
-				statusFunction(self, frame, None, PREFIX[command] + data.decode("utf-8")) if statusFunction else None
-			elif command == 0xD0:
-				fcount = floor(connection.read(1)[0]/4)
-				data = b"".join(self.inputs[0][frame:frame + fcount])
-				frame += fcount
-				connection.write(bytearray([0xD0, len(data)]) + data)
-				statusFunction(self, frame, data[-1]) if statusFunction else None
-			else:
-				print("Unknown Command: " + bytearray([command]).hex())
+		if controllerPack:
+			writeControllerPack(connection, 0, controllerPack)
 
+		if packed:
+			connection.write(bytearray([0xD4, 0x01])) #Packed Datastream Encoding
+			stream = encodeRecords(self.records())
+			sent = 0
+
+		frame = 0
+		credit = 0
+		try:
+			while True:
+				command, payload = readFrame(connection)
+				if command in [0xFC, 0xFD, 0xFE, 0xFF]:
+					data = payload.rstrip(b"\n")
+					statusFunction(self, frame, None, PREFIX[command] + data.decode("utf-8")) if statusFunction else None
+				elif command == 0xF1:
+					for level, text in decodeLog(payload):
+						statusFunction(self, frame, None, PREFIX[level] + text) if statusFunction else None
+				elif command == 0xD0 and packed:
+					# Packed credit is in bytes of the stream, which can split anywhere.
+					credit += payload[0] | (payload[1] << 8)
+					while credit > 0 and sent < len(stream):
+						data = stream[sent:sent + min(credit, 0xFF)]
+						sent += len(data)
+						credit -= len(data)
+						connection.write(bytearray([0xD0, len(data)]) + data)
+					frame = self.frames * sent // len(stream) if stream else 0
+					statusFunction(self, frame, None) if statusFunction else None
+				elif command == 0xD0:
+					# Grants add up, and are spent in packets of whole records. Each
+					# record holds one frame for every connected controller.
+					credit += payload[0] | (payload[1] << 8)
+					fcount = floor(min(credit, 0xFF)/(4 * self.controllers))
+					while fcount > 0 and frame < self.frames:
+						data = b"".join(b"".join(inputs[x] for inputs in self.inputs) for x in range(frame, min(frame + fcount, self.frames)))
+						frame += fcount
+						credit -= len(data)
+						connection.write(bytearray([0xD0, len(data)]) + data)
+						fcount = floor(min(credit, 0xFF)/(4 * self.controllers))
+					statusFunction(self, frame, None) if statusFunction else None
+				else:
+					print("Unknown Command: " + bytearray([command]).hex())
+		except KeyboardInterrupt:
+			pass
 
 		# for frame in range(self.frames):
 		# 	value = connection.read(1)[0]
@@ -87,6 +124,36 @@ class N64Movie(Movie):
 		# 	connection.write(bytearray([0x01]) + b"".join(inputs))
 		# 	statusFunction(self, frame, inputs) if statusFunction else None
 
+	def flashImage(self, autoplay = False):
+		"""Packs the movie for flash playback: a header page, then the packed stream."""
+		stream = encodeRecords(self.records())
+		header = bytearray(b"OTAM")
+		header += self.frames.to_bytes(4, "little")
+		header += len(stream).to_bytes(4, "little")
+		header += bytearray([0x02, 0x01 if autoplay else 0x00, 0x01]) + b"N64" + bytearray(2)
+		for port in range(4):
+			header += bytearray([0x01, 0x05, 0x00, 0x02] if port < self.controllers else [0x00, 0x00, 0x00, 0x00])
+
+		return bytes(header.ljust(256, b"\x00")) + stream
+
+	def playFromFlash(self, connection, statusFunction = None):
+		connection.write(bytearray([0x80])) #Set Device
+		connection.write(b"N64")
+		connection.write(bytearray([0x03])) #Datastream Playback Mode
+		connection.write(bytearray([0xC2])) #Play Flash Movie
+
+		try:
+			while True:
+				command, payload = readFrame(connection)
+				if command in [0xFC, 0xFD, 0xFE, 0xFF]:
+					data = payload.rstrip(b"\n")
+					statusFunction(self, 0, None, PREFIX[command] + data.decode("utf-8")) if statusFunction else None
+				elif command == 0xF1:
+					for level, text in decodeLog(payload):
+						statusFunction(self, 0, None, PREFIX[level] + text) if statusFunction else None
+		except KeyboardInterrupt:
+			pass
+
 	def record(self, connection, statusFunction = None):
 		connection.write(bytearray([0x80])) #Set Device
 		connection.write(b"N64")
@@ -94,16 +161,20 @@ class N64Movie(Movie):
 
 		print("Got it?")
 
+		decoder = CaptureDecoder()
 		try:
 			while True:
-				command = connection.read(1)[0]	
+				command, payload = readFrame(connection)
 				if command in [0xFC, 0xFD, 0xFE, 0xFF]:
-					data = connection.read_until(b"\n")[:-1]
+					data = payload.rstrip(b"\n")
 					statusFunction(self, message = PREFIX[command] + data.decode("utf-8")) if statusFunction else None
+				elif command == 0xF1:
+					for level, text in decodeLog(payload):
+						statusFunction(self, message = PREFIX[level] + text) if statusFunction else None
 				elif command == 0xB0:
-					(port, size, request_size) = connection.read(3)
-					request = connection.read(request_size)
-					response = connection.read(size - request_size)
+					(port, size, request_size) = payload[:3]
+					request = payload[3:3 + request_size]
+					response = payload[3 + request_size:3 + size]
 
 					print(" ".join([
 						bytearray([port]).hex(),
@@ -112,6 +183,9 @@ class N64Movie(Movie):
 						request.hex(),
 						response.hex()
 					]))
+				elif command == 0xB1:
+					for record in decoder.decode(payload):
+						print(record)
 				else:
 					print("Unknown Command: " + bytearray([command]).hex())
 
@@ -44,3 +44,14 @@ def printN64Inputs(movie, message=None):
 
 	# print(text, end=None, flush=True)
 	# print("\b" * len(text), end=None, flush=False)
+
+def printStats(stats):
+	usPerCycle = 1000000 / stats["clock"]
+
+	for name, probe in stats["probes"].items():
+		bucketUs = probe["bucketCycles"] * usPerCycle
+		print("{0}: {1} samples, max {2:.2f}us".format(name, probe["count"], probe["max"] * usPerCycle))
+		for index, count in enumerate(probe["buckets"]):
+			if count:
+				last = index == len(probe["buckets"]) - 1
+				print("  {0:>7.2f}us{1} {2}".format(index * bucketUs, "+" if last else " ", count))
@@ -23,18 +23,120 @@ import zipfile
 
 from serial import Serial
 
+from core.logs import decodeLog
+
 def connectToController(port, rate):
 	controller = Serial(port, rate, timeout=10)
 	
 	# Temp: Send a message to the controller to trigger the preamble
 	controller.write(b"?")
-	preamble = controller.read_until(b"\n")
+	command, preamble = readFrame(controller)
 	isOpenTAS = preamble.startswith(b"OpenTAS")
 	controller.timeout = None
 
 	#return (controller, isOpenTAS)
 	return (controller, True)
 
+# Set to match IO_FRAME_CHECKSUM in the firmware config.
+FRAME_CHECKSUM = False
+
+def readFrame(connection):
+	"""Reads one device frame. Returns the command and its payload."""
+	header = connection.read(3)
+	if len(header) < 3:
+		return (None, b"")
+
+	command = header[0]
+	payload = connection.read(header[1] + header[2] * 256)
+
+	if FRAME_CHECKSUM:
+		checksum = connection.read(1)[0]
+		for value in header + payload:
+			checksum ^= value
+		if checksum != 0:
+			raise Exception("Frame checksum mismatch for command " + bytearray([command]).hex())
+
+	return (command, payload)
+
+def errorText(command, payload):
+	"""Returns the errors in a text error frame or a LOG frame, or None."""
+	if command == 0xFF:
+		return payload.decode("utf-8", "replace").strip()
+	if command == 0xF1:
+		errors = [text for level, text in decodeLog(payload) if level == 0xFF]
+		return "; ".join(errors) if errors else None
+	return None
+
+STATS_PROBES = ["IRQ_TO_REPLY", "IRQ_DURATION", "READ_SPIN", "READ_GAP", "DATASTREAM_REPLY", "RECORDER_CAPTURE", "REALTIME_AGE", "PACK_READ"]
+
+def readStats(connection):
+	"""Requests the latency histograms, which also clears them on the device."""
+	connection.write(bytearray([0xE0]))
+	command, payload = readFrame(connection)
+	while command != 0xE0:
+		command, payload = readFrame(connection)
+
+	probes, buckets = payload[0:2]
+	clock = int.from_bytes(payload[2:6], "little")
+
+	# Each probe has its own bucket width.
+	stats = {"clock": clock, "probes": {}}
+	offset = 6
+	for probe in range(probes):
+		shift = payload[offset]
+		data = [int.from_bytes(payload[x:x + 4], "little") for x in range(offset + 1, offset + 9 + buckets * 4, 4)]
+		offset += 9 + buckets * 4
+		name = STATS_PROBES[probe] if probe < len(STATS_PROBES) else "PROBE_" + str(probe)
+		stats["probes"][name] = {"bucketCycles": 2 ** shift, "count": data[0], "max": data[1], "buckets": data[2:]}
+	return stats
+
+CONTROLLER_PACK_SIZE = 0x8000
+CONTROLLER_PACK_CHUNK = 128
+
+def writeControllerPack(connection, port, image):
+	"""Uploads a Controller Pack image. The port must be configured with a pack inserted."""
+	# mupen64plus keeps all four packs in one file. Only the first is used.
+	image = bytes(image[:CONTROLLER_PACK_SIZE]).ljust(CONTROLLER_PACK_SIZE, b"\x00")
+	for address in range(0, CONTROLLER_PACK_SIZE, CONTROLLER_PACK_CHUNK):
+		chunk = image[address:address + CONTROLLER_PACK_CHUNK]
+		connection.write(bytearray([0xD2, port]) + address.to_bytes(2, "little") + bytearray([len(chunk)]) + chunk)
+
+def readControllerPack(connection, port):
+	"""Downloads a port's Controller Pack image. Other frames received meanwhile are dropped."""
+	image = bytearray()
+	for address in range(0, CONTROLLER_PACK_SIZE, CONTROLLER_PACK_CHUNK):
+		connection.write(bytearray([0xD3, port]) + address.to_bytes(2, "little") + bytearray([CONTROLLER_PACK_CHUNK]))
+		command, payload = readFrame(connection)
+		while command != 0xD2:
+			error = errorText(command, payload)
+			if error:
+				raise Exception("Unable to read controller pack: " + error)
+			command, payload = readFrame(connection)
+		image += payload[3:]
+	return bytes(image)
+
+FLASH_PAGE_SIZE = 256
+
+def writeFlashMovie(connection, image, progressFunction = None):
+	"""Stores a movie image in the controller's flash. This stops the current device."""
+	image = bytes(image).ljust((len(image) + FLASH_PAGE_SIZE - 1) // FLASH_PAGE_SIZE * FLASH_PAGE_SIZE, b"\xFF")
+	connection.write(bytearray([0xC0]) + len(image).to_bytes(4, "little"))
+	waitForAcknowledge(connection, 0xC0)
+
+	# Each page is acknowledged once it's programmed, so nothing queues up while flash is busy.
+	for offset in range(0, len(image), FLASH_PAGE_SIZE):
+		connection.write(bytearray([0xC1]) + offset.to_bytes(4, "little") + image[offset:offset + FLASH_PAGE_SIZE])
+		waitForAcknowledge(connection, 0xC1)
+		progressFunction(offset + FLASH_PAGE_SIZE, len(image)) if progressFunction else None
+
+def waitForAcknowledge(connection, hostCommand):
+	command, payload = readFrame(connection)
+	while command != 0xF0 or payload[0] != hostCommand:
+		error = errorText(command, payload)
+		if error:
+			raise Exception("Flash write failed: " + error)
+		command, payload = readFrame(connection)
+
 def loadMovie(file, specifiedFormat):
 	formats = [specifiedFormat] if specifiedFormat else listFormats()
 	file = getMovieFile(file)
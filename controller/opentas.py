@@ -19,8 +19,8 @@
 from argparse import ArgumentParser, FileType
 import os
 
-from core.services import connectToController, loadMovie, getFormatByName
-from core.output import printPlayProgress, printN64Inputs
+from core.services import connectToController, loadMovie, getFormatByName, readStats, readControllerPack, writeFlashMovie
+from core.output import printPlayProgress, printN64Inputs, printStats
 
 import core.movies
 
@@ -32,11 +32,17 @@ subparsers = parser.add_subparsers(title="Mode", dest="mode", required=True)
 playparser = subparsers.add_parser("play", description="Plays a movie file through the Open TAS Controller.")
 playparser.add_argument("-i", "--input", action="store", type=FileType("rb"), required=True, help="The file to playback")
 playparser.add_argument("-f", "--format", action="store", help="Sets the format for the input file")
+playparser.add_argument("-p", "--pack", action="store", type=FileType("rb"), help="A Controller Pack image (.mpk) to insert in controller 1")
+playparser.add_argument("-s", "--save-pack", action="store", type=FileType("wb"), help="Saves controller 1's Controller Pack here when playback is stopped")
+playparser.add_argument("--flash", action="store_true", help="Stores the movie in the controller's flash and plays it from there, so the host can't stall playback")
+playparser.add_argument("--autoplay", action="store_true", help="With --flash, plays the stored movie whenever the controller powers on")
 
 recordparser = subparsers.add_parser("record", description="Records a movie from a connected controller & console.")
 recordparser.add_argument("-o", "--output", action="store", type=FileType("wb+"), required=True, help="An output file to save the recording to")
 recordparser.add_argument("-f", "--format", action="store", required=True, help="Sets the format for the output file")
 
+statsparser = subparsers.add_parser("stats", description="Prints and clears the controller's latency histograms.")
+
 
 def main(arguments):
 	print("Connecting to OpenTAS Controller on " + arguments.port + "... ", end="", flush=True)
@@ -51,6 +57,8 @@ def main(arguments):
 		play(controller, arguments)
 	elif arguments.mode == "record":
 		record(controller, arguments)
+	elif arguments.mode == "stats":
+		printStats(readStats(controller))
 
 	print("\n")
 
@@ -64,7 +72,27 @@ def play(controller, arguments):
 
 	print("Complete.")
 	confirmConnection(movie)
-	movie.play(controller, printPlayProgress)
+
+	if arguments.flash:
+		if arguments.pack:
+			raise Abort("Flash movies can't use a Controller Pack.")
+		print("Writing movie to flash... ", end="", flush=True)
+		writeFlashMovie(controller, movie.flashImage(arguments.autoplay))
+		print("Complete.")
+		movie.playFromFlash(controller, printPlayProgress)
+		return
+	if arguments.autoplay:
+		raise Abort("--autoplay requires --flash.")
+
+	pack = arguments.pack.read() if arguments.pack else None
+	if arguments.save_pack and not pack:
+		raise Abort("Saving a Controller Pack requires one to be inserted with --pack.")
+	movie.play(controller, printPlayProgress, pack)
+
+	if arguments.save_pack:
+		print("\nSaving Controller Pack... ", end="", flush=True)
+		arguments.save_pack.write(readControllerPack(controller, 0))
+		print("Complete.")
 
 def record(controller, arguments):
 	print("Preparing to record movie... ", end="", flush=True)
@@ -22,13 +22,25 @@ public:
 
     virtual void update();
     virtual bool is_oneline() const;
+    // Payload size of CONTROLLER_CONFIG, which depends on the console.
+    virtual int controller_config_size() const;
 
     virtual void handle_datastream();
+    virtual void handle_datastream_encoding();
     virtual void handle_controller_config();
+    virtual void handle_controller_pack_write();
+    virtual void handle_controller_pack_read();
+    virtual void handle_flash_movie_play();
+    virtual void handle_realtime_overlay();
 };
 
 class DummyDevice : public BaseDevice {
 public:
     virtual void handle_datastream() override;
+    virtual void handle_datastream_encoding() override;
     virtual void handle_controller_config() override;
+    virtual void handle_controller_pack_write() override;
+    virtual void handle_controller_pack_read() override;
+    virtual void handle_flash_movie_play() override;
+    virtual void handle_realtime_overlay() override;
 };
@@ -16,13 +16,22 @@
 #pragma once
 #include "global.h"
 
-template <typename T>
+#include <atomic>
+#include <string.h>
+
+// Single producer, single consumer queue. One side may run in an IRQ or on the
+// other core; the write pointer is published with release semantics after the
+// data is stored, and the read pointer after the data has been copied out.
+// Pointers are free running and masked on access, so size must be a power of 2.
+template <typename T, uint size>
 class CircularQueue {
 private:
-    const int size;
-    T* buffer;
-    int rptr = 0, wptr = 0;
-    int available = 0;
+    static_assert(size > 0 && (size & (size - 1)) == 0, "CircularQueue size must be a power of 2");
+    static constexpr uint mask = size - 1;
+
+    T buffer[size];
+    std::atomic<uint> rptr{0}, wptr{0};
+    // Each flag is only ever written by one side.
     bool underflow = false, overflow = false;
 
     // I keep getting burned by pass by value vs pass by reference. 
@@ -31,24 +40,26 @@ private:
     CircularQueue(CircularQueue&& other) = delete;
     CircularQueue& operator=(CircularQueue&& other) = delete;
 public:
-    CircularQueue(int size) : size(size), buffer(new T[size]) {
-        wptr = 0;
-        rptr = 0;
-        available = 0;
-        // Do we need to clear the buffer before use?
-        // for (int x = 0; x < sizeof(T) * size; x++) {
-        //     *((byte*)buffer + x) = 0;
-        // }
-    }
-    ~CircularQueue() {
-        delete buffer;
+    CircularQueue() {}
+
+    static constexpr int capacity() { return size; }
+
+    // --------------------
+    // |     CONSUMER     |
+    // --------------------
+
+    int gets_avaiable() const {
+        return wptr.load(std::memory_order_acquire) - rptr.load(std::memory_order_relaxed);
     }
 
     T get() {
-        T value = buffer[rptr];
-        rptr = (rptr + 1) % size;
-        available--;
-        underflow |= available < 0;
+        uint r = rptr.load(std::memory_order_relaxed);
+        if (wptr.load(std::memory_order_acquire) == r) {
+            underflow = true;
+            return T();
+        }
+        T value = buffer[r & mask];
+        rptr.store(r + 1, std::memory_order_release);
         return value;
     }
 
@@ -57,29 +68,113 @@ public:
         return get();
     }
 
+    // Copies up to count values out in at most two segments. Returns how many
+    // were copied; asking for more than is available flags an underflow.
+    int get(T values[], int count) {
+        uint r = rptr.load(std::memory_order_relaxed);
+        int available = wptr.load(std::memory_order_acquire) - r;
+        if (count > available) {
+            underflow = true;
+            count = available;
+        }
+
+        int first = size - (r & mask);
+        if (first > count) { first = count; }
+        memcpy(values, &buffer[r & mask], first * sizeof(T));
+        memcpy(values + first, &buffer[0], (count - first) * sizeof(T));
+
+        rptr.store(r + count, std::memory_order_release);
+        return count;
+    }
+
+    // Exposes the readable data up to the end of the buffer without copying.
+    // Call skip() once the data has been consumed.
+    int peek_contiguous(const T** values) const {
+        uint r = rptr.load(std::memory_order_relaxed);
+        int available = wptr.load(std::memory_order_acquire) - r;
+        int contiguous = size - (r & mask);
+
+        *values = &buffer[r & mask];
+        return available < contiguous ? available : contiguous;
+    }
+
+    void skip(int count) {
+        rptr.store(rptr.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Drops everything added before the producer's write_position() was
+    // taken, unless it has been read already.
+    void skip_to(uint position) {
+        uint r = rptr.load(std::memory_order_relaxed);
+        if ((int)(position - r) > 0) { rptr.store(position, std::memory_order_release); }
+    }
+
+    // --------------------
+    // |     PRODUCER     |
+    // --------------------
+
+    int adds_available() const {
+        return size - (wptr.load(std::memory_order_relaxed) - rptr.load(std::memory_order_acquire));
+    }
+
     void add(T value) {
-        buffer[wptr] = value;
-        wptr = (wptr + 1) % size;
-        available++;
-        overflow |= available >= size;
+        uint w = wptr.load(std::memory_order_relaxed);
+        if (w - rptr.load(std::memory_order_acquire) >= size) {
+            overflow = true;
+            return;
+        }
+        buffer[w & mask] = value;
+        wptr.store(w + 1, std::memory_order_release);
+    }
+
+    // Copies up to count values in at most two segments. Returns how many were
+    // added; anything that did not fit is dropped and flags an overflow.
+    int add(const T values[], int count) {
+        uint w = wptr.load(std::memory_order_relaxed);
+        int space = size - (w - rptr.load(std::memory_order_acquire));
+        if (count > space) {
+            overflow = true;
+            count = space;
+        }
+
+        int first = size - (w & mask);
+        if (first > count) { first = count; }
+        memcpy(&buffer[w & mask], values, first * sizeof(T));
+        memcpy(&buffer[0], values + first, (count - first) * sizeof(T));
+
+        wptr.store(w + count, std::memory_order_release);
+        return count;
     }
-    
-    void add(const T values[], int count) {
-        for (int x = 0; x < count; x++) {
-            buffer[(wptr + x) % size] = values[x];
+
+    // Adds all of the values or none of them, so the consumer never sees
+    // half of a record.
+    bool add_record(const T values[], int count) {
+        if (adds_available() < count) {
+            overflow = true;
+            return false;
         }
-        wptr = (wptr + count) % size;
-        available += count;
-        overflow |= available >= size;
+        add(values, count);
+        return true;
     }
 
-    int gets_avaiable() {
-        return available;
+    // Exposes free space up to the end of the buffer so it can be filled in
+    // place. Call commit() with the number of values written.
+    int reserve_contiguous(T** values) {
+        uint w = wptr.load(std::memory_order_relaxed);
+        int space = size - (w - rptr.load(std::memory_order_acquire));
+        int contiguous = size - (w & mask);
+
+        *values = &buffer[w & mask];
+        return space < contiguous ? space : contiguous;
     }
-    int adds_available() {
-        return size - available;
+
+    void commit(int count) {
+        wptr.store(wptr.load(std::memory_order_relaxed) + count, std::memory_order_release);
     }
 
+    // Where the next value will be added, for the consumer's skip_to().
+    uint write_position() const { return wptr.load(std::memory_order_relaxed); }
+
     bool overflowed() const { return overflow; }
     bool underflowed() const { return underflow; }
 };
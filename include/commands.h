@@ -19,6 +19,11 @@
 #include "global.h"
 
 namespace commands {
+    // Every device command is sent as a frame:
+    //   1 byte  - command
+    //   2 bytes - payload length (little endian)
+    //   n bytes - payload
+    //   1 byte  - xor of all previous bytes (only with IO_FRAME_CHECKSUM)
     namespace device {
         enum Command: byte {
             NOP = 0x00,
@@ -27,13 +32,47 @@ namespace commands {
 
             // 0xB0-0xBF - Recording Commands
             RAW_DATA = 0xB0,
+            // Any number of records, each:
+            //   1 byte  - port (top 2 bits), command (low 6 bits, 0x3F = escaped)
+            //  (1 byte) - command, only if escaped
+            //   varint  - microseconds since the previous record
+            //   varint  - request bytes after the command * 64 + response bytes
+            //   n bytes - request bytes, then response bytes
+            // Or, for command 0x3E, a repeat of the port's last record:
+            //   varint  - microseconds from the previous record to the first repeat
+            //   varint  - repeat count
+            //   varint  - microseconds from the first repeat to the last
+            // Varints are 7 bits per byte, least significant first, with the
+            // high bit set on every byte but the last.
+            CAPTURE_DATA = 0xB1,
 
             // 0xD0-0xDF - Datastream Commands
+            // Grants the host credit to send more DATASTREAM_DATA. Grants add up,
+            // so the host may keep sending until its credit runs out.
+            // 2 bytes - bytes granted (little endian), in whole records
+            // 8 bytes - frames queued on each port (2 bytes each, little endian)
             DATASTREAM_REQUEST = 0xD0,
             DATASTREAM_STATUS = 0xD1,
+            // 1 byte  - port
+            // 2 bytes - address (little endian)
+            // n bytes - pack data
+            CONTROLLER_PACK_DATA = 0xD2,
+
+            // 0xE0-0xEF - Diagnostics
+            STATS = 0xE0,
 
             // 0xF0-0xFF - Text/Info Commands
+            // 1 byte  - the host command that finished
             ACKNOWLEDGE = 0xF0,
+            // Log messages since the last LOG, with IO_BINARY_LOGS:
+            //   2 bytes - messages dropped because the log was full (little endian)
+            //   Any number of messages, each:
+            //     1 byte  - message ID (see labels.h)
+            //     1 byte  - argument bytes
+            //     2 bytes - times it was logged with these arguments (little endian)
+            //     n bytes - arguments: shorts and ints little endian, strings
+            //               NUL terminated, and byte arrays as they are
+            LOG = 0xF1,
             DEBUG = 0xFC,
             INFO = 0xFD,
             WARN = 0xFE,
@@ -59,14 +98,56 @@ namespace commands {
             STOP_DEVICE = 0x81,
 
             // 0x90-0xAF - Device Configuration
+            // Sets the turnaround from the end of a console request to the
+            // reply, after SET_DEVICE:
+            //   1 byte  - 1 for every command, 0 for just the next byte's
+            //   1 byte  - console command
+            //   2 bytes - nanoseconds (little endian)
+            REPLY_DELAY = 0x90,
+            // Realtime: changes what a port's controller reports. Each byte
+            // of the controller's reply becomes (reply & keep) | set.
+            //   1 byte  - port
+            //   4 bytes - keep, in reply order
+            //   4 bytes - set, in reply order
+            REALTIME_OVERLAY = 0x91,
 
             // 0xB0-0xBF - Recording Commands
 
             // 0xC0-0xCF - Playback Commands
-            
+            // Erases the flash movie. Replies with ACKNOWLEDGE.
+            //   4 bytes - bytes to erase (little endian)
+            FLASH_MOVIE_ERASE = 0xC0,
+            // Programs one page of the flash movie. Replies with ACKNOWLEDGE.
+            //   4 bytes   - offset (little endian), page aligned
+            //   256 bytes - data
+            FLASH_MOVIE_PROGRAM = 0xC1,
+            // Plays the flash movie on the current device.
+            FLASH_MOVIE_PLAY = 0xC2,
+
             // 0xD0-0xDF - Datastream Commands
+            // Spends count bytes of the credit granted by DATASTREAM_REQUEST.
+            // 1 byte  - count
+            // n bytes - records of one 4 byte frame per connected port, in port order
             DATASTREAM_DATA = 0xD0,
             CONTROLLER_CONFIG = 0xD1,
+            // Writes to a port's Controller Pack image:
+            //   1 byte  - port
+            //   2 bytes - address (little endian)
+            //   1 byte  - count
+            //   n bytes - data
+            CONTROLLER_PACK_WRITE = 0xD2,
+            // Replies with CONTROLLER_PACK_DATA:
+            //   1 byte  - port
+            //   2 bytes - address (little endian)
+            //   1 byte  - count
+            CONTROLLER_PACK_READ = 0xD3,
+            // Sets how DATASTREAM_DATA is encoded, after CONTROLLER_CONFIG:
+            //   1 byte  - 0 for raw records, 1 for a packed stream (see input_codec.h)
+            DATASTREAM_ENCODING = 0xD4,
+
+            // 0xE0-0xEF - Diagnostics
+            // Replies with STATS and clears them.
+            GET_STATS = 0xE0,
         };
     };
 }
\ No newline at end of file
@@ -17,15 +17,103 @@
 #pragma once
 
 #define N64_SUPPORT
+#define GAMECUBE_SUPPORT
 
 #define ONELINE_PIN_PORT_1 6
 #define ONELINE_PIN_PORT_2 7
 #define ONELINE_PIN_PORT_3 26
 #define ONELINE_PIN_PORT_4 27
+// Realtime: the real controllers the Pico polls on pio1, one per console port.
+#define REALTIME_PIN_PORT_1 10
+#define REALTIME_PIN_PORT_2 11
+#define REALTIME_PIN_PORT_3 12
+#define REALTIME_PIN_PORT_4 13
 
 // Each byte of data takes 32us to transmit.
 #define ONELINE_READ_TIMEOUT_US 48
+// The console's stop bit starts within a bit of the request's last byte.
+#define ONELINE_STOP_BIT_TIMEOUT_US 4
+// Can't respond too quickly, or the console will not register the command.
+// Counted from the end of the console's stop bit, from about 3.1us up to
+// 515us. Whatever is over the minimum also adds to how late the IRQ can hand
+// a reply over without it slipping. The host can change these with REPLY_DELAY.
+#define N64_REPLY_DELAY_NS 4000
+#define GAMECUBE_REPLY_DELAY_NS 4000
+
+// Runs the oneline IRQ and all console replies on core 1. Core 0 is left to
+// service USB and refill the device queues.
+#define ONELINE_USE_CORE1
+
+// Records by letting DMA drain the PIO into a RAM ring per port, instead of
+// reading each transaction inside the IRQ. Rings are 2^BITS bytes.
+#define ONELINE_DMA_CAPTURE
+#define ONELINE_CAPTURE_RING_BITS 12
+
+// Realtime: Each controller is polled this long before the console's next
+// poll is expected, which must cover the request and reply (about 175us).
+// Console polls closer together than REALTIME_MIN_PERIOD_US are one burst,
+// timed by its first poll, and gaps longer than REALTIME_MAX_PERIOD_US are
+// pauses rather than its interval. Controllers are polled at least every
+// REALTIME_IDLE_POLL_US regardless. Unplugged ones are identified every
+// REALTIME_IDENTIFY_US, and requests are given up after REALTIME_REPLY_TIMEOUT_US.
+#define REALTIME_POLL_LEAD_US 300
+#define REALTIME_MIN_PERIOD_US 1000
+#define REALTIME_MAX_PERIOD_US 50000
+#define REALTIME_IDLE_POLL_US 1000
+#define REALTIME_IDENTIFY_US 100000
+#define REALTIME_REPLY_TIMEOUT_US 400
+
+// Recording: Sends runs of identical transactions on a port as a repeat count.
+#define RECORDER_COLLAPSE_REPEATS
+
+// Collects latency histograms for the oneline hot paths (see stats.h).
+#define ENABLE_STATS
+
+// Datastream Playback: Frames buffered per port, as a power of 2. Each frame
+// is queued as one 4 byte PIO word.
+#define DATASTREAM_BUFFER_FRAMES 2048
+// The host is granted more data once the frames queued or in flight on a port
+// drop below the low watermark, enough to refill it to the high watermark.
+#define DATASTREAM_LOW_WATERMARK 1536
+#define DATASTREAM_HIGH_WATERMARK 2048
+// Packed streams are buffered as received, and expanded as the ports drain.
+// The host is granted the free space once less than the low watermark is left.
+#define DATASTREAM_PACKED_BUFFER_SIZE 8192
+#define DATASTREAM_PACKED_LOW_WATERMARK 6144
+
+// GameCube Datastream: Frames buffered per port, as a power of 2. Each frame
+// is queued as two PIO words. Watermarks work as above.
+#define GAMECUBE_BUFFER_FRAMES 1024
+#define GAMECUBE_LOW_WATERMARK 768
+#define GAMECUBE_HIGH_WATERMARK 1024
+
+// Flash Movies: Stored from this offset to the end of flash. Must be sector
+// aligned, and past the end of the program.
+#define FLASH_MOVIE_OFFSET (1024 * 1024)
 
 // Activity LED:
 #define LED_SHOWS_ONELINE_ACTIVITY
 // #define LED_SHOWS_DATASTREAM_STATUS
+
+// Host Input:
+// Largest host command payload: FLASH_MOVIE_PROGRAM's offset and page.
+#define IO_INPUT_BUFFER_SIZE (4 + 256)
+// How often the main loop wakes with nothing signalled, to flush output and
+// drain DMA captures.
+#define EVENTS_HOUSEKEEPING_US 500
+
+// Host Output:
+// Small frames are coalesced for up to this long before being sent.
+#define IO_FLUSH_WINDOW_US 1000
+#define IO_OUTPUT_BUFFER_SIZE 1024
+// Appends an xor of each frame's bytes after its payload.
+// #define IO_FRAME_CHECKSUM
+// Sends log messages as an ID with binary arguments, which IRQs may also
+// log. Repeats of a message within IO_LOG_INTERVAL_US are sent as a count.
+// Comment out for text logs, e.g. for a serial terminal.
+#define IO_BINARY_LOGS
+#define IO_LOG_INTERVAL_US 10000
+// Distinct messages per interval. Any more are dropped and counted.
+#define IO_LOG_SLOTS 16
+// Longer arguments are truncated, keeping the end of strings.
+#define IO_LOG_ARGUMENT_SIZE 32
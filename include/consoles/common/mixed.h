@@ -0,0 +1,68 @@
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include "base_device.h"
+#include "consoles/common/oneline.h"
+#include "consoles/common/recorder.h"
+
+namespace oneline {
+    // Streams the ports the host configures as connected and records the
+    // rest, e.g. a movie on port 1 next to a live player on port 2. Host
+    // commands all go to the stream; records already carry their port.
+    template <typename Stream>
+    class MixedDevice : public BaseDevice {
+    public:
+        MixedDevice(const char* console, const CommandSize commands[], int command_count)
+            : recorder(console, commands, command_count, 0) {
+            this->assign_ports();
+        }
+        template <size_t count>
+        MixedDevice(const char* console, const CommandSize (&commands)[count]) : MixedDevice(console, commands, count) {}
+
+        void update() override {
+            this->stream.update();
+            this->recorder.update();
+        }
+        int controller_config_size() const override { return this->stream.controller_config_size(); }
+
+        void handle_datastream() override { this->stream.handle_datastream(); }
+        void handle_datastream_encoding() override { this->stream.handle_datastream_encoding(); }
+        void handle_controller_config() override {
+            this->stream.handle_controller_config();
+            this->assign_ports();
+        }
+        void handle_controller_pack_write() override { this->stream.handle_controller_pack_write(); }
+        void handle_controller_pack_read() override { this->stream.handle_controller_pack_read(); }
+        void handle_flash_movie_play() override {
+            this->stream.handle_flash_movie_play();
+            this->assign_ports();
+        }
+    private:
+        void assign_ports() {
+            for (int x = port_1; x <= port_4; x++) {
+                Port port = (Port)x;
+                set_handler(port, this->stream.is_connected(port) ? (OnelineHandler*)&this->stream : &this->recorder);
+            }
+        }
+
+        // Members are torn down in reverse: the recorder only gives up its
+        // ports, then the stream's uninit stops the PIO.
+        Stream stream;
+        Recorder recorder;
+    };
+}
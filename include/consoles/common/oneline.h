@@ -32,24 +32,164 @@ namespace oneline {
         port_invalid = -1
     };
 
+    // A console command and how many bytes follow it on each side of the
+    // handoff. Each console has a table of the commands it sends.
+    struct CommandSize {
+        byte command;
+        byte request_bytes;
+        byte response_bytes;
+    };
+
+    // Returns nullptr if command isn't in the table.
+    inline const CommandSize* find_command(const CommandSize table[], int count, int command) {
+        for (int x = 0; x < count; x++) {
+            if (table[x].command == command) { return &table[x]; }
+        }
+        return nullptr;
+    }
+    template <size_t count>
+    inline const CommandSize* find_command(const CommandSize (&table)[count], int command) {
+        return find_command(table, count, command);
+    }
+
     class OnelineHandler {
     public:
         virtual void handle_oneline(Port port) = 0;
     };
 
-    void init(OnelineHandler* handler);
-    void uninit();
+    // Each port has its own handler, so one device can stream some ports
+    // while another records the rest. Ports are bit n for port n. The PIO
+    // starts with the first handler and stops once the last one is removed;
+    // ports without a handler have their transactions discarded.
+    constexpr uint all_ports = (1 << port_1) | (1 << port_2) | (1 << port_3) | (1 << port_4);
+    void init(OnelineHandler* handler, uint ports = all_ports);
+    void uninit(OnelineHandler* handler);
+    // Hands a port to another handler, or to none, while the PIO runs.
+    void set_handler(Port port, OnelineHandler* handler);
 
+    // Sets how long after a request its reply starts, for one command or
+    // every command. The PIO counts this from the end of the console's stop
+    // bit, in steps of 1 / oneline_F_PIO_MHZ us, so IRQs hand over replies and
+    // leave. It can't be less than oneline_REPLY_MIN_CYCLES, and the shortest
+    // delay set is how late a reply can be handed over without slipping.
+    constexpr int all_commands = -1;
+    void set_reply_delay(int command, uint32_t ns);
+
+    // Returns -1 if the transaction ended or timed out first. Either way, the
+    // reader is left ready for the next one.
     int read_byte_blocking(Port port);
     int read_bytes_blocking(byte buffer[], Port port, int count, int request_bytes);
     void read_discard(Port port);
 
+#ifdef ONELINE_DMA_CAPTURE
+    // Capture mode: DMA drains every port into a RAM ring. The IRQ only
+    // timestamps each transaction as it starts. Use instead of init/uninit.
+    void init_capture();
+    void uninit_capture();
+    // Copies the raw PIO words of the next complete transaction, including the
+    // end marker, and sets timestamp to the time_us_32() it started at.
+    // Returns the number of words, 0 if nothing is complete yet, or -1 if the
+    // ring overran and data was lost.
+    int read_capture(Port port, uint32_t words[], int max_words, uint32_t* timestamp);
+#endif
+
+    // Request mode: the Pico acts as the console towards real controllers on
+    // pio1, one state machine per port on the REALTIME_PIN_PORT_* pins. The
+    // IRQ is taken on the calling core, and calls the handler once a reply
+    // has ended (or been given up on), to fetch it with read_reply.
+    class RequestHandler {
+    public:
+        virtual void handle_reply(Port port) = 0;
+    };
+    void init_requests(RequestHandler* handler);
+    void uninit_requests();
+    // Sends up to 4 bytes and the console's stop bit, then reads the reply.
+    void start_request(Port port, const byte data[], int bytes);
+    // Ends a request whose controller never replied. The handler still runs.
+    void abort_request(Port port);
+    // Returns the number of reply bytes.
+    int read_reply(Port port, byte buffer[], int count);
+
+    // Turns raw PIO words into bytes. Bytes after the request are shifted by
+    // the handoff bit, so they get realigned as they come in.
+    class Decoder {
+    public:
+        Decoder(byte buffer[], int count, int request_bytes)
+            : buffer(buffer), count(count), request_bytes(request_bytes) {}
+
+        // Returns true once the end of the transaction has been read.
+        __force_inline bool add(uint32_t data) {
+            // Values higher than 255 represent the end of a command.
+            // This is a bit-inverted counter of how many bits were read.
+            if (data <= 0xFF) {
+                // controller bytes need to be rotated left 1 bit.
+                if (bytes >= request_bytes) { data <<= 1; }
+                if (bytes > request_bytes && bytes <= count) { buffer[bytes-1] |= (data >> 8) & 1; }
+
+                // Dont write past the end of the array.
+                if (bytes < count) { buffer[bytes] = data; }
+                last_read = data;
+                bytes++;
+                return false;
+            }
+
+            // We need to reprocess the last byte
+            bytes--;
+            last_read <<= (8 - (~data % 8)) % 8;
+
+            if (bytes > request_bytes && bytes <= count) { buffer[bytes-1] |= (last_read >> 8) & 1; }
+            if (bytes >= 0 && bytes < count) { buffer[bytes] = last_read; }
+            return true;
+        }
+
+        // Despite the bytes-- above, there will always be one "ghost" byte
+        // added due to the handoff bit.
+        int size() const { return bytes < 0 ? 0 : bytes; }
+    private:
+        byte* const buffer;
+        const int count;
+        const int request_bytes;
+        int bytes = 0;
+        uint32_t last_read = 0;
+    };
+
     // void write_request(Port port, const byte buffer[], int bytes);
     // void write_reply(Port port, const byte buffer[], int bytes);
 
+    // Packs 4 reply bytes into the inverted, left aligned word the PIO shifts
+    // out, so a reply can be prepared before the console asks for it.
+    inline uint32_t encode_reply_word(const byte data[4]) {
+        return ~(((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3]);
+    }
+    void write_encoded_reply(Port port, byte command, const uint32_t words[], int bytes);
+
+    // Packs a reply whose size is known at compile time. The loops unroll into
+    // straight loads and shifts, and the last partial word is left aligned.
+    template <int bytes>
+    __force_inline void encode_reply(const byte data[], uint32_t words[]) {
+        static_assert(bytes > 0, "replies have at least one byte");
+        for (int x = 0; x < bytes / 4; x++) {
+            words[x] = encode_reply_word(data + x * 4);
+        }
+        if (bytes % 4 != 0) {
+            uint32_t last = 0;
+            for (int x = 0; x < bytes % 4; x++) {
+                last |= (uint32_t)data[bytes / 4 * 4 + x] << (24 - x * 8);
+            }
+            words[bytes / 4] = ~last;
+        }
+    }
+
+    // Fixed size replies for the hot paths. These skip the per byte
+    // bookkeeping of Writer, which stays for sizes only known at runtime.
+    // Each size used must be instantiated in oneline.cpp.
+    // Replies are timed by the delay set for command.
+    template <int bytes> void write_reply(Port port, byte command, const byte data[]);
+    template <int bytes> void write_encoded_reply(Port port, byte command, const uint32_t words[]);
+
     class Writer {
     public:
-        Writer(Port port, int count);
+        Writer(Port port, byte command, int count);
         // void begin_response(int bytes);
         // void begin_request(int bytes);
         Writer& write(byte data);
@@ -0,0 +1,100 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include "consoles/common/oneline.h"
+#include "circular_queue.h"
+#include "io.h"
+
+#define READER_BUFFER_SIZE 64
+// port, size, request size, command, timestamp (4 bytes)
+#define RECORD_HEADER_SIZE 8
+#define READER_STREAM_SIZE 512
+// Records are batched into CAPTURE_DATA frames up to about this size.
+#define CAPTURE_FRAME_SIZE 256
+#define CAPTURE_COMMAND_REPEAT 0x3E
+#define CAPTURE_COMMAND_ESCAPE 0x3F
+
+#define RECORDER_PORT_COUNT 4
+// A run of identical transactions is sent once it reaches this many repeats,
+// or once its first repeat is this old.
+#define RECORDER_MAX_REPEATS 1024
+#define RECORDER_REPEAT_FLUSH_US 250000
+// Commands missing from the command table whose handoff is being learned.
+#define RECORDER_LEARNED_COMMANDS 8
+
+namespace oneline {
+    // Records every transaction on its ports. Consoles only differ in which
+    // commands they send, so each passes its command table. Capture mode
+    // takes over the whole PIO, so it is only used when recording every port.
+    class Recorder : public BaseDevice, public OnelineHandler {
+    public:
+        Recorder(const char* console, const CommandSize commands[], int command_count, uint ports = all_ports);
+        template <size_t count>
+        Recorder(const char* console, const CommandSize (&commands)[count], uint ports = all_ports)
+            : Recorder(console, commands, count, ports) {}
+        ~Recorder() override;
+
+        void update() override;
+        
+        void handle_oneline(Port port) override;
+    private:
+        int infer_request_bytes(int command, byte data[], int size);
+        void add_record(Port port, int command, int additional_request_bytes, int actual_data_count, uint32_t timestamp);
+        int write_record(io::CommandWriter& writer, byte port, byte command, uint32_t timestamp,
+            const byte data[], int request_bytes, int data_size);
+#ifdef ONELINE_DMA_CAPTURE
+        void process_captures();
+        const bool capture;
+#endif
+#ifdef RECORDER_COLLAPSE_REPEATS
+        struct PortHistory {
+            bool valid = false;
+            byte command;
+            int request_bytes;
+            int data_size;
+            byte data[READER_BUFFER_SIZE];
+            uint repeats = 0;
+            uint32_t first_repeat = 0;
+            uint32_t last_repeat = 0;
+        };
+        PortHistory history[RECORDER_PORT_COUNT];
+
+        int write_repeats(io::CommandWriter& writer, byte port);
+        bool repeats_due() const;
+#endif
+
+        // Candidate request sizes for a command and transaction size. Bit n
+        // is set while n request bytes is still possible.
+        struct LearnedCommand {
+            bool valid = false;
+            byte command;
+            byte size;
+            uint64_t splits;
+        };
+        LearnedCommand learned[RECORDER_LEARNED_COMMANDS];
+        int next_learned = 0;
+
+        const CommandSize* const commands;
+        const int command_count;
+        byte last_invalid_command = 0;
+        uint32_t last_timestamp = 0;
+        byte read_buffer[RECORD_HEADER_SIZE + READER_BUFFER_SIZE] = {};
+        CircularQueue<byte, READER_STREAM_SIZE> reader_data;
+    };
+}
@@ -0,0 +1,94 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+#include "consoles/gamecube/protocol.h"
+
+#include <atomic>
+
+#include "consoles/common/oneline.h"
+#include "circular_queue.h"
+
+#define GAMECUBE_FRAME_SIZE 8
+#define GAMECUBE_FRAME_WORDS 2
+#define GAMECUBE_ORIGIN_SIZE 10
+#define GAMECUBE_CONTROLLER_COUNT 4
+
+static_assert(GAMECUBE_LOW_WATERMARK <= GAMECUBE_HIGH_WATERMARK && GAMECUBE_HIGH_WATERMARK <= GAMECUBE_BUFFER_FRAMES,
+    "GameCube watermarks must fit in the buffer");
+// Grants are sent as 16 bits.
+static_assert(GAMECUBE_HIGH_WATERMARK * GAMECUBE_FRAME_SIZE * GAMECUBE_CONTROLLER_COUNT <= 0xFFFF,
+    "GameCube high watermark is too large to grant at once");
+
+namespace gamecube {
+    struct ControllerConfig {
+        bool connected;
+        byte header[3];
+    };
+
+    // Games poll several times a frame, so every frame is replayed for a set
+    // number of polls. Frames are encoded when they arrive, so a poll only
+    // moves words from the queue to the PIO.
+    class Datastream : public BaseDevice, public oneline::OnelineHandler {
+    public:
+        Datastream();
+        ~Datastream() override;
+
+        void update() override;
+        int controller_config_size() const override;
+
+        void handle_datastream() override;
+        void handle_controller_config() override;
+        void handle_oneline(oneline::Port port) override;
+
+        // Whether the host has configured a controller on port.
+        bool is_connected(oneline::Port port) const { return this->controllers[port].connected; }
+    private:
+        // The connected port after port, wrapping around. Returns port if none are connected.
+        int next_connected_port(int port) const;
+        // Asks the host for more data once the buffers drain past the low watermark.
+        void grant_credit();
+        // Queues the next streamed frame on its port.
+        void queue_frame(const byte frame[GAMECUBE_FRAME_SIZE]);
+        // True if the frames count more bytes complete all fit in their ports' buffers.
+        bool frames_fit(int count) const;
+
+        // Bytes granted to the host that have not arrived yet.
+        uint credit = 0;
+        int polls_per_frame = 1;
+        // Bytes of a frame split across two datastream packets.
+        byte partial_frame[GAMECUBE_FRAME_SIZE];
+        int partial_frame_size = 0;
+        // The port the next streamed frame belongs to.
+        int stream_port = 0;
+        ControllerConfig controllers[GAMECUBE_CONTROLLER_COUNT];
+        // The frame each port replies with, and how many more polls it gets.
+        // Replayed if a port's buffer runs dry.
+        uint32_t current_frame[GAMECUBE_CONTROLLER_COUNT][GAMECUBE_FRAME_WORDS];
+        int polls_left[GAMECUBE_CONTROLLER_COUNT] = {};
+        // Bumped by the main loop when the controllers are reconfigured, after
+        // recording where each port's new stream starts. Each port catches up
+        // on its next poll, so the IRQ is the only side touching polls_left.
+        uint stream_start[GAMECUBE_CONTROLLER_COUNT] = {};
+        std::atomic<uint> stream_generation{0};
+        uint port_generation[GAMECUBE_CONTROLLER_COUNT] = {};
+        // Set from the IRQ, reported from update.
+        byte rumble[GAMECUBE_CONTROLLER_COUNT] = {};
+        byte reported_rumble[GAMECUBE_CONTROLLER_COUNT] = {};
+        CircularQueue<uint32_t, GAMECUBE_BUFFER_FRAMES * GAMECUBE_FRAME_WORDS> databuffer[GAMECUBE_CONTROLLER_COUNT];
+    };
+}
@@ -0,0 +1,32 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include "consoles/common/oneline.h"
+
+namespace gamecube {
+    // Sizes are the bytes which follow the command byte.
+    constexpr oneline::CommandSize commands[] = {
+        { 0x00, 0, 3 },  // Identify Controller
+        { 0x40, 2, 8 },  // Read Inputs - poll mode & rumble
+        { 0x41, 0, 10 }, // Read Origin
+        { 0x42, 2, 10 }, // Calibrate
+        { 0x43, 2, 10 }, // Read Inputs, full precision
+        { 0xFF, 0, 3 },  // Reset Controller
+    };
+}
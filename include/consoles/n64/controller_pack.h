@@ -0,0 +1,50 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#define CONTROLLER_PACK_SIZE 0x8000
+#define CONTROLLER_PACK_BLOCK_SIZE 32
+// Third byte of the identify reply when a pack is inserted.
+#define CONTROLLER_PACK_INSERTED 0x01
+// And when nothing is.
+#define CONTROLLER_PACK_EMPTY 0x02
+
+namespace n64 {
+    // A 32KB Controller Pack. Console addresses carry the block address in
+    // the top 11 bits and a CRC of it in the low 5.
+    class ControllerPack {
+    public:
+        ControllerPack();
+        // Zeroes the image, like a new unformatted pack.
+        void clear();
+
+        // Returns false if the address CRC does not match.
+        static bool check_address(uint16_t address);
+        // CRC of a 32 byte block, sent after reads and as the reply to writes.
+        static byte data_crc(const byte data[CONTROLLER_PACK_BLOCK_SIZE]);
+        static inline byte data_crc_add(byte crc, byte data) { return crc_table[crc ^ data]; }
+
+        // Addresses past the end of the pack read as 0 and ignore writes.
+        void read_block(uint16_t address, byte data[CONTROLLER_PACK_BLOCK_SIZE]) const;
+        void write_block(uint16_t address, const byte data[CONTROLLER_PACK_BLOCK_SIZE]);
+
+        byte image[CONTROLLER_PACK_SIZE];
+    private:
+        static const byte crc_table[256];
+    };
+}
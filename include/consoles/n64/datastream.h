@@ -17,14 +17,25 @@
 #pragma once
 #include "global.h"
 #include "consoles/n64/model.h"
+#include "consoles/n64/controller_pack.h"
+#include "consoles/n64/input_codec.h"
 
 #include "consoles/common/oneline.h"
+#include "flash_movie.h"
 #include "circular_queue.h"
 
-#define DATASTREAM_BUFFER_SIZE 128
+#define DATASTREAM_FRAME_SIZE 4
 #define RAW_DATA_STREAM_SIZE 512
 #define N64_CONTROLLER_COUNT 4
 
+static_assert(DATASTREAM_LOW_WATERMARK <= DATASTREAM_HIGH_WATERMARK && DATASTREAM_HIGH_WATERMARK <= DATASTREAM_BUFFER_FRAMES,
+    "Datastream watermarks must fit in the buffer");
+// Grants are sent as 16 bits.
+static_assert(DATASTREAM_HIGH_WATERMARK * DATASTREAM_FRAME_SIZE * N64_CONTROLLER_COUNT <= 0xFFFF,
+    "Datastream high watermark is too large to grant at once");
+static_assert(DATASTREAM_PACKED_LOW_WATERMARK <= DATASTREAM_PACKED_BUFFER_SIZE && DATASTREAM_PACKED_BUFFER_SIZE <= 0xFFFF,
+    "Packed datastream watermark must fit in the buffer");
+
 namespace n64 {
     class Datastream : public BaseDevice, public oneline::OnelineHandler {
     public:
@@ -32,16 +43,65 @@ namespace n64 {
         ~Datastream() override;
 
         void update() override;
+        int controller_config_size() const override;
         
         void handle_datastream() override;
+        void handle_datastream_encoding() override;
         void handle_controller_config() override;
+        void handle_controller_pack_write() override;
+        void handle_controller_pack_read() override;
+        void handle_flash_movie_play() override;
         void handle_oneline(oneline::Port port) override;
+
+        // Whether the host has configured a controller on port.
+        bool is_connected(oneline::Port port) const { return this->controllers[port].connected; }
     private:
-        bool pending_data = false;
+        // The connected port after port, wrapping around. Returns port if none are connected.
+        int next_connected_port(int port) const;
+        // Applies a CONTROLLER_CONFIG, from the host or a flash movie.
+        void configure_controllers(const byte config[N64_CONTROLLER_COUNT][4]);
+        // Asks the host for more data once the buffers drain past the low watermark.
+        void grant_credit();
+        // Tops up every connected port's buffer from the flash movie.
+        void refill_from_flash();
+        // Called whenever the ports or encoding change.
+        void restart_stream();
+        // Queues the next streamed frame on its port.
+        void queue_frame(const byte frame[DATASTREAM_FRAME_SIZE]);
+        // True if the frames count more raw bytes complete all fit in their ports' buffers.
+        bool frames_fit(int count) const;
+        // True if every connected port can take the longest run a token expands to.
+        bool can_decode() const;
+        // Expands packed data into the port buffers, as far as they have room.
+        void decode_packed();
+
+        // Bytes granted to the host that have not arrived yet.
+        uint credit = 0;
+        // While playing a flash movie, the host is not asked for data.
+        bool flash_playback = false;
+        const byte* flash_next = nullptr;
+        const byte* flash_end = nullptr;
+        // Packed streams are held here until the port buffers have room.
+        bool packed = false;
+        InputDecoder decoder;
+        CircularQueue<byte, DATASTREAM_PACKED_BUFFER_SIZE> packed_data;
         uint last_event = 0;
         oneline::Port last_port;
-        byte last_input[4];
+        // Replayed if a port's buffer runs dry. Starts as no buttons pressed.
+        uint32_t last_reply[N64_CONTROLLER_COUNT] = { ~0u, ~0u, ~0u, ~0u };
+        // Bytes of a frame split across two datastream packets.
+        byte partial_frame[DATASTREAM_FRAME_SIZE];
+        int partial_frame_size = 0;
+        // The port the next streamed frame belongs to.
+        int stream_port = 0;
         ControllerConfig controllers[N64_CONTROLLER_COUNT];
-        CircularQueue<byte> databuffer = CircularQueue<byte>(DATASTREAM_BUFFER_SIZE);
+        // Claimed from pack_slots the first time a port is configured with a
+        // pack inserted. The slots start blank, and live in the device arena
+        // with the rest of the Datastream, so other devices reuse the RAM.
+        ControllerPack* packs[N64_CONTROLLER_COUNT] = {};
+        ControllerPack pack_slots[N64_CONTROLLER_COUNT];
+        // Set from the IRQ, reported from update.
+        uint pack_address_errors = 0;
+        CircularQueue<uint32_t, DATASTREAM_BUFFER_FRAMES> databuffer[N64_CONTROLLER_COUNT];
     };
 }
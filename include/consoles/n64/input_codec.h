@@ -0,0 +1,172 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include <string.h>
+
+// Packed input streams. Tokens expand to the same frames as raw datastream
+// records: one 4 byte frame per connected port, in port order. Every port's
+// previous frame starts as all zeros.
+//   00nnnnnn - Every port repeats its previous frame, n + 1 times.
+//   01xxxyyy - Buttons unchanged. The stick moves by x and y (signed 3 bits).
+//   10xxxyyy - 2 bytes of buttons follow. The stick moves by x and y.
+//   11000000 - A raw 4 byte frame follows.
+#define INPUT_CODEC_FRAME_SIZE 4
+#define INPUT_CODEC_MAX_PORTS 4
+// The most records a single token expands to.
+#define INPUT_CODEC_MAX_RUN 64
+// The most bytes a single frame encodes to.
+#define INPUT_CODEC_MAX_TOKEN 5
+
+namespace n64 {
+    enum InputToken : byte {
+        TOKEN_REPEAT = 0x00,
+        TOKEN_STICK = 0x40,
+        TOKEN_BUTTONS = 0x80,
+        TOKEN_RAW = 0xC0,
+    };
+
+    // Decodes a stream a byte at a time, so tokens may be split across packets.
+    class InputDecoder {
+    public:
+        // ports is the number of frames in each record.
+        void reset(int ports) {
+            this->ports = ports > 0 ? ports : 1;
+            this->slot = 0;
+            this->token_size = 0;
+            memset(this->previous, 0, sizeof(this->previous));
+        }
+
+        // Passes every frame the byte completes to emit(const byte frame[4]),
+        // in stream order. A byte emits at most INPUT_CODEC_MAX_RUN records.
+        template <typename Emit>
+        void add(byte data, Emit emit) {
+            this->token[this->token_size++] = data;
+            if (this->token_size < token_length(this->token[0])) { return; }
+            this->token_size = 0;
+
+            byte op = this->token[0] & 0xC0;
+            if (op == TOKEN_REPEAT) {
+                // Starts at the current slot, so a repeat never shifts the record boundary.
+                int frames = ((this->token[0] & 0x3F) + 1) * this->ports;
+                for (int x = 0; x < frames; x++) {
+                    emit(this->previous[(this->slot + x) % this->ports]);
+                }
+                return;
+            }
+
+            byte* frame = this->previous[this->slot];
+            if (op == TOKEN_RAW) {
+                memcpy(frame, this->token + 1, INPUT_CODEC_FRAME_SIZE);
+            } else {
+                if (op == TOKEN_BUTTONS) {
+                    frame[0] = this->token[1];
+                    frame[1] = this->token[2];
+                }
+                frame[2] += delta(this->token[0] >> 3);
+                frame[3] += delta(this->token[0]);
+            }
+            emit(frame);
+            this->slot = (this->slot + 1) % this->ports;
+        }
+
+        static int token_length(byte token) {
+            switch (token & 0xC0) {
+            case TOKEN_BUTTONS: return 3;
+            case TOKEN_RAW: return 1 + INPUT_CODEC_FRAME_SIZE;
+            default: return 1;
+            }
+        }
+
+        static int delta(byte bits) {
+            return ((bits & 0x07) ^ 0x04) - 0x04;
+        }
+
+    private:
+        int ports = 1;
+        int slot = 0;
+        byte previous[INPUT_CODEC_MAX_PORTS][INPUT_CODEC_FRAME_SIZE] = {};
+        byte token[INPUT_CODEC_MAX_TOKEN];
+        int token_size = 0;
+    };
+
+    // The host side of the codec. The firmware only decodes, but tools and the
+    // sim share this with it.
+    class InputEncoder {
+    public:
+        void reset(int ports) {
+            this->ports = ports > 0 ? ports : 1;
+            memset(this->previous, 0, sizeof(this->previous));
+        }
+
+        // Encodes count whole records. out needs room for
+        // count * ports * INPUT_CODEC_MAX_TOKEN bytes. Returns the bytes written.
+        int encode(const byte* records, int count, byte* out) {
+            int record_size = this->ports * INPUT_CODEC_FRAME_SIZE;
+            int size = 0;
+            int run = 0;
+            for (int x = 0; x < count; x++) {
+                const byte* record = records + x * record_size;
+                if (memcmp(record, this->previous, record_size) == 0) {
+                    if (++run == INPUT_CODEC_MAX_RUN) {
+                        out[size++] = TOKEN_REPEAT | (run - 1);
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0) {
+                    out[size++] = TOKEN_REPEAT | (run - 1);
+                    run = 0;
+                }
+
+                for (int port = 0; port < this->ports; port++) {
+                    size += encode_frame(this->previous[port], record + port * INPUT_CODEC_FRAME_SIZE, out + size);
+                }
+            }
+            if (run > 0) { out[size++] = TOKEN_REPEAT | (run - 1); }
+            return size;
+        }
+
+    private:
+        static int encode_frame(byte previous[INPUT_CODEC_FRAME_SIZE], const byte* frame, byte* out) {
+            int dx = (int8_t)(frame[2] - previous[2]);
+            int dy = (int8_t)(frame[3] - previous[3]);
+            bool small = dx >= -4 && dx <= 3 && dy >= -4 && dy <= 3;
+            bool same_buttons = frame[0] == previous[0] && frame[1] == previous[1];
+            memcpy(previous, frame, INPUT_CODEC_FRAME_SIZE);
+
+            byte stick = ((dx & 0x07) << 3) | (dy & 0x07);
+            if (small && same_buttons) {
+                out[0] = TOKEN_STICK | stick;
+                return 1;
+            }
+            if (small) {
+                out[0] = TOKEN_BUTTONS | stick;
+                out[1] = frame[0];
+                out[2] = frame[1];
+                return 3;
+            }
+            out[0] = TOKEN_RAW;
+            memcpy(out + 1, frame, INPUT_CODEC_FRAME_SIZE);
+            return 1 + INPUT_CODEC_FRAME_SIZE;
+        }
+
+        int ports = 1;
+        byte previous[INPUT_CODEC_MAX_PORTS][INPUT_CODEC_FRAME_SIZE] = {};
+    };
+}
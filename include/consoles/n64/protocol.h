@@ -16,26 +16,16 @@
 
 #pragma once
 #include "global.h"
-#include "consoles/n64/model.h"
 
 #include "consoles/common/oneline.h"
-#include "circular_queue.h"
-
-#define READER_BUFFER_SIZE 64
-#define READER_STREAM_SIZE 512
 
 namespace n64 {
-    class Recorder : public BaseDevice, public oneline::OnelineHandler {
-    public:
-        Recorder();
-        ~Recorder() override;
-
-        void update() override;
-        
-        void handle_oneline(oneline::Port port) override;
-    private:
-        byte last_invalid_command;
-        byte read_buffer[READER_BUFFER_SIZE] = {};
-        CircularQueue<byte> reader_data = CircularQueue<byte>(READER_STREAM_SIZE);
+    // Sizes are the bytes which follow the command byte.
+    constexpr oneline::CommandSize commands[] = {
+        { 0x00, 0, 3 },  // Identify Controller
+        { 0x01, 0, 4 },  // Read Inputs
+        { 0x02, 2, 33 }, // Read Controller Pack - address, then data & CRC
+        { 0x03, 34, 1 }, // Write Controller Pack - address & data, then CRC
+        { 0xFF, 0, 3 },  // Reset Controller
     };
 }
@@ -0,0 +1,76 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include "consoles/common/oneline.h"
+
+#define REALTIME_REPLY_SIZE 4
+#define N64_REALTIME_PORT_COUNT 4
+
+namespace n64 {
+    // Passes real controllers through to the console. Each one is polled on
+    // pio1 a little before the console is expected to read its port, so the
+    // console always gets the freshest state, with any host overlay applied.
+    class Realtime : public BaseDevice, public oneline::OnelineHandler, public oneline::RequestHandler {
+    public:
+        Realtime();
+        ~Realtime() override;
+
+        void update() override;
+        void handle_realtime_overlay() override;
+        void handle_oneline(oneline::Port port) override;
+        void handle_reply(oneline::Port port) override;
+    private:
+        struct Controller {
+            Realtime* device;
+            oneline::Port port;
+            // Only changed from update, or by the reply while requesting.
+            volatile bool connected = false;
+            byte header[3] = {};
+            // What connected was last reported to the host as.
+            bool reported = false;
+            volatile bool requesting = false;
+            bool aborted = false;
+            byte request = 0;
+            uint32_t request_start = 0;
+            uint32_t last_identify = 0;
+            // Set until the armed poll fires. The id is only for cancelling it.
+            volatile bool armed = false;
+            alarm_id_t alarm = 0;
+            // The encoded reply the console gets next, and when it arrived.
+            volatile uint32_t reply = ~0u;
+            volatile uint32_t fresh_at = 0;
+            // When the console last read this port, and how long it waited
+            // since the read before. A period of 0 is not known yet.
+            volatile uint32_t last_poll = 0;
+            volatile uint32_t poll_period = 0;
+            // Every reply becomes (reply & keep) | set, packed like the reply.
+            volatile uint32_t overlay_keep = ~0u;
+            volatile uint32_t overlay_set = 0;
+        };
+
+        // Sends a command to the real controller. Must not be requesting.
+        void start_request(Controller& controller, byte command);
+        // Arms the next poll, timed against the console's.
+        void schedule_poll(Controller& controller);
+        static int64_t poll_alarm(alarm_id_t id, void* user_data);
+
+        uint32_t cycles_per_us;
+        Controller controllers[N64_REALTIME_PORT_COUNT];
+    };
+}
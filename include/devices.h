@@ -21,4 +21,6 @@
 extern BaseDevice *current_device;
 
 void load_new_device();
-void reset_device();
\ No newline at end of file
+void reset_device();
+// Starts playing the flash movie, if it is set to play at power on.
+void load_autoplay_device();
\ No newline at end of file
@@ -0,0 +1,47 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include <hardware/sync.h>
+
+// Wakes the main loop. Anything with work for it signals an event, and the
+// loop sleeps in __wfe until one arrives instead of polling.
+namespace events {
+    enum Event : byte {
+        // USB has bytes from the host.
+        HOST_RX = 0,
+        // The oneline IRQ has used or queued data, so the device should update.
+        DEVICE = 1,
+        // Every EVENTS_HOUSEKEEPING_US, for flushing output and DMA captures.
+        HOUSEKEEPING = 2,
+        EVENT_COUNT = 3,
+    };
+
+    extern volatile bool pending[EVENT_COUNT];
+
+    // Safe from IRQs and either core.
+    inline void signal(Event event) {
+        pending[event] = true;
+        __sev();
+    }
+
+    void init();
+    // Sleeps until an event is signalled. Returns every signalled event as a
+    // bit mask (1 << Event), and clears them.
+    uint32_t wait();
+}
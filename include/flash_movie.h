@@ -0,0 +1,63 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include <hardware/flash.h>
+
+// A movie stored in the reserved end of flash, so playback doesn't depend on
+// the host. The flash is memory mapped through XIP, so frames are read in
+// place. Layout:
+//   1 page  - Header
+//   n bytes - records of one 4 byte frame per connected port, in port order,
+//             raw or packed
+namespace flash_movie {
+    #define FLASH_MOVIE_MAGIC "OTAM"
+    #define FLASH_MOVIE_VERSION 2
+    // Starts playing at power on, without waiting for the host.
+    #define FLASH_MOVIE_AUTOPLAY 0x01
+    // Encodings, the same as DATASTREAM_ENCODING.
+    #define FLASH_MOVIE_RAW 0
+    #define FLASH_MOVIE_PACKED 1
+
+    struct Header {
+        char magic[4];
+        uint32_t records;
+        // Bytes of record data after the header page.
+        uint32_t size;
+        byte version;
+        byte flags;
+        byte encoding;
+        char console[3];
+        byte reserved[2];
+        // The same as CONTROLLER_CONFIG: connected, then the 3 byte header.
+        byte controllers[4][4];
+    };
+    static_assert(sizeof(Header) <= FLASH_PAGE_SIZE, "Flash movie header must fit in a page");
+
+    // The stored movie's header, or nullptr if no valid movie is stored.
+    const Header* header();
+    // The first record, directly after the header page.
+    const byte* records();
+    // Bytes available for the header and records.
+    uint capacity();
+
+    // These stop the current device, since nothing may run from flash while
+    // it is being written.
+    void handle_erase();
+    void handle_program();
+}
@@ -17,26 +17,65 @@
 #include "global.h"
 #include "commands.h"
 #include "circular_queue.h"
+#include "labels.h"
 
 namespace io {
-    byte read_blocking();
+    // Sets up the binary log. Call before anything logs.
+    void init();
+
+    // Host commands are assembled as bytes arrive. receive() reads whatever
+    // USB has, and returns a command once its whole payload is here, or -1
+    // once nothing is left. The handler then reads the payload with
+    // read_byte(), which gives 0 past its end, or read_bytes(), which gives
+    // the next count bytes in place, or nullptr if the payload is shorter.
+    int receive();
+    byte read_byte();
+    const byte* read_bytes(int count);
+
+    // Frames are collected in an output buffer and handed to USB together.
+    // flush_if_due() sends them once the oldest has waited IO_FLUSH_WINDOW_US.
+    void flush();
+    void flush_if_due();
 
     // Message Writers
+    // Each writer builds one frame, which is closed when the writer is
+    // destroyed. Only one writer may be open at a time.
     class CommandWriter {
     public:
         CommandWriter(commands::device::Command command);
+        ~CommandWriter();
+
+        CommandWriter(const CommandWriter&) = delete;
+        CommandWriter& operator=(const CommandWriter&) = delete;
         
         CommandWriter& write_byte(byte data);
         CommandWriter& write_short(uint16_t data);
         CommandWriter& write_int(uint32_t data);
         CommandWriter& write_bytes(const byte *data, int count);
-        CommandWriter& write_bytes(CircularQueue<byte>* data, int count);
         CommandWriter& write_str(const char *data);
+
+        // Drains count bytes from the queue in at most two contiguous writes.
+        template <uint size>
+        CommandWriter& write_bytes(CircularQueue<byte, size>* data, int count) {
+            const byte* segment;
+            while (count > 0) {
+                int length = data->peek_contiguous(&segment);
+                if (length == 0) { break; }
+                if (length > count) { length = count; }
+                write_bytes(segment, length);
+                data->skip(length);
+                count -= length;
+            }
+            return *this;
+        }
     };
 
-    class LogWriter : private CommandWriter {
+    // Log writers build a text frame, or with IO_BINARY_LOGS, a message which
+    // is added to the log when the writer is destroyed. Binary logging is safe
+    // from IRQs and either core; the log is sent by flush_if_due().
+    class LogWriter {
     public:
-        LogWriter(commands::device::Command command, const char* msg);
+        LogWriter(commands::device::Command command, const labels::Message& message);
         ~LogWriter();
 
         LogWriter& write(const char* message);
@@ -49,11 +88,20 @@ namespace io {
         // Prevent log writers from being copied, calling destructor early
         LogWriter(const LogWriter&) = delete;
         LogWriter& operator=(const LogWriter&) = delete;
+    private:
+#ifdef IO_BINARY_LOGS
+        byte id;
+        int length = 0;
+        byte arguments[IO_LOG_ARGUMENT_SIZE];
+        void append(const byte* data, int count);
+#else
+        CommandWriter writer;
+#endif
     };
 
     class Debug : public LogWriter {
     public:
-        Debug(const char* message);
+        Debug(const labels::Message& message);
 
         Debug(const Debug&) = delete;
         Debug& operator=(const Debug&) = delete;
@@ -61,7 +109,7 @@ namespace io {
 
     class Info : public LogWriter {
     public:
-        Info(const char* message);
+        Info(const labels::Message& message);
 
         Info(const Info&) = delete;
         Info& operator=(const Info&) = delete;
@@ -69,7 +117,7 @@ namespace io {
 
     class Warn : public LogWriter {
     public:
-        Warn(const char* message);
+        Warn(const labels::Message& message);
 
         Warn(const Warn&) = delete;
         Warn& operator=(const Warn&) = delete;
@@ -77,7 +125,7 @@ namespace io {
 
     class Error : public LogWriter {
     public:
-        Error(const char* message);
+        Error(const labels::Message& message);
 
         Error(const Error&) = delete;
         Error& operator=(const Error&) = delete;
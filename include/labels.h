@@ -21,6 +21,7 @@ namespace labels {
     static constexpr char DEVICE_INFO[] = "OpenTAS https://github.com/Envian/open-tas-controller/";
 
     static constexpr char CONSOLE_N64[] = "N64";
+    static constexpr char CONSOLE_GAMECUBE[] = "GCN";
 
     static constexpr char DEVICE_TYPE_PLAYBACK[] = "PLAY";
     static constexpr char DEVICE_TYPE_RECORD[] = "RECORD";
@@ -29,32 +30,55 @@ namespace labels {
     // Realtime is for non-movie operations, such as mapping a PC controller to the device.
     static constexpr char DEVICE_TYPE_REALTIME[] = "REALTIME";
 
-    // PORT_INFO - Varies based on system.
-    static constexpr char DEBUG_PORT_INFO[] = "PORT_INFO";
+    // Log messages. With IO_BINARY_LOGS only the ID is sent, followed by the
+    // arguments listed here (see commands::device::LOG). IDs are grouped by
+    // level, and must not be reused.
+    struct Message {
+        byte id;
+        const char* text;
+    };
+
+    // Debug (0x00-0x3F)
+    // PORT_INFO - Port(byte) - Connected(byte) - Header(3 bytes)
+    static constexpr Message DEBUG_PORT_INFO = { 0x00, "PORT_INFO" };
     
-    // Infos
-    // DEVICE_INITIALIZED - Console(3char) - Type
-    static constexpr char INFO_DEVICE_INIT[] = "DEVICE_INIT";
-
-    // Warnings
-    // WARN_OP_NOT_IMPLEMENTED - Method Name
-    static constexpr char WARN_OP_NOT_IMPLEMENTED[] = "OP_NOT_IMPLEMENTED";
-    // WARN_NO_DEVICE - Method Name
-    static constexpr char WARN_NO_DEVICE[] = "NO_DEVICE_SETUP";
-    // WARN_UNKNOWN_CONSOLE_CMD - Method Name
-    static constexpr char WARN_UNKNOWN_CONSOLE_CMD[] = "UNKNOWN_CONSOLE_CMD";
-
-    // Errors
+    // Infos (0x40-0x7F)
+    // DEVICE_INITIALIZED - Console(str) - Type(str)
+    static constexpr Message INFO_DEVICE_INIT = { 0x40, "DEVICE_INIT" };
+    // INFO_FLASH_MOVIE_END - Records(int)
+    static constexpr Message INFO_FLASH_MOVIE_END = { 0x41, "FLASH_MOVIE_END" };
+    // INFO_RUMBLE - Port(byte) - Motor(byte: 0 stop, 1 rumble, 2 brake)
+    static constexpr Message INFO_RUMBLE = { 0x42, "RUMBLE" };
+
+    // Warnings (0x80-0xBF)
+    // WARN_OP_NOT_IMPLEMENTED - Method Name(str)
+    static constexpr Message WARN_OP_NOT_IMPLEMENTED = { 0x80, "OP_NOT_IMPLEMENTED" };
+    // WARN_NO_DEVICE - Method Name(str)
+    static constexpr Message WARN_NO_DEVICE = { 0x81, "NO_DEVICE_SETUP" };
+    // WARN_UNKNOWN_CONSOLE_CMD - Command(byte)
+    static constexpr Message WARN_UNKNOWN_CONSOLE_CMD = { 0x82, "UNKNOWN_CONSOLE_CMD" };
+    // WARN_PACK_ADDRESS_CRC - Count(int)
+    static constexpr Message WARN_PACK_ADDRESS_CRC = { 0x83, "PACK_ADDRESS_CRC" };
+
+    // Errors (0xC0-0xFF)
     // ERROR_UNKNOWN_COMMAND - Command(byte)
-    static constexpr char ERROR_UNKNOWN_COMMAND[] = "NO_DEVICE_SETUP";
+    static constexpr Message ERROR_UNKNOWN_COMMAND = { 0xC0, "NO_DEVICE_SETUP" };
     // ERROR_SUPPORT_DISABLED
-    static constexpr char ERROR_SUPPORT_DISABLED[] = "SUPPORT_DISABLED";
+    static constexpr Message ERROR_SUPPORT_DISABLED = { 0xC1, "SUPPORT_DISABLED" };
     // ERROR_UNKNOWN_DEVICE
-    static constexpr char ERROR_UNKNOWN_DEVICE[] = "UNKNOWN_DEVICE";
-    // ERROR_UNKNOWN_MODE
-    static constexpr char ERROR_UNKNOWN_MODE[] = "UNKNOWN_MODE";
-    // ERROR_BUFFER_UNDERFLOW - file - line
-    static constexpr char ERROR_BUFFER_UNDERFLOW[] = "BUFFER_UNDERFLOW";
-    // ERROR_BUFFER_OVERFLOW - file - line
-    static constexpr char ERROR_BUFFER_OVERFLOW[] = "BUFFER_OVERFLOW";
+    static constexpr Message ERROR_UNKNOWN_DEVICE = { 0xC2, "UNKNOWN_DEVICE" };
+    // ERROR_UNKNOWN_MODE - Console(str) - Mode(byte)
+    static constexpr Message ERROR_UNKNOWN_MODE = { 0xC3, "UNKNOWN_MODE" };
+    // ERROR_BUFFER_UNDERFLOW - File(str)
+    static constexpr Message ERROR_BUFFER_UNDERFLOW = { 0xC4, "BUFFER_UNDERFLOW" };
+    // ERROR_BUFFER_OVERFLOW - File(str)
+    static constexpr Message ERROR_BUFFER_OVERFLOW = { 0xC5, "BUFFER_OVERFLOW" };
+    // ERROR_NO_CONTROLLER_PACK - Port(byte)
+    static constexpr Message ERROR_NO_CONTROLLER_PACK = { 0xC6, "NO_CONTROLLER_PACK" };
+    // ERROR_FLASH_OFFSET - Offset(int)
+    static constexpr Message ERROR_FLASH_OFFSET = { 0xC7, "FLASH_OFFSET" };
+    // ERROR_NO_FLASH_MOVIE
+    static constexpr Message ERROR_NO_FLASH_MOVIE = { 0xC8, "NO_FLASH_MOVIE" };
+    // ERROR_UNSUPPORTED_DEVICE - Console(str)
+    static constexpr Message ERROR_UNSUPPORTED_DEVICE = { 0xC9, "UNSUPPORTED_DEVICE" };
 }
\ No newline at end of file
@@ -0,0 +1,79 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "global.h"
+
+#include <hardware/structs/systick.h>
+
+// Cycle counted latency histograms for the hot paths. Times come from the
+// SysTick counter, which is per core, so a measurement must start and end on
+// the same core. Histograms are written from IRQs without locking; a read
+// racing a write may be off by one sample.
+namespace stats {
+    enum Probe : byte {
+        // From entering the oneline IRQ to the first reply word being queued.
+        IRQ_TO_REPLY = 0,
+        // Whole oneline IRQ.
+        IRQ_DURATION = 1,
+        // Time spent in read_bytes_blocking.
+        READ_SPIN = 2,
+        // Longest wait between two PIO words in a read. Compare to ONELINE_READ_TIMEOUT_US.
+        READ_GAP = 3,
+        // Datastream, from handle_oneline to the reply being queued.
+        DATASTREAM_REPLY = 4,
+        // Recorder, from the command to the record being queued (or decoded in capture mode).
+        RECORDER_CAPTURE = 5,
+        // Realtime, how old the controller state is when the console reads it.
+        // Compare to REALTIME_POLL_LEAD_US.
+        REALTIME_AGE = 6,
+        // N64 Controller Pack reads, from the last request byte to the reply
+        // being ready to queue. Compare to how late a reply can be handed
+        // over (see N64_REPLY_DELAY_NS).
+        PACK_READ = 7,
+        PROBE_COUNT = 8,
+    };
+
+    // Each bucket is 2^STATS_BUCKET_SHIFT cycles wide, or 2^STATS_WIDE_BUCKET_SHIFT
+    // for REALTIME_AGE, which is measured against a lead of hundreds of
+    // microseconds. The last bucket also counts everything longer.
+    #define STATS_BUCKET_COUNT 32
+    #define STATS_BUCKET_SHIFT 8
+    #define STATS_WIDE_BUCKET_SHIFT 14
+
+    // Starts the cycle counter on the calling core.
+    void init();
+
+    inline uint32_t now() { return systick_hw->cvr; }
+    // SysTick counts down, and is 24 bits wide.
+    inline uint32_t elapsed(uint32_t start) { return (start - systick_hw->cvr) & 0xFFFFFF; }
+
+    void record_cycles(Probe probe, uint32_t cycles);
+    inline void record(Probe probe, uint32_t start) { record_cycles(probe, elapsed(start)); }
+
+    // Sends every histogram to the host, then clears them.
+    void send_and_reset();
+}
+
+#ifdef ENABLE_STATS
+#define STATS_START(NAME) uint32_t NAME = stats::now();
+#define STATS_RECORD(PROBE, START) stats::record(PROBE, START);
+#define STATS_RECORD_CYCLES(PROBE, CYCLES) stats::record_cycles(PROBE, CYCLES);
+#else
+#define STATS_START(NAME)
+#define STATS_RECORD(PROBE, START)
+#define STATS_RECORD_CYCLES(PROBE, CYCLES)
+#endif
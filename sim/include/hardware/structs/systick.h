@@ -0,0 +1,33 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "pico/stdlib.h"
+
+// The current value counts down with simulated time at clk_sys.
+struct systick_counter {
+    operator uint32_t() const;
+    systick_counter& operator=(uint32_t value);
+};
+
+typedef struct {
+    uint32_t csr;
+    uint32_t rvr;
+    systick_counter cvr;
+    uint32_t calib;
+} systick_hw_t;
+
+extern systick_hw_t* const systick_hw;
@@ -0,0 +1,36 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "pico/stdlib.h"
+
+// IRQs only run when the sim advances time, and flash writes are the only
+// users, so these do nothing.
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+// __wfe sleeps until the next simulated event, and throws sim::Finished once
+// the host is done, as getchar_timeout_us does.
+void __sev();
+void __wfe();
+
+// Everything runs on one thread, apart from core 1's start up, so locks only
+// need to exist.
+typedef struct { uint32_t locked; } spin_lock_t;
+int spin_lock_claim_unused(bool required);
+spin_lock_t* spin_lock_init(uint lock_num);
+uint32_t spin_lock_blocking(spin_lock_t* lock);
+void spin_unlock(spin_lock_t* lock, uint32_t saved_irq);
@@ -0,0 +1,49 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Hand written stand-in for the pioasm output of pio/oneline.pio. The public
+// offsets must match that file, since the firmware jumps to them.
+
+#pragma once
+#include "hardware/pio.h"
+
+#define oneline_F_PIO_MHZ 8
+#define oneline_F_PIO (oneline_F_PIO_MHZ * 1000000)
+#define oneline_REPLY_MIN_CYCLES 25
+
+#define oneline_offset_start 13u
+#define oneline_offset_fall_wait 24u
+#define oneline_offset_reset_bit 30u
+#define oneline_request_offset_reply_end 25u
+
+extern const pio_program_t oneline_program;
+extern const pio_program_t oneline_capture_program;
+extern const pio_program_t oneline_request_program;
+
+static inline pio_sm_config oneline_program_get_default_config(uint offset) {
+    (void)offset;
+    return pio_sm_config { &oneline_program, 1.0f, 0 };
+}
+
+static inline pio_sm_config oneline_capture_program_get_default_config(uint offset) {
+    (void)offset;
+    return pio_sm_config { &oneline_capture_program, 1.0f, 0 };
+}
+
+static inline pio_sm_config oneline_request_program_get_default_config(uint offset) {
+    (void)offset;
+    return pio_sm_config { &oneline_request_program, 1.0f, 0 };
+}
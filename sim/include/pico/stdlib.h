@@ -0,0 +1,69 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Simulator stand-in for the parts of the Pico SDK the firmware uses. Anything
+// which reads time or polls hardware advances the simulated clock.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef unsigned int uint;
+
+#define PICO_ERROR_TIMEOUT -1
+
+#define __time_critical_func(func_name) func_name
+#define __not_in_flash(group)
+#define __not_in_flash_func(func_name) func_name
+#define __force_inline inline __attribute__((always_inline))
+
+uint32_t time_us_32();
+uint64_t time_us_64();
+void tight_loop_contents();
+
+void stdio_init_all();
+int getchar_timeout_us(uint32_t timeout_us);
+// Reads whatever the host has sent, up to len bytes, in one go.
+typedef uint64_t absolute_time_t;
+absolute_time_t get_absolute_time();
+int stdio_get_until(char* buf, int len, absolute_time_t until);
+int putchar_raw(int c);
+int stdio_put_string(const char* s, int len, bool newline, bool cr_translation);
+// Called whenever the host has bytes waiting, since the sim has no USB IRQ.
+void stdio_set_chars_available_callback(void (*fn)(void*), void* param);
+
+// Timers fire as simulated events, like the PIO.
+typedef struct repeating_timer repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t* rt);
+struct repeating_timer {
+    int64_t delay_us;
+    repeating_timer_callback_t callback;
+    void* user_data;
+    bool cancelled;
+};
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out);
+bool cancel_repeating_timer(repeating_timer_t* timer);
+
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void* user_data);
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void* user_data, bool fire_if_past);
+bool cancel_alarm(alarm_id_t alarm_id);
+
+#define GPIO_OUT 1
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
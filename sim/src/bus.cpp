@@ -0,0 +1,1006 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// The other ends of the simulated wires: a console polling the ports, the
+// controllers answering it in record mode (or the device in realtime mode),
+// and the host on the USB side.
+
+#include "sim.h"
+#include "capture.h"
+
+#include <config.h>
+#include <commands.h>
+#include <labels.h>
+#include <flash_movie.h>
+#include <consoles/n64/input_codec.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Console timing, in nanoseconds.
+#define CONSOLE_START_NS 20000000ull
+#define CONSOLE_GAP_NS 20000ull
+// How long a controller waits after the console's stop bit before replying.
+#define CONTROLLER_DELAY_NS 2000ull
+// Replies must start this close to the same time after every stop bit.
+#define TURNAROUND_JITTER_NS 125ull
+#define HOST_SETUP_NS 1000000ull
+// Recorded inputs only change every few polls, so repeats get collapsed.
+#define RECORD_POLLS_PER_INPUT 8
+// Recorded timestamps must be within a bit of the transaction starting.
+#define RECORD_MAX_LAG_US 4
+// Long enough for the recorder to flush any collapsed repeats.
+#define HOST_DRAIN_NS 300000000ull
+// Realtime: how often the live controllers' inputs change.
+#define LIVE_INPUT_NS 50000ull
+// Realtime: what the host overlays on port 1's last byte.
+#define LIVE_OVERLAY 0xA5
+
+#define N64_IDENTIFY 0x00
+#define N64_READ_INPUTS 0x01
+#define N64_READ_PACK 0x02
+#define N64_WRITE_PACK 0x03
+#define N64_INPUT_SIZE 4
+#define GAMECUBE_READ_INPUTS 0x40
+#define GAMECUBE_READ_ORIGIN 0x41
+#define GAMECUBE_INPUT_SIZE 8
+#define GAMECUBE_ORIGIN_SIZE 10
+// Analog mode sent with every GameCube poll.
+#define GAMECUBE_POLL_MODE 0x03
+// The console switches each port's rumble motor this often.
+#define RUMBLE_TOGGLE_FRAMES 20
+#define MAX_INPUT_SIZE GAMECUBE_INPUT_SIZE
+#define PACK_SIZE 0x8000
+#define PACK_BLOCK_SIZE 32
+#define PACK_UPLOAD_CHUNK 128
+// The block the console writes, then reads back.
+#define PACK_TEST_ADDRESS 0x0420
+// Read back from the uploaded image, as a frame of 0x0A bytes whose data
+// starts with 0x0A, so line ending translation would corrupt it.
+#define PACK_NEWLINE_ADDRESS 0x009D
+#define PACK_NEWLINE_SIZE 7
+// Data bytes in the write the console cuts short.
+#define PACK_TRUNCATED_SIZE 5
+
+namespace sim {
+    Options options;
+
+    namespace {
+        const uint32_t port_pins[] = { ONELINE_PIN_PORT_1, ONELINE_PIN_PORT_2, ONELINE_PIN_PORT_3, ONELINE_PIN_PORT_4 };
+        const uint32_t live_pins[] = { REALTIME_PIN_PORT_1, REALTIME_PIN_PORT_2, REALTIME_PIN_PORT_3, REALTIME_PIN_PORT_4 };
+        const uint8_t controller_header[] = { 0x05, 0x00, 0x02 };
+        const uint8_t controller_header_pack[] = { 0x05, 0x00, 0x01 };
+        const uint8_t gamecube_header[] = { 0x09, 0x00, 0x03 };
+        const uint8_t gamecube_origin[GAMECUBE_ORIGIN_SIZE] = { 0x00, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x00, 0x00, 0x00 };
+
+        bool gamecube() { return options.console == CONSOLE_GAMECUBE; }
+        int input_size() { return gamecube() ? GAMECUBE_INPUT_SIZE : N64_INPUT_SIZE; }
+        uint8_t read_inputs() { return gamecube() ? GAMECUBE_READ_INPUTS : N64_READ_INPUTS; }
+        // GameCube frames last for every poll of a console frame.
+        uint32_t movie_records() { return gamecube() ? options.frames : options.frames * options.polls_per_frame; }
+        // Mixed mode streams the first ports, and has a live controller on the last.
+        bool recorded(int port) { return options.mode == MODE_RECORD || (options.mode == MODE_MIXED && port == options.ports - 1); }
+        int streamed_ports() { return options.mode == MODE_RECORD ? 0 : options.mode == MODE_MIXED ? options.ports - 1 : options.ports; }
+
+        // With --pack, port 1 has a Controller Pack inserted.
+        std::vector<uint8_t> header_for(int port) {
+            const uint8_t* header = gamecube() ? gamecube_header
+                : options.pack && port == 0 ? controller_header_pack : controller_header;
+            return std::vector<uint8_t>(header, header + 3);
+        }
+
+        uint8_t rumble_for(int frame, int port) { return (frame / RUMBLE_TOGGLE_FRAMES + port) % 2; }
+
+        uint8_t pack_image(uint32_t address) { return address * 31 + 7; }
+        uint8_t pack_written(uint32_t address) { return address * 17 + 3; }
+
+        // Done bit by bit, as a check on the firmware's table.
+        uint8_t pack_data_crc(const uint8_t* data) {
+            uint8_t crc = 0;
+            for (int x = 0; x <= PACK_BLOCK_SIZE; x++) {
+                for (int bit = 7; bit >= 0; bit--) {
+                    uint8_t feedback = crc & 0x80 ? 0x85 : 0;
+                    crc <<= 1;
+                    if (x < PACK_BLOCK_SIZE && (data[x] >> bit) & 1) { crc |= 1; }
+                    crc ^= feedback;
+                }
+            }
+            return crc;
+        }
+
+        uint16_t pack_address(uint16_t address) {
+            uint8_t crc = 0;
+            for (int bit = 15; bit >= 0; bit--) {
+                uint8_t feedback = crc & 0x10 ? 0x15 : 0;
+                crc = ((crc << 1) | (bit >= 5 ? (address >> bit) & 1 : 0)) & 0x1F;
+                crc ^= feedback;
+            }
+            return (address & ~0x1F) | crc;
+        }
+
+        // Every input frame is different, so held or skipped frames show up.
+        // Packed streams get inputs that change slowly on each port, like real
+        // ones, so they actually compress.
+        void input_frame(uint32_t index, uint8_t frame[MAX_INPUT_SIZE]) {
+            if (gamecube()) {
+                frame[0] = index >> 8;
+                frame[1] = index;
+                frame[2] = index * 7;
+                frame[3] = index * 13;
+                frame[4] = index * 3;
+                frame[5] = index * 5;
+                frame[6] = index * 11;
+                frame[7] = index * 17;
+                return;
+            }
+            if (options.packed) {
+                uint32_t n = index / 4;
+                frame[0] = (n >> 12) | ((index % 4) << 4);
+                frame[1] = n >> 4;
+                frame[2] = n & 0x0F;
+                frame[3] = 0;
+                return;
+            }
+            frame[0] = index >> 8;
+            frame[1] = index;
+            frame[2] = index * 7;
+            frame[3] = index * 13;
+        }
+
+        // Realtime: a live controller's inputs, which change every
+        // LIVE_INPUT_NS. The last byte checks the rest.
+        void live_frame(uint32_t index, int port, uint8_t frame[N64_INPUT_SIZE]) {
+            frame[0] = index >> 16;
+            frame[1] = index >> 8;
+            frame[2] = index;
+            frame[3] = port == 0 ? LIVE_OVERLAY : index * 13 + port * 64;
+        }
+
+        struct Transaction {
+            int port;
+            uint8_t command;
+            std::vector<uint8_t> request;
+            int response_bytes;
+            // Checked exactly when set.
+            std::vector<uint8_t> expected;
+            uint64_t stop_fall;
+            std::vector<std::pair<WireBit, uint64_t>> reply;
+            // Cut short by the console, so there must be no reply.
+            bool truncated = false;
+        };
+
+        // What actually happened on the bus, for checking recordings against.
+        struct BusRecord {
+            uint8_t command;
+            std::vector<uint8_t> response;
+            uint64_t time;
+        };
+
+        struct Console {
+            bool active = false;
+            bool finished = false;
+            Transaction current;
+            // When frame -1 starts.
+            uint64_t start = CONSOLE_START_NS;
+            int frame = -1;
+            int step = 0;
+            uint64_t polls = 0;
+            uint32_t port_polls[4] = {};
+
+            uint64_t ok = 0;
+            uint64_t held = 0;
+            uint64_t mismatched = 0;
+            uint64_t missing = 0;
+            uint64_t bad_identify = 0;
+            uint64_t pack_ok = 0;
+            uint64_t pack_bad = 0;
+            uint64_t turnaround_min = UINT64_MAX;
+            uint64_t turnaround_max = 0;
+            uint64_t turnaround_total = 0;
+            uint64_t turnaround_count = 0;
+            // The device's replies alone, split by the last request bit,
+            // which their turnaround must not depend on.
+            uint64_t device_turnaround_min = UINT64_MAX;
+            uint64_t device_turnaround_max = 0;
+            uint64_t turnaround_by_bit_total[2] = {};
+            uint64_t turnaround_by_bit_count[2] = {};
+            // Realtime: how old the inputs were when the console polled for them.
+            uint64_t age_max = 0;
+            uint64_t age_total = 0;
+            uint32_t last_live[4] = {};
+
+            // Datastream mode: the next frame the host queued, and the last reply, per port.
+            uint32_t next_expected[4] = {};
+            std::vector<uint8_t> last_reply[4];
+            // GameCube: polls the expected frame has had, and rumble motor changes.
+            int expected_polls[4] = {};
+            uint8_t rumble[4] = {};
+            uint64_t rumble_changes = 0;
+
+            std::vector<BusRecord> log[4];
+        } console;
+
+        // Realtime: the bits the device has sent each live controller.
+        struct LiveController {
+            std::vector<WireBit> request;
+            uint64_t requests = 0;
+        } live[4];
+
+        struct Host {
+            std::deque<std::pair<uint64_t, uint8_t>> outgoing;
+            bool done = false;
+            uint32_t next_frame = 0;
+            uint64_t requests = 0;
+            // Datastream bytes granted by the device and not yet sent.
+            uint32_t credit = 0;
+            uint64_t chunks = 0;
+            // Packed streams: encoded but not yet sent.
+            n64::InputEncoder encoder;
+            std::deque<uint8_t> packed;
+            uint64_t packed_bytes = 0;
+            uint64_t errors = 0;
+            bool got_stats = false;
+            int pack_downloads = 0;
+            int pack_download_errors = 0;
+            // Flash pages the device has finished programming.
+            size_t flash_pages = 0;
+            size_t flash_acks = 0;
+            // GameCube: rumble changes the device reported.
+            uint8_t rumble[4] = {};
+            uint64_t rumble_reports = 0;
+            // Binary logs: frames, messages in them, times those were logged, and drops.
+            uint64_t log_frames = 0;
+            uint64_t log_messages = 0;
+            uint64_t log_count = 0;
+            uint64_t log_dropped = 0;
+
+            // Record mode
+            uint64_t matched = 0;
+            uint64_t record_mismatches = 0;
+            uint64_t max_lag_us = 0;
+            size_t next_record[4] = {};
+            // Records which got here before the console finished the transaction.
+            std::deque<CaptureRecord> early_records[4];
+        } host;
+
+        void send(std::vector<uint8_t> data, uint64_t at) {
+            host_send(data.data(), data.size(), at);
+        }
+
+        // Records from first, one frame per port, as the host would stream them.
+        std::vector<uint8_t> make_records(uint32_t first, uint32_t count) {
+            std::vector<uint8_t> records;
+            for (uint32_t record = first; record < first + count; record++) {
+                for (int port = 0; port < streamed_ports(); port++) {
+                    uint8_t frame[MAX_INPUT_SIZE];
+                    input_frame(record * 4 + port, frame);
+                    records.insert(records.end(), frame, frame + input_size());
+                }
+            }
+            return records;
+        }
+
+        std::vector<uint8_t> pack(n64::InputEncoder& encoder, const std::vector<uint8_t>& records) {
+            std::vector<uint8_t> packed(records.size() / N64_INPUT_SIZE * INPUT_CODEC_MAX_TOKEN);
+            packed.resize(encoder.encode(records.data(), records.size() / (N64_INPUT_SIZE * streamed_ports()), packed.data()));
+            return packed;
+        }
+
+        // The same records the host would stream, behind a header page.
+        std::vector<uint8_t> flash_image(bool autoplay) {
+            uint32_t records = movie_records();
+            std::vector<uint8_t> data = make_records(0, records);
+            if (options.packed) {
+                n64::InputEncoder encoder;
+                encoder.reset(options.ports);
+                data = pack(encoder, data);
+            }
+
+            std::vector<uint8_t> image(FLASH_PAGE_SIZE, 0);
+            flash_movie::Header* header = (flash_movie::Header*)image.data();
+            memcpy(header->magic, FLASH_MOVIE_MAGIC, sizeof(header->magic));
+            header->records = records;
+            header->size = data.size();
+            header->version = FLASH_MOVIE_VERSION;
+            header->flags = autoplay ? FLASH_MOVIE_AUTOPLAY : 0;
+            header->encoding = options.packed ? FLASH_MOVIE_PACKED : FLASH_MOVIE_RAW;
+            memcpy(header->console, "N64", sizeof(header->console));
+            for (int port = 0; port < 4; port++) {
+                std::vector<uint8_t> port_header = header_for(port);
+                header->controllers[port][0] = port < options.ports;
+                memcpy(&header->controllers[port][1], port_header.data(), 3);
+            }
+            image.insert(image.end(), data.begin(), data.end());
+            // Programming is done in whole pages.
+            image.resize((image.size() + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE, 0xFF);
+            return image;
+        }
+
+        void upload_flash_movie() {
+            std::vector<uint8_t> image = flash_image(false);
+            uint32_t size = image.size();
+            send({ commands::host::FLASH_MOVIE_ERASE, (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24) }, HOST_SETUP_NS);
+            for (uint32_t offset = 0; offset < size; offset += FLASH_PAGE_SIZE) {
+                std::vector<uint8_t> page { commands::host::FLASH_MOVIE_PROGRAM,
+                    (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16), (uint8_t)(offset >> 24) };
+                page.insert(page.end(), image.begin() + offset, image.begin() + offset + FLASH_PAGE_SIZE);
+                send(page, HOST_SETUP_NS);
+                host.flash_pages++;
+            }
+        }
+
+        // The host sends nothing during the stall, which starts halfway through the run.
+        uint64_t host_send_time() {
+            uint64_t at = now() + options.host_latency_us * 1000;
+            uint64_t stall_start = options.frames * options.poll_interval_us * 1000 / 2;
+            uint64_t stall_end = stall_start + options.host_stall_ms * 1000000;
+            return at >= stall_start && at < stall_end ? stall_end : at;
+        }
+
+        // Spends all of the credit, in packets of whole records. Each record is one
+        // frame per port, and frames are unique across ports.
+        void send_datastream() {
+            int record_size = input_size() * streamed_ports();
+            uint64_t at = host_send_time();
+            // Packed credit is in bytes of the stream, which is encoded as it's needed.
+            while (options.packed && host.credit > 0) {
+                uint32_t size = std::min<uint32_t>(host.credit, 0xFF);
+                while (host.packed.size() < size) {
+                    std::vector<uint8_t> packed = pack(host.encoder, make_records(host.next_frame, INPUT_CODEC_MAX_RUN));
+                    host.packed.insert(host.packed.end(), packed.begin(), packed.end());
+                    host.next_frame += INPUT_CODEC_MAX_RUN;
+                }
+                std::vector<uint8_t> packet { commands::host::DATASTREAM_DATA, (uint8_t)size };
+                packet.insert(packet.end(), host.packed.begin(), host.packed.begin() + size);
+                host.packed.erase(host.packed.begin(), host.packed.begin() + size);
+                host.credit -= size;
+                host.packed_bytes += size;
+                host.chunks++;
+                send(packet, at);
+            }
+            while (host.credit >= (uint32_t)record_size) {
+                int records = std::min<uint32_t>(host.credit, 0xFF) / record_size;
+                std::vector<uint8_t> packet { commands::host::DATASTREAM_DATA, (uint8_t)(records * record_size) };
+                for (int x = 0; x < records; x++, host.next_frame++) {
+                    for (int port = 0; port < streamed_ports(); port++) {
+                        uint8_t frame[MAX_INPUT_SIZE];
+                        input_frame(host.next_frame * 4 + port, frame);
+                        packet.insert(packet.end(), frame, frame + input_size());
+                    }
+                }
+                host.credit -= records * record_size;
+                host.chunks++;
+                send(packet, at);
+            }
+        }
+
+        // --------------------
+        // |     CONSOLE      |
+        // --------------------
+
+        void run_step();
+        void match_early_records(int port);
+
+        void drive_byte(uint32_t pin, uint8_t value, uint64_t start, int driver) {
+            for (int bit = 0; bit < 8; bit++) {
+                WireBit wire = (value & (0x80 >> bit)) ? WIRE_1 : WIRE_0;
+                uint64_t fall = start + bit * BIT_NS;
+                schedule(fall, [pin, wire, fall, driver] { drive_bit(pin, wire, fall, driver); });
+            }
+        }
+
+        void controller_reply(const Transaction& transaction, const std::vector<uint8_t>& response) {
+            uint32_t pin = port_pins[transaction.port];
+            uint64_t start = transaction.stop_fall + BIT_NS + CONTROLLER_DELAY_NS;
+            for (size_t x = 0; x < response.size(); x++) {
+                drive_byte(pin, response[x], start + x * 8 * BIT_NS, DRIVER_CONTROLLER);
+            }
+            uint64_t stop = start + response.size() * 8 * BIT_NS;
+            schedule(stop, [pin, stop] { drive_bit(pin, WIRE_STOP, stop, DRIVER_CONTROLLER); });
+        }
+
+        std::vector<uint8_t> expected_response(uint8_t command, int port) {
+            if (command == N64_IDENTIFY) {
+                return header_for(port);
+            }
+            if (gamecube() && command == GAMECUBE_READ_ORIGIN) {
+                return std::vector<uint8_t>(gamecube_origin, gamecube_origin + GAMECUBE_ORIGIN_SIZE);
+            }
+            uint8_t frame[MAX_INPUT_SIZE];
+            input_frame(console.port_polls[port] / RECORD_POLLS_PER_INPUT, frame);
+            return std::vector<uint8_t>(frame, frame + input_size());
+        }
+
+        // The reply must be a whole live frame, no older than the last one,
+        // and from before the poll.
+        void check_live(const Transaction& transaction, const std::vector<uint8_t>& response) {
+            int port = transaction.port;
+            uint32_t index = (response[0] << 16) | (response[1] << 8) | response[2];
+            uint8_t frame[N64_INPUT_SIZE];
+            live_frame(index, port, frame);
+            uint64_t poll = transaction.stop_fall - (1 + transaction.request.size()) * 8 * BIT_NS;
+
+            if (memcmp(response.data(), frame, N64_INPUT_SIZE) != 0 || index < console.last_live[port] || index * LIVE_INPUT_NS > poll) {
+                console.mismatched++;
+                if (options.verbose) { printf("%10.3fms port %d: wrong live inputs %06X\n", now() / 1e6, port + 1, index); }
+                return;
+            }
+            console.ok++;
+            console.last_live[port] = index;
+
+            uint64_t age = poll - index * LIVE_INPUT_NS;
+            console.age_max = std::max(console.age_max, age);
+            console.age_total += age;
+        }
+
+        void finish_transaction() {
+            Transaction& transaction = console.current;
+            console.active = false;
+
+            // Decode whatever the other side drove, up to its stop bit.
+            std::vector<uint8_t> response;
+            bool stopped = false;
+            uint8_t value = 0;
+            int bits = 0;
+            for (auto& bit : transaction.reply) {
+                if (bit.first == WIRE_STOP) {
+                    stopped = true;
+                    break;
+                }
+                value = (value << 1) | (bit.first == WIRE_1 ? 1 : 0);
+                if (++bits == 8) {
+                    response.push_back(value);
+                    bits = 0;
+                }
+            }
+
+            if (transaction.truncated) {
+                if (transaction.reply.empty()) {
+                    console.pack_ok++;
+                } else {
+                    console.pack_bad++;
+                    if (options.verbose) { printf("%10.3fms port %d cmd %02X: replied to a short request\n", now() / 1e6, transaction.port + 1, transaction.command); }
+                }
+                schedule(now() + CONSOLE_GAP_NS, run_step);
+                return;
+            }
+
+            uint64_t stop_rise = transaction.stop_fall + low_ns(WIRE_1);
+            // A reply that starts during the console's stop bit collides with it.
+            if (transaction.reply.empty() || transaction.reply[0].second < stop_rise
+                    || transaction.reply[0].second > stop_rise + options.reply_timeout_us * 1000
+                    || !stopped || bits != 0 || (int)response.size() != transaction.response_bytes) {
+                console.missing++;
+                if (options.verbose) {
+                    printf("%10.3fms port %d cmd %02X: no valid reply (%zu bits)\n",
+                        now() / 1e6, transaction.port + 1, transaction.command, transaction.reply.size());
+                }
+            } else {
+                uint64_t turnaround = transaction.reply[0].second - stop_rise;
+                console.turnaround_min = std::min(console.turnaround_min, turnaround);
+                console.turnaround_max = std::max(console.turnaround_max, turnaround);
+                console.turnaround_total += turnaround;
+                console.turnaround_count++;
+                if (!recorded(transaction.port)) {
+                    int last_bit = (transaction.request.empty() ? transaction.command : transaction.request.back()) & 1;
+                    console.device_turnaround_min = std::min(console.device_turnaround_min, turnaround);
+                    console.device_turnaround_max = std::max(console.device_turnaround_max, turnaround);
+                    console.turnaround_by_bit_total[last_bit] += turnaround;
+                    console.turnaround_by_bit_count[last_bit]++;
+                }
+
+                if (transaction.command == N64_IDENTIFY) {
+                    if (response != expected_response(N64_IDENTIFY, transaction.port)) { console.bad_identify++; }
+                } else if (!transaction.expected.empty()) {
+                    if (response == transaction.expected) {
+                        console.pack_ok++;
+                    } else {
+                        console.pack_bad++;
+                        if (options.verbose) { printf("%10.3fms port %d cmd %02X: wrong reply\n", now() / 1e6, transaction.port + 1, transaction.command); }
+                    }
+                } else if (recorded(transaction.port)) {
+                    console.ok++;
+                } else if (options.mode == MODE_REALTIME) {
+                    check_live(transaction, response);
+                } else {
+                    // GameCube frames are expected for every poll of a frame.
+                    int port = transaction.port;
+                    int polls = gamecube() ? options.polls_per_frame : 1;
+                    uint8_t expected[MAX_INPUT_SIZE];
+                    input_frame(console.next_expected[port] * 4 + port, expected);
+                    if (memcmp(response.data(), expected, input_size()) == 0) {
+                        console.ok++;
+                        if (++console.expected_polls[port] == polls) {
+                            console.expected_polls[port] = 0;
+                            console.next_expected[port]++;
+                        }
+                    } else if (response == console.last_reply[port]) {
+                        console.held++;
+                    } else {
+                        console.mismatched++;
+                        console.expected_polls[port] = 0;
+                        console.next_expected[port]++;
+                    }
+                    console.last_reply[port] = response;
+                }
+
+                console.log[transaction.port].push_back(BusRecord { transaction.command, response,
+                    transaction.stop_fall - (1 + transaction.request.size()) * 8 * BIT_NS });
+                match_early_records(transaction.port);
+            }
+
+            if (transaction.command == read_inputs()) { console.port_polls[transaction.port]++; }
+            schedule(now() + CONSOLE_GAP_NS, run_step);
+        }
+
+        void begin_transaction(int port, uint8_t command, std::vector<uint8_t> request = {}, std::vector<uint8_t> expected = {}) {
+            uint64_t start = now();
+            Transaction& transaction = console.current;
+            int response_bytes = !expected.empty() ? expected.size() : command == N64_IDENTIFY ? 3 : input_size();
+            transaction = Transaction { port, command, request, response_bytes, expected, start + (1 + request.size()) * 8 * BIT_NS, {} };
+            console.active = true;
+
+            uint32_t pin = port_pins[port];
+            drive_byte(pin, command, start, DRIVER_CONSOLE);
+            for (size_t x = 0; x < request.size(); x++) {
+                drive_byte(pin, request[x], start + (x + 1) * 8 * BIT_NS, DRIVER_CONSOLE);
+            }
+            // The console's stop bit is indistinguishable from a 1.
+            uint64_t stop = transaction.stop_fall;
+            schedule(stop, [pin, stop] { drive_bit(pin, WIRE_1, stop, DRIVER_CONSOLE); });
+
+            if (recorded(port)) {
+                controller_reply(transaction, expected_response(command, port));
+            }
+
+            uint64_t end = stop + BIT_NS + options.reply_timeout_us * 1000
+                + (transaction.response_bytes * 8 + 1) * BIT_NS;
+            schedule(end, finish_transaction);
+        }
+
+        void finish_console();
+
+        // Reads a block, starts a write but stops after a few bytes, writes
+        // properly, then reads it back.
+        void pack_step(int step) {
+            uint16_t address = pack_address(step == 0 ? 0 : PACK_TEST_ADDRESS);
+            std::vector<uint8_t> request { (uint8_t)(address >> 8), (uint8_t)address };
+            std::vector<uint8_t> block(PACK_BLOCK_SIZE);
+            for (int x = 0; x < PACK_BLOCK_SIZE; x++) {
+                block[x] = step == 0 ? pack_image(x) : pack_written(PACK_TEST_ADDRESS + x);
+            }
+
+            if (step == 1) {
+                request.insert(request.end(), block.begin(), block.begin() + PACK_TRUNCATED_SIZE);
+                begin_transaction(0, N64_WRITE_PACK, request);
+                console.current.truncated = true;
+            } else if (step == 2) {
+                request.insert(request.end(), block.begin(), block.end());
+                begin_transaction(0, N64_WRITE_PACK, request, { pack_data_crc(block.data()) });
+            } else {
+                block.push_back(pack_data_crc(block.data()));
+                begin_transaction(0, N64_READ_PACK, request, block);
+            }
+        }
+
+        // GameCube polls carry the rumble motor state.
+        void poll(int port) {
+            if (!gamecube()) {
+                begin_transaction(port, N64_READ_INPUTS);
+                return;
+            }
+            uint8_t motor = rumble_for(console.frame, port);
+            // Only streamed ports report rumble; a live controller just gets it.
+            if (motor != console.rumble[port] && !recorded(port)) {
+                console.rumble[port] = motor;
+                console.rumble_changes++;
+            }
+            begin_transaction(port, GAMECUBE_READ_INPUTS, { GAMECUBE_POLL_MODE, motor });
+        }
+
+        // Frame -1 identifies every port (and tests the pack, or reads the
+        // GameCube origins), the rest poll each port in turn.
+        void run_step() {
+            const int pack_steps = 4;
+            if (console.frame < 0 && options.pack && console.step >= options.ports && console.step < options.ports + pack_steps) {
+                pack_step(console.step++ - options.ports);
+                return;
+            }
+
+            int setup_steps = options.ports * (gamecube() ? 2 : 1) + (options.pack ? pack_steps : 0);
+            int steps = console.frame < 0 ? setup_steps : options.ports * options.polls_per_frame;
+            if (console.step < steps) {
+                int port = console.step % options.ports;
+                bool origin = console.step >= options.ports;
+                console.step++;
+                if (console.frame >= 0) {
+                    console.polls++;
+                    poll(port);
+                } else if (origin) {
+                    begin_transaction(port, GAMECUBE_READ_ORIGIN, {},
+                        std::vector<uint8_t>(gamecube_origin, gamecube_origin + GAMECUBE_ORIGIN_SIZE));
+                } else {
+                    begin_transaction(port, N64_IDENTIFY);
+                }
+                return;
+            }
+
+            console.frame++;
+            console.step = 0;
+            if (console.frame >= options.frames) {
+                finish_console();
+                return;
+            }
+            schedule(console.start + (console.frame + 1) * options.poll_interval_us * 1000, run_step);
+        }
+
+        // --------------------
+        // |       HOST       |
+        // --------------------
+
+        void finish_console() {
+            console.finished = true;
+            if (options.pack) {
+                send({ commands::host::CONTROLLER_PACK_READ, 0, PACK_TEST_ADDRESS & 0xFF, PACK_TEST_ADDRESS >> 8, PACK_BLOCK_SIZE }, now());
+                send({ commands::host::CONTROLLER_PACK_READ, 0, PACK_NEWLINE_ADDRESS & 0xFF, PACK_NEWLINE_ADDRESS >> 8, PACK_NEWLINE_SIZE }, now());
+            }
+            // Let the recorder catch up before asking for stats and stopping.
+            send({ commands::host::GET_STATS, commands::host::STOP_DEVICE }, now() + HOST_DRAIN_NS);
+            host.done = true;
+        }
+
+        void match_record(const CaptureRecord& record) {
+            const BusRecord& actual = console.log[record.port][host.next_record[record.port]++];
+            if (actual.command != record.command || actual.response != record.response) {
+                host.record_mismatches++;
+                if (options.verbose) { printf("%10.3fms port %d: recorded cmd %02X does not match the bus\n", now() / 1e6, record.port + 1, record.command); }
+                return;
+            }
+            host.matched++;
+
+            uint64_t lag = record.timestamp > actual.time / 1000 ? record.timestamp - actual.time / 1000 : 0;
+            host.max_lag_us = std::max(host.max_lag_us, lag);
+        }
+
+        // Busy USB traffic can deliver a record before the console is done
+        // waiting out the reply, so records wait for their transaction.
+        void match_early_records(int port) {
+            std::deque<CaptureRecord>& early = host.early_records[port];
+            while (!early.empty() && host.next_record[port] < console.log[port].size()) {
+                match_record(early.front());
+                early.pop_front();
+            }
+        }
+
+        void check_record(const CaptureRecord& record) {
+            host.early_records[record.port].push_back(record);
+            match_early_records(record.port);
+        }
+
+        void handle_stats(const std::vector<uint8_t>& data) {
+            static const char* names[] = {
+                "irq to reply", "irq duration", "read spin", "read gap", "datastream reply", "recorder capture", "realtime age", "pack read"
+            };
+            auto u32 = [&data](size_t offset) {
+                return data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) | ((uint32_t)data[offset + 3] << 24);
+            };
+
+            host.got_stats = true;
+            int probes = data[0];
+            int buckets = data[1];
+            double mhz = u32(2) / 1e6;
+            size_t offset = 6;
+
+            printf("Stats:\n");
+            for (int probe = 0; probe < probes; probe++) {
+                int shift = data[offset];
+                uint32_t count = u32(offset + 1);
+                uint32_t max = u32(offset + 5);
+                uint32_t p99 = 0;
+                uint64_t seen = 0;
+                for (int bucket = 0; bucket < buckets; bucket++) {
+                    seen += u32(offset + 9 + bucket * 4);
+                    if (!p99 && seen * 100 >= (uint64_t)count * 99) { p99 = (bucket + 1) << shift; }
+                }
+                offset += 9 + buckets * 4;
+
+                if (count) {
+                    printf("  %-18s %8u samples, p99 < %7.2fus, max %7.2fus (%d cycle buckets)\n",
+                        probe < (int)(sizeof(names) / sizeof(*names)) ? names[probe] : "?", count, p99 / mhz, max / mhz, 1 << shift);
+                }
+            }
+        }
+
+        CaptureDecoder captures(check_record);
+
+        void handle_frame(uint8_t command, const std::vector<uint8_t>& payload) {
+            switch (command) {
+            case commands::device::DATASTREAM_REQUEST: {
+                // Anything sent now would arrive after STOP_DEVICE.
+                if (host.done) { break; }
+                host.requests++;
+                host.credit += payload[0] | (payload[1] << 8);
+                send_datastream();
+                break;
+            }
+            case commands::device::CAPTURE_DATA:
+                captures.decode(payload);
+                break;
+            case commands::device::STATS:
+                handle_stats(payload);
+                break;
+            case commands::device::CONTROLLER_PACK_DATA: {
+                host.pack_downloads++;
+                uint32_t address = payload.size() >= 3 ? payload[1] | (payload[2] << 8) : 0;
+                bool written = address == PACK_TEST_ADDRESS;
+                for (size_t x = 3; x < payload.size(); x++) {
+                    uint8_t expected = written ? pack_written(address + x - 3) : pack_image(address + x - 3);
+                    if (payload[x] != expected) { host.pack_download_errors++; }
+                }
+                if (payload.size() != 3u + (written ? PACK_BLOCK_SIZE : PACK_NEWLINE_SIZE)) { host.pack_download_errors++; }
+                break;
+            }
+            case commands::device::ACKNOWLEDGE:
+                if (payload.size() != 1) { host.errors++; }
+                if (payload[0] == commands::host::FLASH_MOVIE_PROGRAM && ++host.flash_acks == host.flash_pages) {
+                    uint64_t at = now() + options.host_latency_us * 1000;
+                    send({ commands::host::SET_DEVICE, 'N', '6', '4', 0x03, commands::host::FLASH_MOVIE_PLAY }, at);
+                    console.start = at + CONSOLE_START_NS;
+                    schedule(console.start, run_step);
+                }
+                break;
+            case commands::device::INFO: {
+                unsigned port, motor;
+                std::string text(payload.begin(), payload.end());
+                if (sscanf(text.c_str(), " RUMBLE %x %x", &port, &motor) == 2 && port < 4) {
+                    host.rumble[port] = motor;
+                    host.rumble_reports++;
+                }
+                if (options.verbose) { printf("%10.3fms %02X: %s", now() / 1e6, command, text.c_str()); }
+                break;
+            }
+            case commands::device::LOG:
+                host.log_frames++;
+                host.log_dropped += decode_log(payload, [](const LogMessage& message) {
+                    host.log_messages++;
+                    host.log_count += message.count;
+                    if (message.id == labels::INFO_RUMBLE.id && message.arguments.size() == 2 && message.arguments[0] < 4) {
+                        host.rumble[message.arguments[0]] = message.arguments[1];
+                        host.rumble_reports += message.count;
+                    }
+                    if (message.is_error()) { host.errors += message.count; }
+                    if (message.is_error() || options.verbose) {
+                        printf("%10.3fms log %02X x%u:", now() / 1e6, message.id, message.count);
+                        for (uint8_t value : message.arguments) { printf(" %02X", value); }
+                        printf("\n");
+                    }
+                });
+                break;
+            case commands::device::ERROR:
+                host.errors++;
+                printf("%10.3fms error: %.*s\n", now() / 1e6, (int)payload.size(), payload.data());
+                break;
+            default:
+                if (command >= commands::device::ACKNOWLEDGE && options.verbose) {
+                    printf("%10.3fms %02X: %.*s", now() / 1e6, command, (int)payload.size(), payload.data());
+                }
+                break;
+            }
+        }
+
+        FrameReader frames(handle_frame);
+    }
+
+    void drive_bit(uint32_t pin, WireBit bit, uint64_t fall, int driver) {
+        pio_observe_bit(pin, bit, fall, driver);
+
+        // Live controllers answer the device, which sends single byte commands.
+        for (int port = 0; options.mode == MODE_REALTIME && port < options.ports; port++) {
+            if (pin != live_pins[port] || driver < 0) { continue; }
+            LiveController& controller = live[port];
+            controller.request.push_back(bit);
+            // The command, then the stop bit.
+            if (controller.request.size() < 9) { continue; }
+
+            uint8_t command = 0;
+            for (int x = 0; x < 8; x++) { command = (command << 1) | (controller.request[x] == WIRE_1 ? 1 : 0); }
+            controller.request.clear();
+            controller.requests++;
+
+            std::vector<uint8_t> reply(controller_header_pack, controller_header_pack + 3);
+            if (command == N64_READ_INPUTS) {
+                uint8_t frame[N64_INPUT_SIZE];
+                live_frame(fall / LIVE_INPUT_NS, port, frame);
+                // Only the host's overlay makes port 1's last byte right.
+                if (port == 0) { frame[3] = 0; }
+                reply.assign(frame, frame + N64_INPUT_SIZE);
+            }
+
+            uint64_t start = fall + BIT_NS + CONTROLLER_DELAY_NS;
+            for (size_t x = 0; x < reply.size(); x++) {
+                drive_byte(pin, reply[x], start + x * 8 * BIT_NS, DRIVER_CONTROLLER);
+            }
+            uint64_t stop = start + reply.size() * 8 * BIT_NS;
+            schedule(stop, [pin, stop] { drive_bit(pin, WIRE_STOP, stop, DRIVER_CONTROLLER); });
+        }
+
+        if (console.active && pin == port_pins[console.current.port] && driver != DRIVER_CONSOLE) {
+            console.current.reply.push_back({ bit, fall });
+        }
+    }
+
+    void start_bus() {
+        // Playback starts once the device has the whole movie.
+        if (options.flash == FLASH_UPLOAD) {
+            upload_flash_movie();
+            return;
+        }
+        // Nothing is sent until the end of the run.
+        if (options.flash == FLASH_AUTOPLAY) {
+            std::vector<uint8_t> image = flash_image(true);
+            memcpy(sim_flash + FLASH_MOVIE_OFFSET, image.data(), image.size());
+            schedule(console.start, run_step);
+            return;
+        }
+
+        // Realtime controllers come with the device, so there is nothing to configure.
+        if (options.mode == MODE_REALTIME) {
+            send({ commands::host::SET_DEVICE, 'N', '6', '4', 0x02 }, 0);
+            send({ commands::host::REALTIME_OVERLAY, 0, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, LIVE_OVERLAY }, HOST_SETUP_NS);
+            schedule(console.start, run_step);
+            return;
+        }
+
+        const uint8_t mode = options.mode == MODE_RECORD ? 0x01 : options.mode == MODE_MIXED ? 0x04 : 0x03;
+        if (gamecube()) {
+            send({ commands::host::SET_DEVICE, 'G', 'C', 'N', mode }, 0);
+        } else {
+            send({ commands::host::SET_DEVICE, 'N', '6', '4', mode }, 0);
+        }
+
+        if (options.mode != MODE_RECORD && options.reply_delay_ns >= 0) {
+            uint16_t ns = options.reply_delay_ns;
+            send({ commands::host::REPLY_DELAY, 1, 0, (uint8_t)ns, (uint8_t)(ns >> 8) }, HOST_SETUP_NS);
+        }
+
+        if (options.mode != MODE_RECORD) {
+            std::vector<uint8_t> config { commands::host::CONTROLLER_CONFIG };
+            for (int port = 0; port < 4; port++) {
+                std::vector<uint8_t> header = header_for(port);
+                config.push_back(port < streamed_ports());
+                config.insert(config.end(), header.begin(), header.end());
+            }
+            if (gamecube()) { config.push_back(options.polls_per_frame); }
+            send(config, HOST_SETUP_NS);
+            if (options.packed) {
+                host.encoder.reset(streamed_ports());
+                send({ commands::host::DATASTREAM_ENCODING, 1 }, HOST_SETUP_NS);
+            }
+
+            for (uint32_t address = 0; options.pack && address < PACK_SIZE; address += PACK_UPLOAD_CHUNK) {
+                std::vector<uint8_t> upload { commands::host::CONTROLLER_PACK_WRITE, 0, (uint8_t)address, (uint8_t)(address >> 8), PACK_UPLOAD_CHUNK };
+                for (uint32_t x = 0; x < PACK_UPLOAD_CHUNK; x++) { upload.push_back(pack_image(address + x)); }
+                send(upload, HOST_SETUP_NS);
+            }
+        }
+
+        schedule(console.start, run_step);
+    }
+
+    void host_send(const uint8_t* data, int count, uint64_t at) {
+        // The serial link keeps bytes in order.
+        if (!host.outgoing.empty() && host.outgoing.back().first > at) { at = host.outgoing.back().first; }
+        for (int x = 0; x < count; x++) {
+            host.outgoing.push_back({ at, data[x] });
+        }
+    }
+
+    void host_receive(const uint8_t* data, int count) {
+        frames.add(data, count);
+    }
+
+    int host_read() {
+        if (!host.outgoing.empty() && host.outgoing.front().first <= now()) {
+            uint8_t data = host.outgoing.front().second;
+            host.outgoing.pop_front();
+            return data;
+        }
+        if (host.done && host.outgoing.empty()) { throw Finished(); }
+        return -1;
+    }
+
+    uint64_t host_next_byte_time() {
+        return host.outgoing.empty() ? UINT64_MAX : host.outgoing.front().first;
+    }
+
+    bool report() {
+        printf("Console: %d frames, %llu polls on %d port(s)\n", console.frame, (unsigned long long)console.polls, options.ports);
+        if (console.turnaround_count) {
+            printf("  turnaround after stop bit: min %.2fus, avg %.2fus, max %.2fus\n",
+                console.turnaround_min / 1e3, console.turnaround_total / 1e3 / console.turnaround_count, console.turnaround_max / 1e3);
+            for (int bit = 0; bit < 2; bit++) {
+                if (console.turnaround_by_bit_count[bit] == 0) { continue; }
+                printf("    device, after a request ending in %d: avg %.2fus over %llu\n", bit,
+                    console.turnaround_by_bit_total[bit] / 1e3 / console.turnaround_by_bit_count[bit],
+                    (unsigned long long)console.turnaround_by_bit_count[bit]);
+            }
+        }
+        printf("  replies ok %llu, held %llu, mismatched %llu, missing %llu, bad identify %llu\n",
+            (unsigned long long)console.ok, (unsigned long long)console.held, (unsigned long long)console.mismatched,
+            (unsigned long long)console.missing, (unsigned long long)console.bad_identify);
+        if (options.pack) {
+            printf("  controller pack: %llu ok, %llu wrong; host read back %d block(s), %d error(s)\n",
+                (unsigned long long)console.pack_ok, (unsigned long long)console.pack_bad, host.pack_downloads, host.pack_download_errors);
+        }
+
+        const PioCounters& pio = pio_counters();
+        printf("PIO: %llu words pushed (%llu by DMA), %llu rx overflows, %llu write stalls\n",
+            (unsigned long long)pio.words_pushed, (unsigned long long)pio.dma_words,
+            (unsigned long long)pio.rx_overflows, (unsigned long long)pio.write_stalls);
+
+        if (host.log_frames) {
+            printf("Logs: %llu frames, %llu messages logged %llu times, %llu dropped\n",
+                (unsigned long long)host.log_frames, (unsigned long long)host.log_messages,
+                (unsigned long long)host.log_count, (unsigned long long)host.log_dropped);
+        }
+
+        bool steady = console.device_turnaround_min == UINT64_MAX
+            || console.device_turnaround_max - console.device_turnaround_min <= TURNAROUND_JITTER_NS;
+        bool passed = steady && console.finished && console.mismatched == 0 && console.missing == 0 && console.bad_identify == 0 && host.errors == 0
+            && console.pack_bad == 0 && (!options.pack || (host.pack_downloads == 2 && host.pack_download_errors == 0));
+        if (options.mode == MODE_REALTIME) {
+            uint64_t requests = 0;
+            for (int port = 0; port < options.ports; port++) { requests += live[port].requests; }
+            printf("Live controllers: %llu requests, input age at poll avg %.2fus, max %.2fus\n", (unsigned long long)requests,
+                console.ok ? console.age_total / 1e3 / console.ok : 0.0, console.age_max / 1e3);
+            passed = passed && console.ok == console.polls && console.age_max < options.poll_interval_us * 1000;
+        } else if (options.mode != MODE_RECORD) {
+            printf("Host: %llu datastream grants, %llu packets, %u frames sent\n",
+                (unsigned long long)host.requests, (unsigned long long)host.chunks, host.next_frame);
+            if (options.packed && options.flash == FLASH_NONE) {
+                printf("  packed stream: %llu bytes for %u frames\n", (unsigned long long)host.packed_bytes, host.next_frame * streamed_ports());
+            }
+            if (options.flash == FLASH_UPLOAD) {
+                printf("  flash movie: %zu of %zu pages programmed\n", host.flash_acks, host.flash_pages);
+                passed = passed && host.flash_acks == host.flash_pages;
+            }
+            if (gamecube()) {
+                printf("  rumble: console changed it %llu times, device reported %llu\n",
+                    (unsigned long long)console.rumble_changes, (unsigned long long)host.rumble_reports);
+                passed = passed && host.rumble_reports == console.rumble_changes
+                    && memcmp(host.rumble, console.rumble, sizeof(host.rumble)) == 0;
+            }
+        }
+        if (options.mode == MODE_RECORD || options.mode == MODE_MIXED) {
+            uint64_t transactions = 0;
+            for (int port = 0; port < 4; port++) {
+                if (recorded(port)) { transactions += console.log[port].size(); }
+                // Anything still waiting was never on the bus.
+                host.record_mismatches += host.early_records[port].size();
+            }
+            printf("Host: %llu records, %llu repeat records, %llu of %llu transactions matched, %llu mismatched, max lag %lluus\n",
+                (unsigned long long)captures.records, (unsigned long long)captures.repeat_records, (unsigned long long)host.matched,
+                (unsigned long long)transactions, (unsigned long long)host.record_mismatches, (unsigned long long)host.max_lag_us);
+            passed = passed && host.record_mismatches == 0 && host.matched == transactions && host.max_lag_us <= RECORD_MAX_LAG_US;
+        }
+        return passed;
+    }
+}
@@ -0,0 +1,114 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "capture.h"
+
+#include <config.h>
+
+#define CAPTURE_COMMAND_REPEAT 0x3E
+#define CAPTURE_COMMAND_ESCAPE 0x3F
+
+namespace sim {
+    void FrameReader::add(const uint8_t* data, int count) {
+        this->incoming.insert(this->incoming.end(), data, data + count);
+
+#ifdef IO_FRAME_CHECKSUM
+        const size_t trailer = 1;
+#else
+        const size_t trailer = 0;
+#endif
+        while (this->incoming.size() >= 3) {
+            size_t length = this->incoming[1] | (this->incoming[2] << 8);
+            if (this->incoming.size() < 3 + length + trailer) { break; }
+
+            std::vector<uint8_t> payload(this->incoming.begin() + 3, this->incoming.begin() + 3 + length);
+            uint8_t command = this->incoming[0];
+            this->incoming.erase(this->incoming.begin(), this->incoming.begin() + 3 + length + trailer);
+            this->handler(command, payload);
+        }
+    }
+
+    int decode_log(const std::vector<uint8_t>& payload, std::function<void(const LogMessage& message)> handler) {
+        if (payload.size() < 2) { return 0; }
+        size_t offset = 2;
+        while (offset + 4 <= payload.size()) {
+            LogMessage message;
+            message.id = payload[offset];
+            size_t length = payload[offset + 1];
+            message.count = payload[offset + 2] | (payload[offset + 3] << 8);
+            offset += 4;
+            if (offset + length > payload.size()) { break; }
+            message.arguments.assign(payload.begin() + offset, payload.begin() + offset + length);
+            offset += length;
+            handler(message);
+        }
+        return payload[0] | (payload[1] << 8);
+    }
+
+    static uint32_t read_varint(const std::vector<uint8_t>& data, size_t& offset) {
+        uint32_t value = 0;
+        for (int shift = 0; offset < data.size(); shift += 7) {
+            uint8_t part = data[offset++];
+            value |= (uint32_t)(part & 0x7F) << shift;
+            if (!(part & 0x80)) { break; }
+        }
+        return value;
+    }
+
+    void CaptureDecoder::decode(const std::vector<uint8_t>& data) {
+        size_t offset = 0;
+        while (offset < data.size()) {
+            uint8_t header = data[offset++];
+            int port = header >> 6;
+            uint8_t command = header & 0x3F;
+
+            if (command == CAPTURE_COMMAND_REPEAT) {
+                uint32_t first = this->timestamp + read_varint(data, offset);
+                uint32_t count = read_varint(data, offset);
+                uint32_t span = read_varint(data, offset);
+                this->timestamp = first;
+                this->repeat_records++;
+
+                CaptureRecord record = this->last_record[port];
+                for (uint32_t x = 0; x < count; x++) {
+                    record.timestamp = first + (count > 1 ? (uint64_t)span * x / (count - 1) : 0);
+                    this->handler(record);
+                }
+                continue;
+            }
+
+            if (command == CAPTURE_COMMAND_ESCAPE && offset < data.size()) { command = data[offset++]; }
+            this->timestamp += read_varint(data, offset);
+            uint32_t sizes = read_varint(data, offset);
+            size_t request_bytes = sizes / 64;
+            size_t response_bytes = sizes % 64;
+            if (offset + request_bytes + response_bytes > data.size()) { return; }
+
+            CaptureRecord record;
+            record.port = port;
+            record.command = command;
+            record.timestamp = this->timestamp;
+            record.request.assign(data.begin() + offset, data.begin() + offset + request_bytes);
+            offset += request_bytes;
+            record.response.assign(data.begin() + offset, data.begin() + offset + response_bytes);
+            offset += response_bytes;
+
+            this->records++;
+            this->last_record[port] = record;
+            this->handler(record);
+        }
+    }
+}
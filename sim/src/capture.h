@@ -0,0 +1,74 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <stdint.h>
+
+#include <functional>
+#include <vector>
+
+// Host side decoding of the device's output, shared by the simulator and the
+// replay benchmark. This mirrors controller/core/capture.py.
+namespace sim {
+    struct CaptureRecord {
+        int port;
+        uint8_t command;
+        uint32_t timestamp;
+        std::vector<uint8_t> request;
+        std::vector<uint8_t> response;
+    };
+
+    // Splits the device's output into frames.
+    class FrameReader {
+    public:
+        typedef std::function<void(uint8_t command, const std::vector<uint8_t>& payload)> Handler;
+
+        explicit FrameReader(Handler handler) : handler(handler) {}
+        void add(const uint8_t* data, int count);
+    private:
+        Handler handler;
+        std::vector<uint8_t> incoming;
+    };
+
+    struct LogMessage {
+        uint8_t id;
+        uint16_t count;
+        std::vector<uint8_t> arguments;
+
+        // Levels are grouped by ID, see labels.h.
+        bool is_error() const { return id >= 0xC0; }
+    };
+
+    // Decodes a LOG payload. Returns the number of messages dropped.
+    int decode_log(const std::vector<uint8_t>& payload, std::function<void(const LogMessage& message)> handler);
+
+    // Decodes CAPTURE_DATA payloads, expanding repeat records back into one
+    // record per transaction. Repeats get evenly spread timestamps.
+    class CaptureDecoder {
+    public:
+        typedef std::function<void(const CaptureRecord& record)> Handler;
+
+        explicit CaptureDecoder(Handler handler) : handler(handler) {}
+        void decode(const std::vector<uint8_t>& payload);
+
+        uint64_t records = 0;
+        uint64_t repeat_records = 0;
+    private:
+        Handler handler;
+        uint32_t timestamp = 0;
+        CaptureRecord last_record[4];
+    };
+}
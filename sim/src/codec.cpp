@@ -0,0 +1,192 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+
+// Round trips input streams through the packed datastream codec, checks the
+// decoded frames match, and reports the size and speed. Inputs come from
+// mupen64 movies (.m64) and the read inputs replies in captures (.raw). With
+// no files, a generated stream stands in: held buttons and a stick that drifts.
+//   codec [--iterations N] [--frames N] [movie.m64 | capture.raw]...
+
+#include <consoles/n64/input_codec.h>
+
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define FRAME_SIZE INPUT_CODEC_FRAME_SIZE
+#define M64_CONTROLLERS_OFFSET 0x15
+#define M64_INPUT_OFFSET 0x400
+
+namespace {
+    struct Stream {
+        std::string name;
+        int ports;
+        // Whole records, one frame per port.
+        std::vector<uint8_t> records;
+    };
+
+    bool load_m64(const char* path, Stream& stream) {
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (data.size() < M64_INPUT_OFFSET || memcmp(data.data(), "M64\x1A", 4) != 0) { return false; }
+
+        stream.ports = data[M64_CONTROLLERS_OFFSET];
+        if (stream.ports < 1 || stream.ports > INPUT_CODEC_MAX_PORTS) { return false; }
+        size_t record_size = stream.ports * FRAME_SIZE;
+        size_t size = (data.size() - M64_INPUT_OFFSET) / record_size * record_size;
+        stream.records.assign(data.begin() + M64_INPUT_OFFSET, data.begin() + M64_INPUT_OFFSET + size);
+        return true;
+    }
+
+    // Only port 1's read inputs replies are used, so captures are one port.
+    bool load_capture(const char* path, Stream& stream) {
+        std::ifstream file(path);
+        if (!file) { return false; }
+
+        stream.ports = 1;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::vector<std::string> fields;
+            std::stringstream fields_stream(line);
+            std::string field;
+            while (std::getline(fields_stream, field, ',')) { fields.push_back(field); }
+            if (fields.size() != 5 || atoi(fields[1].c_str()) != 0 || strtoul(fields[2].c_str(), nullptr, 16) != 0x01) { continue; }
+
+            const std::string& hex = fields[4];
+            if (hex.size() < FRAME_SIZE * 2) { continue; }
+            for (size_t x = 0; x < FRAME_SIZE * 2; x += 2) {
+                stream.records.push_back(strtoul(hex.substr(x, 2).c_str(), nullptr, 16));
+            }
+        }
+        return true;
+    }
+
+    void generate(int frames, Stream& stream) {
+        std::mt19937 random(64);
+        uint8_t frame[FRAME_SIZE] = {};
+        int hold = 0;
+        stream.name = "generated";
+        stream.ports = 1;
+        for (int x = 0; x < frames; x++) {
+            if (hold-- <= 0) {
+                // A new input every so often: mostly stick drift, sometimes buttons.
+                hold = random() % 30;
+                if (random() % 4 == 0) {
+                    frame[0] = random();
+                    frame[1] = random() & 0x3F;
+                }
+                if (random() % 8 == 0) {
+                    frame[2] = random();
+                    frame[3] = random();
+                }
+            }
+            if (random() % 2) {
+                frame[2] += (int)(random() % 5) - 2;
+                frame[3] += (int)(random() % 5) - 2;
+            }
+            stream.records.insert(stream.records.end(), frame, frame + FRAME_SIZE);
+        }
+    }
+
+    bool round_trip(const Stream& stream, int iterations) {
+        int record_count = stream.records.size() / (stream.ports * FRAME_SIZE);
+        std::vector<uint8_t> packed(stream.records.size() * INPUT_CODEC_MAX_TOKEN);
+        std::vector<uint8_t> decoded;
+        decoded.reserve(stream.records.size());
+
+        n64::InputEncoder encoder;
+        n64::InputDecoder decoder;
+        int size = 0;
+        double encode_time = 0, decode_time = 0;
+        for (int iteration = 0; iteration < iterations; iteration++) {
+            auto started = std::chrono::steady_clock::now();
+            encoder.reset(stream.ports);
+            size = encoder.encode(stream.records.data(), record_count, packed.data());
+            auto encoded = std::chrono::steady_clock::now();
+
+            decoded.clear();
+            decoder.reset(stream.ports);
+            for (int x = 0; x < size; x++) {
+                decoder.add(packed[x], [&decoded](const uint8_t* frame) { decoded.insert(decoded.end(), frame, frame + FRAME_SIZE); });
+            }
+            auto finished = std::chrono::steady_clock::now();
+
+            encode_time += std::chrono::duration<double>(encoded - started).count();
+            decode_time += std::chrono::duration<double>(finished - encoded).count();
+        }
+
+        bool matched = decoded == stream.records;
+        uint64_t frames = (uint64_t)record_count * stream.ports;
+        printf("%s: %d port(s), %llu frames\n", stream.name.c_str(), stream.ports, (unsigned long long)frames);
+        printf("  %zu raw bytes -> %d packed, %.2f bytes/frame (%.1fx)\n",
+            stream.records.size(), size, frames ? (double)size / frames : 0, size ? (double)stream.records.size() / size : 0);
+        if (frames) {
+            printf("  encode %.1f ns/frame, decode %.1f ns/frame\n",
+                encode_time * 1e9 / (frames * iterations), decode_time * 1e9 / (frames * iterations));
+        }
+        printf("  %s\n", matched ? "round trip ok" : "MISMATCH");
+        return matched;
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = 100;
+    int frames = 100000;
+    std::vector<Stream> streams;
+
+    for (int x = 1; x < argc; x++) {
+        if (!strcmp(argv[x], "--iterations") && x + 1 < argc) {
+            iterations = atoi(argv[++x]);
+            continue;
+        }
+        if (!strcmp(argv[x], "--frames") && x + 1 < argc) {
+            frames = atoi(argv[++x]);
+            continue;
+        }
+
+        Stream stream;
+        stream.name = argv[x];
+        size_t length = stream.name.size();
+        bool loaded = length > 4 && stream.name.compare(length - 4, 4, ".m64") == 0
+            ? load_m64(argv[x], stream)
+            : load_capture(argv[x], stream);
+        if (!loaded) {
+            fprintf(stderr, "could not read %s\n", argv[x]);
+            return 2;
+        }
+        streams.push_back(stream);
+    }
+    if (iterations < 1 || frames < 1) {
+        fprintf(stderr, "usage: codec [--iterations N] [--frames N] [movie.m64 | capture.raw]...\n");
+        return 2;
+    }
+    if (streams.empty()) {
+        streams.emplace_back();
+        generate(frames, streams.back());
+    }
+
+    bool passed = true;
+    for (const Stream& stream : streams) {
+        passed = round_trip(stream, iterations) && passed;
+    }
+    return passed ? 0 : 1;
+}
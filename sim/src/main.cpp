@@ -0,0 +1,114 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Runs the firmware against a simulated console and host, then reports what
+// the console saw. Exits non-zero if any reply was wrong or missing.
+//   sim [--console n64|gamecube] [--mode datastream|record|mixed|realtime] [--frames N] [--ports N]
+//       [--polls-per-frame N] [--poll-interval-us N] [--host-latency-us N] [--host-stall-ms N]
+//       [--reply-timeout-us N] [--reply-delay-ns N] [--handover-jitter-ns N]
+//       [--pack] [--packed] [--flash upload|autoplay] [--verbose]
+
+#include "sim.h"
+
+#include <io.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int firmware_main();
+
+static void usage() {
+    fprintf(stderr, "usage: sim [--console n64|gamecube] [--mode datastream|record|mixed|realtime] [--frames N] [--ports N]\n"
+        "           [--polls-per-frame N] [--poll-interval-us N] [--host-latency-us N] [--host-stall-ms N]\n"
+        "           [--reply-timeout-us N] [--reply-delay-ns N] [--handover-jitter-ns N]\n"
+        "           [--pack] [--packed] [--flash upload|autoplay] [--verbose]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    sim::Options& options = sim::options;
+    for (int x = 1; x < argc; x++) {
+        const char* arg = argv[x];
+        if (!strcmp(arg, "--verbose")) {
+            options.verbose = true;
+            continue;
+        }
+        if (!strcmp(arg, "--pack")) {
+            options.pack = true;
+            continue;
+        }
+        if (!strcmp(arg, "--packed")) {
+            options.packed = true;
+            continue;
+        }
+        if (x + 1 >= argc) { usage(); }
+        const char* value = argv[++x];
+
+        if (!strcmp(arg, "--console")) {
+            if (!strcmp(value, "n64")) { options.console = sim::CONSOLE_N64; }
+            else if (!strcmp(value, "gamecube")) { options.console = sim::CONSOLE_GAMECUBE; }
+            else { usage(); }
+        }
+        else if (!strcmp(arg, "--mode")) {
+            if (!strcmp(value, "datastream")) { options.mode = sim::MODE_DATASTREAM; }
+            else if (!strcmp(value, "record")) { options.mode = sim::MODE_RECORD; }
+            else if (!strcmp(value, "mixed")) { options.mode = sim::MODE_MIXED; }
+            else if (!strcmp(value, "realtime")) { options.mode = sim::MODE_REALTIME; }
+            else { usage(); }
+        }
+        else if (!strcmp(arg, "--flash")) {
+            if (!strcmp(value, "upload")) { options.flash = sim::FLASH_UPLOAD; }
+            else if (!strcmp(value, "autoplay")) { options.flash = sim::FLASH_AUTOPLAY; }
+            else { usage(); }
+        }
+        else if (!strcmp(arg, "--frames")) { options.frames = atoi(value); }
+        else if (!strcmp(arg, "--ports")) { options.ports = atoi(value); }
+        else if (!strcmp(arg, "--polls-per-frame")) { options.polls_per_frame = atoi(value); }
+        else if (!strcmp(arg, "--poll-interval-us")) { options.poll_interval_us = atoll(value); }
+        else if (!strcmp(arg, "--host-latency-us")) { options.host_latency_us = atoll(value); }
+        else if (!strcmp(arg, "--host-stall-ms")) { options.host_stall_ms = atoll(value); }
+        else if (!strcmp(arg, "--reply-timeout-us")) { options.reply_timeout_us = atoll(value); }
+        else if (!strcmp(arg, "--reply-delay-ns")) { options.reply_delay_ns = atoi(value); }
+        else if (!strcmp(arg, "--handover-jitter-ns")) { sim::pio_set_handover_jitter(atoll(value)); }
+        else { usage(); }
+    }
+    if (options.ports < 1 || options.ports > 4 || options.frames < 1 || options.polls_per_frame < 1
+            || options.reply_delay_ns > 0xFFFF) { usage(); }
+    if ((options.pack || options.packed) && options.mode == sim::MODE_RECORD) { usage(); }
+    if (options.mode == sim::MODE_MIXED && options.ports < 2) { usage(); }
+    // Realtime is N64 only, with nothing streamed.
+    if (options.mode == sim::MODE_REALTIME && (options.console != sim::CONSOLE_N64 || options.pack || options.packed)) { usage(); }
+    // Flash movies can't carry a Controller Pack image.
+    if (options.flash != sim::FLASH_NONE && (options.pack || options.mode != sim::MODE_DATASTREAM)) { usage(); }
+    // Packs, packed streams and flash movies are N64 only.
+    if (options.console == sim::CONSOLE_GAMECUBE && (options.pack || options.packed || options.flash != sim::FLASH_NONE)) { usage(); }
+
+    auto started = std::chrono::steady_clock::now();
+    sim::start_bus();
+    try {
+        firmware_main();
+    } catch (sim::Finished&) {
+        // Anything still buffered would have gone out on the next flush window.
+        io::flush();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    bool passed = sim::report();
+    printf("Simulated %.3fs in %.3fs: %s\n", sim::now() / 1e9, wall, passed ? "PASS" : "FAIL");
+    return passed ? 0 : 1;
+}
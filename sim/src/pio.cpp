@@ -0,0 +1,618 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// A behavioural model of pio/oneline.pio and the DMA channels fed from it.
+// Rather than executing instructions, each state machine reacts to bits on
+// its pin with the same timing and FIFO output as the real programs:
+//   - oneline: raises its irq on every bit, pushes every 8 bits, and on a
+//     controller stop bit (or an abort) pushes the leftover bits followed by
+//     the inverted bit count. After a bit which leaves bits in the ISR (the
+//     console's stop bit) it waits out the handover loops, then polls the
+//     TX FIFO every 3 cycles. A reply found there waits out the turnaround
+//     from its first word, is shifted out of the TX FIFO, inverted, 4us per
+//     bit, and the word after it becomes the next handover wait.
+//   - oneline_capture: the same words, but it ends a transaction by itself once
+//     the line has been idle for the loop count the CPU loaded. Its irq is
+//     only raised as a transaction starts.
+//   - oneline_request: writes a request as soon as its first word arrives,
+//     then the console's stop bit, then reads the reply like the reader. Its
+//     irq is only raised at the controller's stop bit (or an abort).
+
+#include "sim.h"
+
+#include <hardware/pio.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <oneline.pio.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#define PIO_FIFO_DEPTH 4
+#define PIO_CYCLE_NS (1000 / oneline_F_PIO_MHZ)
+#define DMA_CHANNEL_COUNT 12
+
+static const uint16_t no_instructions[1] = {};
+const pio_program_t oneline_program = { no_instructions, 32, -1 };
+const pio_program_t oneline_capture_program = { no_instructions, 21, -1 };
+const pio_program_t oneline_request_program = { no_instructions, 29, -1 };
+
+namespace sim {
+    namespace {
+        struct StateMachine {
+            const pio_program_t* program = nullptr;
+            uint pin = 0;
+            bool enabled = false;
+            bool writing = false;
+
+            std::deque<uint32_t> rx, tx;
+            // When set, writes land here instead of the TX FIFO.
+            std::vector<uint32_t>* tx_sink = nullptr;
+
+            // Reader
+            uint32_t isr = 0;
+            int isr_bits = 0;
+            uint32_t y = ~0u;
+            bool in_transaction = false;
+            uint64_t generation = 0;
+            uint64_t idle_ns = 0;
+
+            // Writer
+            bool write_waiting = false;
+            bool write_needs_count = false;
+            uint32_t bits_left = 0;
+            // The loop count left in the OSR for the next stop bit.
+            uint32_t handover_loops = 0;
+            // Polling the TX FIFO for a reply since then, every 3 cycles.
+            bool reply_polling = false;
+            uint64_t reply_poll_ns = 0;
+            // The reply has been sent, and the final pull is waiting on the handover loops.
+            bool handover_waiting = false;
+            uint32_t osr = 0;
+            int osr_bits = 0;
+
+            // Request
+            bool replying = false;
+        };
+
+        struct PioBlock {
+            pio_hw_t registers;
+            StateMachine sm[NUM_PIO_STATE_MACHINES];
+            uint32_t irq_flags = 0;
+            uint32_t irq0_sources = 0;
+        };
+
+        struct DmaChannel {
+            bool claimed = false;
+            bool enabled = false;
+            dma_channel_config config;
+            dma_channel_hw_t hw;
+        };
+
+        PioBlock blocks[2];
+        DmaChannel channels[DMA_CHANNEL_COUNT];
+        PioCounters counters;
+        uint64_t handover_jitter_ns = 0;
+        uint32_t handover_count = 0;
+
+        PioBlock& block(PIO pio) { return pio == pio0 ? blocks[0] : blocks[1]; }
+        int driver_id(PioBlock& pio, uint sm) { return (&pio - blocks) * NUM_PIO_STATE_MACHINES + sm; }
+
+        // Hands the word to a running DMA channel reading the RX FIFO, if any.
+        bool dma_take(PioBlock& pio, uint sm, uint32_t value) {
+            for (DmaChannel& channel : channels) {
+                if (channel.enabled && channel.hw.read_addr == &pio.registers.rxf[sm] && channel.hw.transfer_count > 0) {
+                    uintptr_t address = (uintptr_t)channel.hw.write_addr;
+                    *(volatile uint32_t*)address = value;
+
+                    if (channel.config.write_increment) {
+                        uintptr_t mask = channel.config.ring_write && channel.config.ring_bits ? (1u << channel.config.ring_bits) - 1 : ~(uintptr_t)0;
+                        address = (address & ~mask) | ((address + sizeof(uint32_t)) & mask);
+                    }
+                    channel.hw.write_addr = (volatile void*)address;
+                    channel.hw.transfer_count = channel.hw.transfer_count - 1;
+                    counters.dma_words++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // A channel started on an RX FIFO empties it first.
+        void dma_drain_fifos() {
+            for (PioBlock& pio : blocks) {
+                for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+                    std::deque<uint32_t>& rx = pio.sm[sm].rx;
+                    while (!rx.empty() && dma_take(pio, sm, rx.front())) { rx.pop_front(); }
+                }
+            }
+        }
+
+        void push(PioBlock& pio, uint sm, uint32_t value) {
+            counters.words_pushed++;
+            if (dma_take(pio, sm, value)) { return; }
+
+            // The real push blocks the state machine, losing the bits which follow.
+            // The request program only blocks at the end of a reply (of up to
+            // 4 bytes), where there is nothing left to lose.
+            if (pio.sm[sm].rx.size() >= PIO_FIFO_DEPTH && pio.sm[sm].program != &oneline_request_program) {
+                counters.rx_overflows++;
+                return;
+            }
+            pio.sm[sm].rx.push_back(value);
+        }
+
+        void end_transaction(PioBlock& pio, uint sm) {
+            StateMachine& state = pio.sm[sm];
+            push(pio, sm, state.isr);
+            push(pio, sm, state.y);
+            state.isr = 0;
+            state.isr_bits = 0;
+            state.y = ~0u;
+            state.in_transaction = false;
+        }
+
+        // irq set 0 rel, then the rest of the reply.
+        void end_reply(PioBlock& pio, uint sm) {
+            pio.sm[sm].replying = false;
+            pio.irq_flags |= 1u << sm;
+            end_transaction(pio, sm);
+            check_irqs();
+        }
+
+        void sample(PioBlock& pio, uint sm, WireBit bit) {
+            StateMachine& state = pio.sm[sm];
+            if (!state.enabled || state.writing) { return; }
+            bool request = state.program == &oneline_request_program;
+            if (request && !state.replying) { return; }
+
+            if (bit == WIRE_STOP) {
+                if (request) {
+                    end_reply(pio, sm);
+                } else {
+                    end_transaction(pio, sm);
+                }
+                return;
+            }
+
+            state.in_transaction = true;
+            state.isr = (state.isr << 1) | (bit == WIRE_1 ? 1 : 0);
+            state.isr_bits++;
+            state.y--;
+            if (state.isr_bits == 8) {
+                push(pio, sm, state.isr);
+                state.isr = 0;
+                state.isr_bits = 0;
+            }
+        }
+
+        void write_step(PioBlock& pio, uint sm);
+
+        // The final pull of a reply, which loads the handover loops for the
+        // next stop bit. Nothing is read until it arrives.
+        void end_write(PioBlock& pio, uint sm) {
+            StateMachine& state = pio.sm[sm];
+            if (!state.enabled) { return; }
+            if (state.tx.empty()) {
+                state.handover_waiting = true;
+                return;
+            }
+            state.handover_loops = state.tx.front();
+            state.tx.pop_front();
+            state.handover_waiting = false;
+            state.writing = false;
+            state.y = ~0u;
+            state.isr = 0;
+            state.isr_bits = 0;
+        }
+
+        // jmp !x write_reply saw the reply at poll, then the pull, out x, out y,
+        // the turnaround's delay + 1 jmp x-- and pull ifempty before the first bit.
+        void begin_reply(PioBlock& pio, uint sm, uint64_t poll) {
+            StateMachine& state = pio.sm[sm];
+            uint32_t word = state.tx.front();
+            state.tx.pop_front();
+            state.reply_polling = false;
+            state.writing = true;
+            state.write_needs_count = false;
+            state.bits_left = (word & 0xFFFFF) + 1;
+            state.osr_bits = 0;
+            state.isr = 0;
+            state.isr_bits = 0;
+            schedule(poll + (7 + (word >> 20)) * PIO_CYCLE_NS, [&pio, sm] { write_step(pio, sm); });
+        }
+
+        void start_write(PioBlock& pio, uint sm) {
+            StateMachine& state = pio.sm[sm];
+            state.writing = true;
+            state.write_needs_count = true;
+            state.osr_bits = 0;
+            state.isr = 0;
+            state.isr_bits = 0;
+            schedule(now() + 3 * PIO_CYCLE_NS, [&pio, sm] { write_step(pio, sm); });
+        }
+
+        void write_step(PioBlock& pio, uint sm) {
+            StateMachine& state = pio.sm[sm];
+            if (!state.enabled || !state.writing) { return; }
+
+            if (state.write_needs_count) {
+                if (state.tx.empty()) {
+                    state.write_waiting = true;
+                    return;
+                }
+                uint32_t word = state.tx.front();
+                state.tx.pop_front();
+                state.write_needs_count = false;
+
+                // out y 32, then a nop and the pull.
+                state.bits_left = word + 1;
+                schedule(now() + 3 * PIO_CYCLE_NS, [&pio, sm] { write_step(pio, sm); });
+                return;
+            }
+
+            // Requests end with the console's stop bit, then read the reply
+            // once the line is released.
+            if (state.bits_left == 0 && state.program == &oneline_request_program) {
+                drive_bit(state.pin, WIRE_1, now(), driver_id(pio, sm));
+                schedule(now() + low_ns(WIRE_1), [&state] {
+                    state.writing = false;
+                    state.replying = true;
+                    state.isr = 0;
+                    state.isr_bits = 0;
+                    state.y = ~0u;
+                });
+                return;
+            }
+
+            if (state.bits_left == 0) {
+                drive_bit(state.pin, WIRE_STOP, now(), driver_id(pio, sm));
+                schedule(now() + low_ns(WIRE_STOP), [&pio, sm] { end_write(pio, sm); });
+                return;
+            }
+
+            if (state.osr_bits == 0) {
+                // pull ifempty stalls with the line released.
+                if (state.tx.empty()) {
+                    counters.write_stalls++;
+                    state.write_waiting = true;
+                    return;
+                }
+                state.osr = state.tx.front();
+                state.tx.pop_front();
+                state.osr_bits = 32;
+            }
+
+            // Words are inverted, since a 1 drives the line low.
+            WireBit bit = (state.osr & 0x80000000) ? WIRE_0 : WIRE_1;
+            state.osr <<= 1;
+            state.osr_bits--;
+            state.bits_left--;
+
+            drive_bit(state.pin, bit, now(), driver_id(pio, sm));
+            schedule(now() + BIT_NS, [&pio, sm] { write_step(pio, sm); });
+        }
+    }
+
+    void pio_observe_bit(uint32_t pin, WireBit bit, uint64_t fall, int driver) {
+        for (PioBlock& pio : blocks) {
+            for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+                StateMachine& state = pio.sm[sm];
+                if (!state.enabled || state.pin != pin || driver == driver_id(pio, sm)) { continue; }
+
+                if (state.writing) { continue; }
+
+                state.reply_polling = false;
+                uint64_t generation = ++state.generation;
+
+                if (state.program == &oneline_program) {
+                    // irq set 0 rel, half a microsecond into every bit.
+                    schedule(fall + 500, [&pio, sm] {
+                        if (pio.sm[sm].enabled && !pio.sm[sm].writing) {
+                            pio.irq_flags |= 1u << sm;
+                            check_irqs();
+                        }
+                    });
+
+                    // The first status check once the bit has risen, and the
+                    // handover loops are done, 25 cycles before the reply
+                    // would start. Another fall first means it was a data bit.
+                    uint64_t check = fall + low_ns(bit) + (oneline_REPLY_MIN_CYCLES - 7 + 2 * state.handover_loops) * PIO_CYCLE_NS;
+                    schedule(check, [&pio, sm, generation] {
+                        StateMachine& state = pio.sm[sm];
+                        if (!state.enabled || state.writing || state.generation != generation || state.isr == 0) { return; }
+                        if (!state.tx.empty()) {
+                            begin_reply(pio, sm, now());
+                        } else {
+                            state.reply_polling = true;
+                            state.reply_poll_ns = now();
+                        }
+                    });
+                }
+
+                schedule(fall + 2500, [&pio, sm, bit] { sample(pio, sm, bit); });
+
+                if (state.program == &oneline_capture_program) {
+                    // irq set 0 rel, only as a transaction starts.
+                    if (!state.in_transaction) {
+                        schedule(fall + PIO_CYCLE_NS, [&pio, sm] {
+                            if (pio.sm[sm].enabled) {
+                                pio.irq_flags |= 1u << sm;
+                                check_irqs();
+                            }
+                        });
+                    }
+                    schedule(fall + low_ns(bit) + state.idle_ns, [&pio, sm, generation] {
+                        StateMachine& state = pio.sm[sm];
+                        if (state.enabled && state.in_transaction && state.generation == generation) {
+                            end_transaction(pio, sm);
+                        }
+                    });
+                }
+            }
+        }
+    }
+
+    void pio_push_word(uint32_t pin, uint32_t word) {
+        for (PioBlock& pio : blocks) {
+            for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+                if (pio.sm[sm].enabled && pio.sm[sm].pin == pin) { push(pio, sm, word); }
+            }
+        }
+    }
+
+    bool pio_irq_pending(uint32_t irq) {
+        PioBlock& pio = irq == PIO0_IRQ_0 ? blocks[0] : blocks[1];
+        return pio.irq_flags & pio.irq0_sources;
+    }
+
+    const PioCounters& pio_counters() {
+        return counters;
+    }
+
+    void pio_sink_tx(uint32_t sm, std::vector<uint32_t>* words) {
+        blocks[0].sm[sm].tx_sink = words;
+    }
+
+    void pio_set_handover_jitter(uint64_t ns) {
+        handover_jitter_ns = ns;
+    }
+}
+
+using namespace sim;
+
+pio_hw_t* const pio0 = &blocks[0].registers;
+pio_hw_t* const pio1 = &blocks[1].registers;
+
+// --------------------
+// |       PIO        |
+// --------------------
+
+uint pio_add_program(PIO, const pio_program_t*) { return 0; }
+void pio_remove_program(PIO, const pio_program_t*, uint) {}
+void pio_gpio_init(PIO, uint) {}
+int pio_sm_set_consecutive_pindirs(PIO, uint, uint, uint, bool) { return 0; }
+
+void pio_set_irq0_source_enabled(PIO pio, enum pio_interrupt_source source, bool enabled) {
+    if (source < pis_interrupt0) { return; }
+    uint32_t bit = 1u << (source - pis_interrupt0);
+    block(pio).irq0_sources = enabled ? (block(pio).irq0_sources | bit) : (block(pio).irq0_sources & ~bit);
+}
+
+void sm_config_set_clkdiv(pio_sm_config* c, float div) { c->clkdiv = div; }
+void sm_config_set_in_pins(pio_sm_config*, uint) {}
+void sm_config_set_out_pins(pio_sm_config*, uint, uint) {}
+void sm_config_set_set_pins(pio_sm_config*, uint, uint) {}
+void sm_config_set_in_shift(pio_sm_config*, bool, bool, uint) {}
+void sm_config_set_out_shift(pio_sm_config*, bool, bool, uint) {}
+void sm_config_set_mov_status(pio_sm_config*, enum pio_mov_status_type, uint) {}
+
+// Both programs use the jmp pin as their data pin.
+void sm_config_set_jmp_pin(pio_sm_config* c, uint pin) { c->pin = pin; }
+
+void pio_sm_init(PIO pio, uint sm, uint, const pio_sm_config* config) {
+    StateMachine& state = block(pio).sm[sm];
+    state = StateMachine();
+    state.program = config->program;
+    state.pin = config->pin;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled) {
+    StateMachine& state = block(pio).sm[sm];
+    state.enabled = enabled;
+
+    // The capture program starts by pulling its idle loop count. Each loop is 2 cycles.
+    if (enabled && state.program == &oneline_capture_program && !state.tx.empty()) {
+        state.idle_ns = state.tx.front() * 2 * PIO_CYCLE_NS;
+        state.tx.pop_front();
+    }
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm) {
+    block(pio).sm[sm].rx.clear();
+    block(pio).sm[sm].tx.clear();
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx) {
+    return (pio == pio0 ? 0 : 8) + (is_tx ? 0 : 4) + sm;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm) {
+    advance(POLL_NS);
+    return block(pio).sm[sm].rx.empty();
+}
+
+bool pio_sm_is_tx_fifo_full(PIO pio, uint sm) {
+    advance(POLL_NS);
+    return block(pio).sm[sm].tx.size() >= PIO_FIFO_DEPTH;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm) {
+    StateMachine& state = block(pio).sm[sm];
+    if (state.rx.empty()) { return 0; }
+    uint32_t value = state.rx.front();
+    state.rx.pop_front();
+    return value;
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data) {
+    PioBlock& piob = block(pio);
+    StateMachine& state = piob.sm[sm];
+    if (state.tx_sink != nullptr) { state.tx_sink->push_back(data); return; }
+    if (state.tx.size() >= PIO_FIFO_DEPTH) { return; }
+
+    // The first word of a reply.
+    if (handover_jitter_ns && state.enabled && state.program == &oneline_program && !state.writing && state.tx.empty()) {
+        // Spread evenly, but not in step with anything on the bus.
+        handover_count++;
+        advance((handover_count * 2654435761u >> 8) % (handover_jitter_ns + 1));
+    }
+    state.tx.push_back(data);
+
+    // The request program waits on pull for its first word.
+    if (state.enabled && state.program == &oneline_request_program && !state.writing && !state.replying) {
+        start_write(piob, sm);
+        return;
+    }
+
+    if (state.reply_polling && state.tx.size() == 1) {
+        // Picked up by the next mov x status, unless the line drops first.
+        uint64_t poll_cycle = 3 * PIO_CYCLE_NS;
+        uint64_t poll = state.reply_poll_ns + (now() - state.reply_poll_ns + poll_cycle - 1) / poll_cycle * poll_cycle;
+        uint64_t generation = state.generation;
+        state.reply_polling = false;
+        schedule(poll, [&piob, sm, generation] {
+            StateMachine& state = piob.sm[sm];
+            if (state.enabled && !state.writing && state.generation == generation && !state.tx.empty()) {
+                begin_reply(piob, sm, now());
+            }
+        });
+    }
+
+    if (state.handover_waiting) {
+        schedule(now(), [&piob, sm] { end_write(piob, sm); });
+    }
+
+    if (state.write_waiting) {
+        state.write_waiting = false;
+        schedule(now(), [&piob, sm] { write_step(piob, sm); });
+    }
+}
+
+void pio_sm_put_blocking(PIO pio, uint sm, uint32_t data) {
+    while (block(pio).sm[sm].tx.size() >= PIO_FIFO_DEPTH) {
+        advance(POLL_NS);
+    }
+    pio_sm_put(pio, sm, data);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr) {
+    PioBlock& piob = block(pio);
+    StateMachine& state = piob.sm[sm];
+    // Programs are always loaded at offset 0.
+    if (state.enabled && state.program == &oneline_request_program && instr == oneline_request_offset_reply_end) {
+        if (state.replying) { end_reply(piob, sm); }
+        return;
+    }
+    if (state.program != &oneline_program) { return; }
+
+    // Loads the handover loops before the state machine is enabled.
+    if (instr == pio_encode_pull(false, true)) {
+        if (!state.tx.empty()) {
+            state.handover_loops = state.tx.front();
+            state.tx.pop_front();
+        }
+        return;
+    }
+    if (state.enabled && instr == oneline_offset_reset_bit && !state.writing) {
+        state.reply_polling = false;
+        state.generation++;
+        end_transaction(piob, sm);
+    }
+}
+
+// Only tells apart the oneline reader waiting for a fall after a whole byte.
+uint8_t pio_sm_get_pc(PIO pio, uint sm) {
+    advance(POLL_NS);
+    StateMachine& state = block(pio).sm[sm];
+    if (!state.enabled || state.writing) { return 0; }
+    return state.isr_bits == 0 && !state.reply_polling ? oneline_offset_fall_wait : oneline_offset_start;
+}
+
+bool pio_interrupt_get(PIO pio, uint pio_interrupt_num) {
+    return block(pio).irq_flags & (1u << pio_interrupt_num);
+}
+
+void pio_interrupt_clear(PIO pio, uint pio_interrupt_num) {
+    block(pio).irq_flags &= ~(1u << pio_interrupt_num);
+}
+
+// --------------------
+// |       DMA        |
+// --------------------
+
+int dma_claim_unused_channel(bool) {
+    for (int x = 0; x < DMA_CHANNEL_COUNT; x++) {
+        if (!channels[x].claimed) {
+            channels[x].claimed = true;
+            return x;
+        }
+    }
+    return -1;
+}
+
+void dma_channel_unclaim(uint channel) {
+    channels[channel] = DmaChannel();
+}
+
+dma_channel_hw_t* dma_channel_hw_addr(uint channel) {
+    return &channels[channel].hw;
+}
+
+dma_channel_config dma_channel_get_default_config(uint) {
+    return dma_channel_config { DMA_SIZE_32, true, false, 0, false, 0 };
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config* c, enum dma_channel_transfer_size size) { c->size = size; }
+void channel_config_set_read_increment(dma_channel_config* c, bool incr) { c->read_increment = incr; }
+void channel_config_set_write_increment(dma_channel_config* c, bool incr) { c->write_increment = incr; }
+void channel_config_set_dreq(dma_channel_config* c, uint dreq) { c->dreq = dreq; }
+void channel_config_set_ring(dma_channel_config* c, bool write, uint size_bits) {
+    c->ring_write = write;
+    c->ring_bits = size_bits;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config* config, volatile void* write_addr,
+        const volatile void* read_addr, uint transfer_count, bool trigger) {
+    channels[channel].config = *config;
+    channels[channel].hw.write_addr = write_addr;
+    channels[channel].hw.read_addr = read_addr;
+    channels[channel].hw.transfer_count = transfer_count;
+    channels[channel].enabled = trigger;
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger) {
+    channels[channel].hw.transfer_count = trans_count;
+    if (trigger) {
+        channels[channel].enabled = true;
+        dma_drain_fifos();
+    }
+}
+
+void dma_channel_abort(uint channel) {
+    channels[channel].enabled = false;
+}
@@ -0,0 +1,400 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// Time, IRQs, stdio and multicore for the simulated Pico.
+
+#include "sim.h"
+
+#include <pico/stdlib.h>
+#include <pico/multicore.h>
+#include <hardware/irq.h>
+#include <hardware/clocks.h>
+#include <hardware/structs/systick.h>
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <vector>
+
+#define SIM_CLOCK_HZ 125000000
+#define SIM_IRQ_COUNT 32
+// Typical flash timings, from the W25Q16JV datasheet.
+#define SIM_FLASH_ERASE_NS 45000000ull
+#define SIM_FLASH_PROGRAM_NS 400000ull
+// Longest __wfe sleeps with nothing scheduled.
+#define SIM_WFE_LIMIT_NS 20000000ull
+
+namespace sim {
+    struct Event {
+        uint64_t time;
+        uint64_t order;
+        std::function<void()> run;
+
+        bool operator>(const Event& other) const {
+            return time != other.time ? time > other.time : order > other.order;
+        }
+    };
+
+    static uint64_t current_time = 0;
+    static uint64_t event_order = 0;
+    static std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+    static irq_handler_t irq_handlers[SIM_IRQ_COUNT];
+    static bool irq_enabled[SIM_IRQ_COUNT];
+    static bool in_irq = false;
+
+    uint64_t now() { return current_time; }
+
+    uint64_t next_event() {
+        return events.empty() ? UINT64_MAX : events.top().time;
+    }
+
+    void schedule(uint64_t time, std::function<void()> event) {
+        events.push(Event { time < current_time ? current_time : time, event_order++, event });
+    }
+
+    void advance(uint64_t duration) {
+        uint64_t target = current_time + duration;
+
+        // Handlers run by an event advance time themselves, so the clock may
+        // already be past target when they return.
+        while (!events.empty() && events.top().time <= target) {
+            Event event = events.top();
+            events.pop();
+            if (event.time > current_time) { current_time = event.time; }
+            event.run();
+        }
+
+        if (target > current_time) { current_time = target; }
+    }
+
+    void idle(uint64_t limit) {
+        uint64_t until = next_event();
+        uint64_t host = host_next_byte_time();
+        if (host < until) { until = host; }
+        if (until > current_time + limit) { until = current_time + limit; }
+        advance(until > current_time ? until - current_time : POLL_NS);
+    }
+
+    void check_irqs() {
+        if (in_irq) { return; }
+
+        // The oneline code only uses IRQ 0 of each PIO, which is level
+        // triggered on the PIO's irq flags. pio0 has the higher priority.
+        while (true) {
+            uint32_t irq = PIO0_IRQ_0;
+            if (!irq_enabled[irq] || !irq_handlers[irq] || !pio_irq_pending(irq)) { irq = PIO1_IRQ_0; }
+            if (!irq_enabled[irq] || !irq_handlers[irq] || !pio_irq_pending(irq)) { break; }
+
+            in_irq = true;
+            irq_handlers[irq]();
+            in_irq = false;
+        }
+    }
+}
+
+// --------------------
+// |    PICO STDLIB   |
+// --------------------
+
+uint32_t time_us_32() {
+    sim::advance(sim::POLL_NS);
+    return sim::now() / 1000;
+}
+
+uint64_t time_us_64() {
+    sim::advance(sim::POLL_NS);
+    return sim::now() / 1000;
+}
+
+void tight_loop_contents() {
+    sim::advance(sim::POLL_NS);
+}
+
+void stdio_init_all() {}
+
+int getchar_timeout_us(uint32_t timeout_us) {
+    sim::advance(sim::POLL_NS);
+    int data = sim::host_read();
+    if (data != -1) { return data; }
+
+    // Nothing to read, so skip ahead rather than spinning through every poll.
+    if (timeout_us > 0) { sim::idle(timeout_us * 1000ull); }
+    return PICO_ERROR_TIMEOUT;
+}
+
+absolute_time_t get_absolute_time() {
+    return sim::now() / 1000;
+}
+
+// A bulk read costs one poll, however many bytes it returns.
+int stdio_get_until(char* buf, int len, absolute_time_t until) {
+    sim::advance(sim::POLL_NS);
+    int count = 0;
+    while (count < len) {
+        int data = sim::host_read();
+        if (data == -1) { break; }
+        buf[count++] = data;
+    }
+    if (count > 0) { return count; }
+
+    // Nothing to read, so skip ahead to the deadline like getchar_timeout_us.
+    uint64_t deadline = until * 1000;
+    if (deadline > sim::now()) { sim::idle(deadline - sim::now()); }
+    return PICO_ERROR_TIMEOUT;
+}
+
+namespace sim {
+    static void (*chars_available)(void*) = nullptr;
+    static void* chars_available_param = nullptr;
+    static bool event_register = false;
+
+    static void schedule_timer(repeating_timer_t* timer) {
+        schedule(now() + timer->delay_us * 1000, [timer] {
+            if (!timer->cancelled && timer->callback(timer)) { schedule_timer(timer); }
+        });
+    }
+}
+
+void stdio_set_chars_available_callback(void (*fn)(void*), void* param) {
+    sim::chars_available = fn;
+    sim::chars_available_param = param;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out) {
+    *out = repeating_timer_t { delay_us < 0 ? -delay_us : delay_us, callback, user_data, false };
+    sim::schedule_timer(out);
+    return true;
+}
+
+bool cancel_repeating_timer(repeating_timer_t* timer) {
+    timer->cancelled = true;
+    return true;
+}
+
+namespace sim {
+    static alarm_id_t next_alarm_id = 1;
+    static std::set<alarm_id_t> alarms;
+}
+
+// Always fires from the event queue, even when already due. Callbacks are
+// never rescheduled, whatever they return.
+alarm_id_t add_alarm_in_us(uint64_t us, alarm_callback_t callback, void* user_data, bool) {
+    alarm_id_t id = sim::next_alarm_id++;
+    sim::alarms.insert(id);
+    sim::schedule(sim::now() + us * 1000, [id, callback, user_data] {
+        if (sim::alarms.erase(id)) { callback(id, user_data); }
+    });
+    return id;
+}
+
+bool cancel_alarm(alarm_id_t alarm_id) {
+    return sim::alarms.erase(alarm_id) > 0;
+}
+
+void __sev() {
+    sim::event_register = true;
+}
+
+void __wfe() {
+    // Sleeps until the next event, which is how IRQs and timers run, or the
+    // next byte from the host.
+    if (!sim::event_register) { sim::idle(SIM_WFE_LIMIT_NS); }
+    sim::event_register = false;
+
+    if (sim::host_next_byte_time() <= sim::now()) {
+        if (sim::chars_available) { sim::chars_available(sim::chars_available_param); }
+    } else if (sim::host_next_byte_time() == UINT64_MAX) {
+        // Throws Finished once the host is done.
+        sim::host_read();
+    }
+}
+
+int putchar_raw(int c) {
+    uint8_t data = c;
+    sim::host_receive(&data, 1);
+    return c;
+}
+
+// Where io::flush sends its frames. Translation is done like the SDK's, so
+// frames sent with it on get corrupted.
+int stdio_put_string(const char* s, int len, bool newline, bool cr_translation) {
+    std::vector<uint8_t> data;
+    for (int x = 0; x < len + newline; x++) {
+        char c = x < len ? s[x] : '\n';
+        if (cr_translation && c == '\n') { data.push_back('\r'); }
+        data.push_back(c);
+    }
+    sim::host_receive(data.data(), data.size());
+    return len;
+}
+
+void gpio_init(uint) {}
+void gpio_set_dir(uint, bool) {}
+void gpio_put(uint, bool) {}
+
+uint32_t clock_get_hz(enum clock_index) {
+    return SIM_CLOCK_HZ;
+}
+
+// --------------------
+// |     SYSTICK      |
+// --------------------
+
+static systick_hw_t systick_registers;
+systick_hw_t* const systick_hw = &systick_registers;
+
+systick_counter::operator uint32_t() const {
+    uint64_t cycles = sim::now() * (SIM_CLOCK_HZ / 1000000) / 1000;
+    return (0xFFFFFF - cycles) & 0xFFFFFF;
+}
+
+systick_counter& systick_counter::operator=(uint32_t) {
+    return *this;
+}
+
+// --------------------
+// |      FLASH       |
+// --------------------
+
+uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+
+namespace {
+    // Flash starts out erased.
+    struct FlashInit {
+        FlashInit() { memset(sim_flash, 0xFF, sizeof(sim_flash)); }
+    } flash_init;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    memset(sim_flash + flash_offs, 0xFF, count);
+    sim::advance(count / FLASH_SECTOR_SIZE * SIM_FLASH_ERASE_NS);
+}
+
+// Programming can only clear bits.
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    for (size_t x = 0; x < count; x++) {
+        sim_flash[flash_offs + x] &= data[x];
+    }
+    sim::advance(count / FLASH_PAGE_SIZE * SIM_FLASH_PROGRAM_NS);
+}
+
+uint32_t save_and_disable_interrupts() { return 0; }
+void restore_interrupts(uint32_t) {}
+
+namespace sim {
+    static spin_lock_t spin_locks[32];
+    static uint32_t spin_locks_claimed = 0;
+}
+
+int spin_lock_claim_unused(bool) {
+    for (int x = 0; x < 32; x++) {
+        if (!(sim::spin_locks_claimed & (1u << x))) {
+            sim::spin_locks_claimed |= 1u << x;
+            return x;
+        }
+    }
+    return -1;
+}
+
+spin_lock_t* spin_lock_init(uint lock_num) {
+    sim::spin_locks[lock_num].locked = 0;
+    return &sim::spin_locks[lock_num];
+}
+
+uint32_t spin_lock_blocking(spin_lock_t* lock) {
+    lock->locked = 1;
+    return 0;
+}
+
+void spin_unlock(spin_lock_t* lock, uint32_t) {
+    lock->locked = 0;
+}
+
+// --------------------
+// |       IRQ        |
+// --------------------
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler) {
+    sim::irq_handlers[num] = handler;
+}
+
+void irq_remove_handler(uint num, irq_handler_t) {
+    sim::irq_handlers[num] = nullptr;
+}
+
+void irq_set_enabled(uint num, bool enabled) {
+    sim::irq_enabled[num] = enabled;
+}
+
+void irq_set_priority(uint, uint8_t) {}
+
+// --------------------
+// |    MULTICORE     |
+// --------------------
+
+namespace {
+    struct Fifo {
+        std::mutex lock;
+        std::condition_variable ready;
+        std::deque<uint32_t> data;
+
+        void push(uint32_t value) {
+            std::lock_guard<std::mutex> guard(lock);
+            data.push_back(value);
+            ready.notify_all();
+        }
+
+        uint32_t pop() {
+            std::unique_lock<std::mutex> guard(lock);
+            ready.wait(guard, [this] { return !data.empty(); });
+            uint32_t value = data.front();
+            data.pop_front();
+            return value;
+        }
+    };
+
+    Fifo to_core1, to_core0;
+    thread_local bool is_core1 = false;
+}
+
+void multicore_launch_core1(void (*entry)(void)) {
+    std::thread([entry] {
+        is_core1 = true;
+        entry();
+    }).detach();
+}
+
+// Core 1 always returns after sending its last message, so there is nothing
+// left to stop.
+void multicore_reset_core1() {
+    to_core1.data.clear();
+    to_core0.data.clear();
+}
+
+void multicore_fifo_push_blocking(uint32_t data) {
+    (is_core1 ? to_core0 : to_core1).push(data);
+}
+
+uint32_t multicore_fifo_pop_blocking() {
+    return (is_core1 ? to_core1 : to_core0).pop();
+}
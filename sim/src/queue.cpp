@@ -0,0 +1,327 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Checks CircularQueue, then compares it against the queue it replaced, which
+// copied a value at a time and wrapped with a modulo. The stress test runs a
+// producer and a consumer on their own threads, as the firmware does across
+// the cores, and checks every value arrives once and in order.
+//   queue [--iterations N]
+
+#include <circular_queue.h>
+
+#include <chrono>
+#include <initializer_list>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+namespace {
+    int failures = 0;
+
+    void check(bool condition, const char* what, int line) {
+        if (!condition) {
+            printf("FAILED line %d: %s\n", line, what);
+            failures++;
+        }
+    }
+    #define CHECK(CONDITION) check(CONDITION, #CONDITION, __LINE__)
+
+    // The queue before it became lock-free, less get_blocking.
+    template <typename T>
+    class BaselineQueue {
+    private:
+        const int size;
+        T* buffer;
+        int rptr = 0, wptr = 0;
+        int available = 0;
+        bool underflow = false, overflow = false;
+    public:
+        BaselineQueue(int size) : size(size), buffer(new T[size]) {}
+        ~BaselineQueue() { delete[] buffer; }
+
+        T get() {
+            T value = buffer[rptr];
+            rptr = (rptr + 1) % size;
+            available--;
+            underflow |= available < 0;
+            return value;
+        }
+
+        void add(T value) {
+            buffer[wptr] = value;
+            wptr = (wptr + 1) % size;
+            available++;
+            overflow |= available >= size;
+        }
+
+        void add(const T values[], int count) {
+            for (int x = 0; x < count; x++) {
+                buffer[(wptr + x) % size] = values[x];
+            }
+            wptr = (wptr + count) % size;
+            available += count;
+            overflow |= available >= size;
+        }
+
+        int gets_avaiable() { return available; }
+        int adds_available() { return size - available; }
+    };
+
+    void test_single() {
+        CircularQueue<int, 4> queue;
+        CHECK(queue.gets_avaiable() == 0);
+        CHECK(queue.adds_available() == 4);
+        for (int x = 0; x < 4; x++) { queue.add(x + 10); }
+        CHECK(queue.gets_avaiable() == 4);
+        CHECK(!queue.overflowed());
+
+        // A full queue drops the value.
+        queue.add(99);
+        CHECK(queue.overflowed());
+        for (int x = 0; x < 4; x++) { CHECK(queue.get() == x + 10); }
+        CHECK(!queue.underflowed());
+
+        CHECK(queue.get() == 0);
+        CHECK(queue.underflowed());
+    }
+
+    void test_bulk_and_wraparound() {
+        CircularQueue<byte, 8> queue;
+        byte in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        byte out[8] = {};
+
+        // Moves the pointers to 6, so the next bulk operations wrap.
+        CHECK(queue.add(in, 6) == 6);
+        CHECK(queue.get(out, 6) == 6);
+        CHECK(memcmp(in, out, 6) == 0);
+
+        CHECK(queue.add(in, 5) == 5);
+        CHECK(queue.gets_avaiable() == 5);
+        memset(out, 0, sizeof(out));
+        CHECK(queue.get(out, 5) == 5);
+        CHECK(memcmp(in, out, 5) == 0);
+
+        // Anything past the space is dropped; anything past the data is not read.
+        byte many[10] = { 11, 12, 13, 14, 15, 16, 17, 18, 19, 20 };
+        CHECK(queue.add(many, 10) == 8);
+        CHECK(queue.overflowed());
+        CHECK(queue.get(out, 8) == 8);
+        CHECK(memcmp(many, out, 8) == 0);
+        CHECK(queue.get(out, 1) == 0);
+        CHECK(queue.underflowed());
+
+        // Wraps the buffer many times over, at every offset.
+        for (int x = 0; x < 1000; x++) {
+            queue.add(in, 7);
+            CHECK(queue.get(out, 7) == 7);
+        }
+        CHECK(memcmp(in, out, 7) == 0);
+
+        // commit() and skip() only add to the free running pointers, so
+        // moving both by the same amount leaves the queue empty, 16 values
+        // short of the counter wrapping.
+        int park = -16 - (int)queue.write_position();
+        queue.commit(park);
+        queue.skip(park);
+        CHECK(queue.write_position() == 0xFFFFFFF0u);
+        CHECK(queue.gets_avaiable() == 0);
+        for (int x = 0; x < 10; x++) {
+            queue.add(in, 7);
+            CHECK(queue.gets_avaiable() == 7);
+            CHECK(queue.adds_available() == 1);
+            memset(out, 0, sizeof(out));
+            CHECK(queue.get(out, 7) == 7);
+            CHECK(memcmp(in, out, 7) == 0);
+        }
+        CHECK(queue.write_position() < 0xFFFFFFF0u);
+    }
+
+    void test_add_record() {
+        CircularQueue<byte, 8> queue;
+        byte record[5] = { 1, 2, 3, 4, 5 };
+        CHECK(queue.add_record(record, 5));
+        CHECK(!queue.overflowed());
+
+        // A record that doesn't fit adds nothing.
+        CHECK(!queue.add_record(record, 5));
+        CHECK(queue.overflowed());
+        CHECK(queue.gets_avaiable() == 5);
+        CHECK(queue.add_record(record, 3));
+        CHECK(queue.adds_available() == 0);
+    }
+
+    void test_peek_and_skip() {
+        CircularQueue<byte, 8> queue;
+        byte in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        const byte* segment = nullptr;
+        CHECK(queue.peek_contiguous(&segment) == 0);
+
+        queue.add(in, 6);
+        queue.skip(4);
+        queue.add(in, 5);
+
+        // 2 values before the end of the buffer, then 3 from the start.
+        CHECK(queue.peek_contiguous(&segment) == 4);
+        CHECK(segment[0] == 5 && segment[1] == 6 && segment[2] == 1 && segment[3] == 2);
+        queue.skip(4);
+        CHECK(queue.peek_contiguous(&segment) == 3);
+        CHECK(segment[0] == 3 && segment[2] == 5);
+        queue.skip(3);
+        CHECK(queue.gets_avaiable() == 0);
+    }
+
+    void test_skip_to() {
+        CircularQueue<byte, 8> queue;
+        byte in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        queue.add(in, 5);
+        CHECK(queue.get() == 1);
+        uint position = queue.write_position();
+        queue.add(in + 5, 3);
+
+        // Only what was added before the position is dropped.
+        queue.skip_to(position);
+        CHECK(queue.gets_avaiable() == 3);
+        CHECK(queue.get() == 6);
+
+        // Nothing moves back over values already read.
+        queue.skip_to(position);
+        CHECK(queue.gets_avaiable() == 2);
+        CHECK(queue.get() == 7);
+    }
+
+    void test_reserve_and_commit() {
+        CircularQueue<byte, 8> queue;
+        byte* space = nullptr;
+        CHECK(queue.reserve_contiguous(&space) == 8);
+
+        byte in[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+        byte out[8] = {};
+        queue.add(in, 6);
+        queue.get(out, 3);
+
+        // Free space runs to the end of the buffer, then wraps.
+        CHECK(queue.reserve_contiguous(&space) == 2);
+        space[0] = 20;
+        space[1] = 21;
+        queue.commit(2);
+        CHECK(queue.reserve_contiguous(&space) == 3);
+        space[0] = 22;
+        queue.commit(1);
+
+        CHECK(queue.get(out, 6) == 6);
+        byte expected[6] = { 4, 5, 6, 20, 21, 22 };
+        CHECK(memcmp(out, expected, 6) == 0);
+        CHECK(!queue.overflowed() && !queue.underflowed());
+    }
+
+    // Records of varying length go through a small queue, so both threads
+    // keep wrapping and waiting on each other.
+    void test_spsc_stress(uint32_t values) {
+        static CircularQueue<uint32_t, 64> queue;
+        bool in_order = true;
+
+        std::thread consumer([&in_order, values] {
+            uint32_t next = 0;
+            uint32_t buffer[16];
+            while (next < values) {
+                int available = queue.gets_avaiable();
+                // Lets the producer run when there is only one host core.
+                if (available == 0) { std::this_thread::yield(); }
+                int count = queue.get(buffer, available < 16 ? available : 16);
+                for (int x = 0; x < count; x++) {
+                    if (buffer[x] != next++) { in_order = false; }
+                }
+            }
+        });
+
+        uint32_t next = 0;
+        uint32_t buffer[16];
+        while (next < values) {
+            int count = 1 + next % 16;
+            if (values - next < (uint32_t)count) { count = values - next; }
+            for (int x = 0; x < count; x++) { buffer[x] = next + x; }
+            if (queue.add_record(buffer, count)) {
+                next += count;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        consumer.join();
+
+        CHECK(in_order);
+        CHECK(queue.gets_avaiable() == 0);
+        CHECK(!queue.underflowed());
+    }
+
+    template <typename Run>
+    double time_ns(int iterations, Run run) {
+        auto started = std::chrono::steady_clock::now();
+        for (int x = 0; x < iterations; x++) { run(); }
+        auto finished = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(finished - started).count() / iterations;
+    }
+
+    // A 4 byte frame at a time in and out of a 512 byte buffer, as the
+    // datastream does, then 64 byte chunks.
+    void bench(int iterations) {
+        static CircularQueue<byte, 512> queue;
+        BaselineQueue<byte> baseline(512);
+        byte frame[64] = {};
+        volatile byte sink = 0;
+
+        for (int bytes : { 4, 64 }) {
+            double old_ns = time_ns(iterations, [&] {
+                baseline.add(frame, bytes);
+                for (int x = 0; x < bytes; x++) { sink = baseline.get(); }
+            });
+            double new_ns = time_ns(iterations, [&] {
+                byte out[64];
+                queue.add(frame, bytes);
+                queue.get(out, bytes);
+                sink = out[0];
+            });
+            printf("%2d bytes in and out: baseline %.1f ns, CircularQueue %.1f ns (%.1fx)\n",
+                bytes, old_ns, new_ns, old_ns / new_ns);
+        }
+        (void)sink;
+    }
+}
+
+int main(int argc, char** argv) {
+    int iterations = 1000000;
+    for (int x = 1; x < argc; x++) {
+        if (strcmp(argv[x], "--iterations") == 0 && x + 1 < argc) {
+            iterations = atoi(argv[++x]);
+        } else {
+            fprintf(stderr, "usage: queue [--iterations N]\n");
+            return 2;
+        }
+    }
+    if (iterations < 1) { iterations = 1; }
+
+    test_single();
+    test_bulk_and_wraparound();
+    test_add_record();
+    test_peek_and_skip();
+    test_skip_to();
+    test_reserve_and_commit();
+    test_spsc_stress(iterations);
+    printf("CircularQueue: %s\n", failures == 0 ? "ok" : "FAILED");
+
+    bench(iterations);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Replays the captures in sample_readings through the Recorder's capture
+// decoding and record packing, and reports how fast that went. Each
+// transaction becomes the PIO words the capture program would have pushed,
+// so the DMA ring, oneline::Decoder and CAPTURE_DATA packing all run as on
+// the device. The output is decoded again and checked against the capture.
+//   replay [--iterations N] capture.raw...
+
+#include "sim.h"
+#include "capture.h"
+
+#include <config.h>
+#include <commands.h>
+#include <io.h>
+#include <labels.h>
+#include <consoles/common/recorder.h>
+#include <consoles/n64/protocol.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ONELINE_DMA_CAPTURE
+#error "replay feeds the capture rings, so it needs ONELINE_DMA_CAPTURE"
+#endif
+
+// Captures from different files (and iterations) are this far apart.
+#define REPLAY_GAP_US 1000000
+
+namespace {
+    const uint32_t port_pins[] = { ONELINE_PIN_PORT_1, ONELINE_PIN_PORT_2, ONELINE_PIN_PORT_3, ONELINE_PIN_PORT_4 };
+
+    struct Transaction {
+        uint32_t timestamp;
+        sim::CaptureRecord record;
+        std::vector<uint32_t> words;
+    };
+
+    // Request bytes after the command. Same as N64_REQUEST_BYTES in controller/core/capture.py.
+    size_t request_bytes(uint8_t command) {
+        switch (command) {
+        case 0x02: return 2;
+        case 0x03: return 34;
+        default: return 0;
+        }
+    }
+
+    // The words the capture program pushes: a byte every 8 bits, then the
+    // leftover bits and the inverted bit count. The console's stop bit reads
+    // as a 1 between the request and response.
+    std::vector<uint32_t> capture_words(const sim::CaptureRecord& record) {
+        std::vector<bool> bits;
+        auto add_byte = [&bits](uint8_t value) {
+            for (int bit = 7; bit >= 0; bit--) { bits.push_back((value >> bit) & 1); }
+        };
+
+        add_byte(record.command);
+        for (uint8_t value : record.request) { add_byte(value); }
+        bits.push_back(1);
+        for (uint8_t value : record.response) { add_byte(value); }
+
+        std::vector<uint32_t> words;
+        uint32_t isr = 0;
+        for (size_t x = 0; x < bits.size(); x++) {
+            isr = (isr << 1) | bits[x];
+            if (x % 8 == 7) {
+                words.push_back(isr);
+                isr = 0;
+            }
+        }
+        words.push_back(isr);
+        words.push_back(~(uint32_t)bits.size());
+        return words;
+    }
+
+    bool load_capture(const char* path, std::vector<Transaction>& transactions) {
+        std::ifstream file(path);
+        if (!file) { return false; }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, ',')) { fields.push_back(field); }
+            if (fields.size() != 5) { continue; }
+
+            Transaction transaction;
+            char* end;
+            transaction.timestamp = strtoul(fields[0].c_str(), &end, 16);
+            if (*end || fields[0].empty()) { continue; }
+
+            sim::CaptureRecord& record = transaction.record;
+            record.port = atoi(fields[1].c_str());
+            record.command = strtoul(fields[2].c_str(), nullptr, 16);
+
+            std::vector<uint8_t> reply;
+            const std::string& hex = fields[4];
+            for (size_t x = 0; x + 1 < hex.size(); x += 2) {
+                reply.push_back(strtoul(hex.substr(x, 2).c_str(), nullptr, 16));
+            }
+            size_t split = std::min(request_bytes(record.command), reply.size());
+            record.request.assign(reply.begin(), reply.begin() + split);
+            record.response.assign(reply.begin() + split, reply.end());
+
+            transaction.words = capture_words(record);
+            transactions.push_back(transaction);
+        }
+        return true;
+    }
+
+    struct Output {
+        uint64_t frame_bytes = 0;
+        uint64_t capture_bytes = 0;
+        uint64_t errors = 0;
+        uint64_t matched = 0;
+        uint64_t dropped = 0;
+        uint64_t unmatched = 0;
+    } output;
+
+    // Everything replayed, per port, in order. Records are matched against
+    // it, skipping transactions the recorder does not know how to size.
+    std::vector<const sim::CaptureRecord*> expected[4];
+    size_t next_expected[4];
+
+    void check_record(const sim::CaptureRecord& record) {
+        std::vector<const sim::CaptureRecord*>& port = expected[record.port];
+        size_t& next = next_expected[record.port];
+        while (next < port.size()) {
+            const sim::CaptureRecord* actual = port[next++];
+            if (actual->command == record.command && actual->request == record.request && actual->response == record.response) {
+                output.matched++;
+                return;
+            }
+            output.dropped++;
+        }
+        output.unmatched++;
+    }
+
+    sim::CaptureDecoder captures(check_record);
+
+    sim::FrameReader frames([](uint8_t command, const std::vector<uint8_t>& payload) {
+        output.frame_bytes += 3 + payload.size();
+        if (command == commands::device::CAPTURE_DATA) {
+            output.capture_bytes += payload.size();
+            captures.decode(payload);
+        } else if (command == commands::device::ERROR) {
+            output.errors++;
+        } else if (command == commands::device::LOG) {
+            sim::decode_log(payload, [](const sim::LogMessage& message) {
+                if (message.is_error()) { output.errors += message.count; }
+            });
+        }
+    });
+}
+
+// Nothing is on the bus, and the host only listens.
+namespace sim {
+    void drive_bit(uint32_t, WireBit, uint64_t, int) {}
+    void host_send(const uint8_t*, int, uint64_t) {}
+    void host_receive(const uint8_t* data, int count) { frames.add(data, count); }
+    int host_read() { return -1; }
+    uint64_t host_next_byte_time() { return UINT64_MAX; }
+}
+
+int main(int argc, char** argv) {
+    int iterations = 100;
+    std::vector<Transaction> transactions;
+    std::vector<size_t> file_starts;
+
+    for (int x = 1; x < argc; x++) {
+        if (!strcmp(argv[x], "--iterations") && x + 1 < argc) {
+            iterations = atoi(argv[++x]);
+            continue;
+        }
+        file_starts.push_back(transactions.size());
+        if (!load_capture(argv[x], transactions)) {
+            fprintf(stderr, "could not read %s\n", argv[x]);
+            return 2;
+        }
+    }
+    if (transactions.empty() || iterations < 1) {
+        fprintf(stderr, "usage: replay [--iterations N] capture.raw...\n");
+        return 2;
+    }
+
+    uint64_t word_count = 0;
+    for (const Transaction& transaction : transactions) { word_count += transaction.words.size(); }
+
+    io::init();
+    oneline::Recorder* recorder = new oneline::Recorder(labels::CONSOLE_N64, n64::commands);
+
+    // Timestamps are kept relative to each file's first transaction.
+    auto started = std::chrono::steady_clock::now();
+    uint64_t base_us = sim::now() / 1000;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        size_t file = 0;
+        uint32_t file_start = 0;
+        for (size_t x = 0; x < transactions.size(); x++) {
+            const Transaction& transaction = transactions[x];
+            if (file < file_starts.size() && x == file_starts[file]) {
+                base_us = sim::now() / 1000 + REPLAY_GAP_US;
+                file_start = transaction.timestamp;
+                file++;
+            }
+
+            uint64_t at = (base_us + (transaction.timestamp - file_start)) * 1000;
+            if (at > sim::now()) { sim::advance(at - sim::now()); }
+
+            expected[transaction.record.port].push_back(&transaction.record);
+            for (uint32_t word : transaction.words) {
+                sim::pio_push_word(port_pins[transaction.record.port], word);
+            }
+            recorder->update();
+            io::flush_if_due();
+        }
+    }
+
+    // Long enough for any collapsed repeats to be sent.
+    sim::advance(REPLAY_GAP_US * 1000ull);
+    recorder->update();
+    io::flush();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    delete recorder;
+
+    uint64_t total = (uint64_t)transactions.size() * iterations;
+    printf("Replayed %zu transactions (%llu PIO words) x %d iterations in %.3fs\n",
+        transactions.size(), (unsigned long long)word_count, iterations, wall);
+    printf("  %.0f transactions/s, %.1f M words/s\n", total / wall, word_count * iterations / wall / 1e6);
+    printf("  %llu bytes emitted (%llu capture data), %.2f bytes/transaction\n",
+        (unsigned long long)output.frame_bytes, (unsigned long long)output.capture_bytes, (double)output.capture_bytes / total);
+    printf("  %llu records, %llu repeat records\n",
+        (unsigned long long)captures.records, (unsigned long long)captures.repeat_records);
+    printf("  %llu matched, %llu not recorded, %llu unmatched, %llu errors\n",
+        (unsigned long long)output.matched, (unsigned long long)output.dropped,
+        (unsigned long long)output.unmatched, (unsigned long long)output.errors);
+
+    return output.unmatched == 0 && output.errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include <vector>
+
+// Everything runs on simulated time, in nanoseconds. The firmware's own polling
+// (time_us_32, FIFO checks, getchar) is what moves the clock forward, and IRQs
+// are run from inside those calls, much like they would interrupt a real core.
+namespace sim {
+    // How long one poll of the hardware costs the firmware.
+    constexpr uint64_t POLL_NS = 20;
+
+    struct Finished {};
+
+    uint64_t now();
+    // Runs every event due in the next duration, including any IRQs they raise.
+    void advance(uint64_t duration);
+    // Used when the main loop has nothing to do: skips ahead to the next event
+    // but no further than limit.
+    void idle(uint64_t limit);
+    // Time of the next scheduled event, or UINT64_MAX.
+    uint64_t next_event();
+    void schedule(uint64_t time, std::function<void()> event);
+
+    // Runs the IRQ handlers for any pending, enabled interrupts.
+    void check_irqs();
+    // Whether the PIO has any IRQ flags raised which have their source enabled.
+    bool pio_irq_pending(uint32_t irq);
+
+    // --------------------
+    // |       BUS        |
+    // --------------------
+
+    // Oneline bit timing. Every bit is 4us, the low part of it is what
+    // tells them apart. Console stop bits look exactly like a 1.
+    constexpr uint64_t BIT_NS = 4000;
+    enum WireBit { WIRE_0, WIRE_1, WIRE_STOP };
+    inline uint64_t low_ns(WireBit bit) { return bit == WIRE_1 ? 1000 : bit == WIRE_STOP ? 2000 : 3000; }
+
+    // Who is driving a bit. PIO state machines use their own index, so they
+    // never read back what they write.
+    constexpr int DRIVER_CONSOLE = -1;
+    constexpr int DRIVER_CONTROLLER = -2;
+
+    // Puts a bit on the line for pin, starting (falling) at the given time.
+    void drive_bit(uint32_t pin, WireBit bit, uint64_t fall, int driver);
+    // The PIO side of drive_bit.
+    void pio_observe_bit(uint32_t pin, WireBit bit, uint64_t fall, int driver);
+    // Pushes a word from every enabled state machine on pin, skipping the bus.
+    void pio_push_word(uint32_t pin, uint32_t word);
+
+    // Counters the report prints.
+    struct PioCounters {
+        uint64_t words_pushed = 0;
+        uint64_t rx_overflows = 0;
+        uint64_t write_stalls = 0;
+        uint64_t dma_words = 0;
+    };
+    const PioCounters& pio_counters();
+    // Sends every word written to a pio0 state machine to words rather than
+    // the bus, so writes can be checked without timing them. nullptr restores
+    // the FIFO.
+    void pio_sink_tx(uint32_t sm, std::vector<uint32_t>* words);
+    // Holds the firmware up by as much as this each time it hands a reply to
+    // pio0, varying from reply to reply, as if its IRQ had been held off.
+    void pio_set_handover_jitter(uint64_t ns);
+
+    // --------------------
+    // |    SCENARIO      |
+    // --------------------
+
+    enum Console { CONSOLE_N64, CONSOLE_GAMECUBE };
+    // Mixed streams every port but the last, which has a live controller
+    // that is recorded. Realtime has live controllers on the realtime pins,
+    // which the device passes through to the console.
+    enum Mode { MODE_DATASTREAM, MODE_RECORD, MODE_MIXED, MODE_REALTIME };
+    // Datastream only: where the movie comes from.
+    //   FLASH_UPLOAD   - The host writes it to flash, then plays it.
+    //   FLASH_AUTOPLAY - It is already in flash, and plays at power on without a host.
+    enum Flash { FLASH_NONE, FLASH_UPLOAD, FLASH_AUTOPLAY };
+
+    struct Options {
+        Console console = CONSOLE_N64;
+        Mode mode = MODE_DATASTREAM;
+        int frames = 600;
+        int ports = 1;
+        // N64 games read a new frame every poll, GameCube ones get the same
+        // frame for every poll of a frame.
+        int polls_per_frame = 1;
+        uint64_t poll_interval_us = 16683;
+        uint64_t host_latency_us = 2000;
+        // The host stops sending for this long, halfway through the run.
+        uint64_t host_stall_ms = 0;
+        uint64_t reply_timeout_us = 64;
+        // Datastream only: sent with REPLY_DELAY for every command, if set.
+        int reply_delay_ns = -1;
+        // Datastream only: port 1 gets a Controller Pack, which is tested at startup.
+        bool pack = false;
+        Flash flash = FLASH_NONE;
+        // Datastream only: inputs are sent (or stored) as a packed stream.
+        bool packed = false;
+        bool verbose = false;
+    };
+    extern Options options;
+
+    // Schedules the console, controllers and host for the whole run.
+    void start_bus();
+    // Prints what the console and host saw. Returns false if anything was wrong.
+    bool report();
+
+    // Host side of the USB serial connection.
+    void host_send(const uint8_t* data, int count, uint64_t at);
+    // Called with everything the firmware writes to stdout.
+    void host_receive(const uint8_t* data, int count);
+    // Returns the next byte the host has sent by now, or -1. Throws Finished
+    // once the host is done and everything sent has been read.
+    int host_read();
+    uint64_t host_next_byte_time();
+}
@@ -0,0 +1,99 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+// Compares the generic oneline::Writer against the fixed size write_reply for
+// each reply size the firmware sends. The PIO words are taken straight from
+// the state machine, so only the firmware's own packing and FIFO writes are
+// timed, and both paths must produce the same words.
+//   writer [--iterations N]
+
+#include "sim.h"
+
+#include <consoles/common/oneline.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+    struct Result {
+        double ns = 0;
+        std::vector<uint32_t> words;
+    };
+
+    template <typename Write>
+    Result run(int iterations, Write write) {
+        Result result;
+        result.words.reserve(64);
+        sim::pio_sink_tx(oneline::port_1, &result.words);
+
+        auto started = std::chrono::steady_clock::now();
+        for (int x = 0; x < iterations; x++) {
+            result.words.clear();
+            write();
+        }
+        auto finished = std::chrono::steady_clock::now();
+
+        sim::pio_sink_tx(oneline::port_1, nullptr);
+        result.ns = std::chrono::duration<double, std::nano>(finished - started).count() / iterations;
+        return result;
+    }
+
+    template <int bytes>
+    bool compare(int iterations) {
+        byte data[bytes];
+        for (int x = 0; x < bytes; x++) { data[x] = rand(); }
+
+        Result generic = run(iterations, [&] { oneline::Writer(oneline::port_1, 0, bytes).write(data); });
+        Result fixed = run(iterations, [&] { oneline::write_reply<bytes>(oneline::port_1, 0, data); });
+
+        bool matched = generic.words == fixed.words;
+        printf("%2d byte reply: %zu words, Writer %.1f ns, write_reply<%d> %.1f ns (%.1fx) %s\n",
+            bytes, fixed.words.size(), generic.ns, bytes, fixed.ns, generic.ns / fixed.ns,
+            matched ? "ok" : "MISMATCH");
+        return matched;
+    }
+}
+
+// Nothing is on the bus, and there is no host.
+namespace sim {
+    void drive_bit(uint32_t, WireBit, uint64_t, int) {}
+    void host_send(const uint8_t*, int, uint64_t) {}
+    void host_receive(const uint8_t*, int) {}
+    int host_read() { return -1; }
+    uint64_t host_next_byte_time() { return UINT64_MAX; }
+}
+
+int main(int argc, char** argv) {
+    int iterations = 1000000;
+    for (int x = 1; x < argc; x++) {
+        if (strcmp(argv[x], "--iterations") == 0 && x + 1 < argc) {
+            iterations = atoi(argv[++x]);
+        } else {
+            fprintf(stderr, "usage: writer [--iterations N]\n");
+            return 2;
+        }
+    }
+    if (iterations < 1) { iterations = 1; }
+
+    bool ok = compare<1>(iterations);
+    ok &= compare<3>(iterations);
+    ok &= compare<4>(iterations);
+    ok &= compare<33>(iterations);
+    return ok ? 0 : 1;
+}
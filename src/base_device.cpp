@@ -28,9 +28,27 @@ void BaseDevice::update() {}
 bool BaseDevice::is_oneline() const {
     return false;
 }
+int BaseDevice::controller_config_size() const {
+    return 0;
+}
 
 void BaseDevice::handle_datastream() NOT_IMPL_WARNING
 void DummyDevice::handle_datastream() NO_DEVICE_WARNING;
 
+void BaseDevice::handle_datastream_encoding() NOT_IMPL_WARNING;
+void DummyDevice::handle_datastream_encoding() NO_DEVICE_WARNING;
+
 void BaseDevice::handle_controller_config() NOT_IMPL_WARNING;
 void DummyDevice::handle_controller_config() NO_DEVICE_WARNING;
+
+void BaseDevice::handle_controller_pack_write() NOT_IMPL_WARNING;
+void DummyDevice::handle_controller_pack_write() NO_DEVICE_WARNING;
+
+void BaseDevice::handle_controller_pack_read() NOT_IMPL_WARNING;
+void DummyDevice::handle_controller_pack_read() NO_DEVICE_WARNING;
+
+void BaseDevice::handle_flash_movie_play() NOT_IMPL_WARNING;
+void DummyDevice::handle_flash_movie_play() NO_DEVICE_WARNING;
+
+void BaseDevice::handle_realtime_overlay() NOT_IMPL_WARNING;
+void DummyDevice::handle_realtime_overlay() NO_DEVICE_WARNING;
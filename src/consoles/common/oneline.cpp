@@ -19,15 +19,21 @@
 
 #include <hardware/pio.h>
 #include <hardware/clocks.h>
+#include <hardware/dma.h>
+#include <hardware/sync.h>
+#include <pico/multicore.h>
 
 #include "devices.h"
 #include "helpers.h"
+#include "stats.h"
 
 // REFERENCE: https://kthompson.gitlab.io/2016/07/26/n64-controller-protocol.html
 // Note: GCN Controller uses the same format, hence the shared code.
 
 #define ONELINE_PIO pio0
 #define ONELINE_IRQ PIO0_IRQ_0
+#define REQUEST_PIO pio1
+#define REQUEST_IRQ PIO1_IRQ_0
 
 #ifdef LED_SHOWS_ONELINE_ACTIVITY
 #define DATASTREAM_START() LED_ON()
@@ -39,7 +45,23 @@
 
 namespace oneline {
     uint pio_offset = 0;
-    OnelineHandler* oneline_handler = nullptr;
+    // Written from the main loop while the IRQ runs, one pointer at a time.
+    OnelineHandler* volatile port_handlers[4] = {};
+    int handler_count = 0;
+    // Turnaround before the reply to each command, in PIO cycles on top of
+    // oneline_REPLY_MIN_CYCLES.
+    uint16_t reply_delays[256];
+    // The reader waits this many 2 cycle loops after every stop bit before it
+    // looks for a reply, so a reply handed over late by up to that much still
+    // starts on time. It covers as much of the shortest turnaround as it can,
+    // and each reply counts whatever is left of its own.
+    uint32_t handover_loops = 0;
+    // What each state machine has in its OSR, until its next reply ends.
+    uint32_t port_handover_loops[4];
+#ifdef ENABLE_STATS
+    // When the current IRQ started, for IRQ_TO_REPLY.
+    uint32_t irq_start = 0;
+#endif
 
     void handle_irq();
 
@@ -56,10 +78,16 @@ namespace oneline {
         sm_config_set_set_pins(&reader_config, pin, 1);
         sm_config_set_jmp_pin(&reader_config, pin);
 
-        sm_config_set_in_shift(&reader_config, false /*shift right*/, false /*auto push*/, 8 /*push size*/);
+        sm_config_set_in_shift(&reader_config, false /*shift right*/, true /*auto push*/, 8 /*push size*/);
         sm_config_set_out_shift(&reader_config, false /*shift left*/, false /*auto pull*/, 32 /*pull size*/);
-
-        pio_sm_init(ONELINE_PIO, (uint)port, pio_offset, &reader_config);
+        // mov x status is all ones until a reply is pushed.
+        sm_config_set_mov_status(&reader_config, STATUS_TX_LESSTHAN, 1);
+
+        pio_sm_init(ONELINE_PIO, (uint)port, pio_offset + oneline_offset_start, &reader_config);
+        // Normally the end of each reply loads the handover wait.
+        pio_sm_put(ONELINE_PIO, (uint)port, handover_loops);
+        pio_sm_exec(ONELINE_PIO, (uint)port, pio_encode_pull(false, true));
+        port_handover_loops[port] = handover_loops;
         pio_sm_set_enabled(ONELINE_PIO, (uint)port, true);
     }
 
@@ -69,22 +97,22 @@ namespace oneline {
         pio_set_irq0_source_enabled(ONELINE_PIO, (pio_interrupt_source)(pis_interrupt0 + (uint)port), false);
     }
 
-    void init(OnelineHandler* handler) {
+    // IRQs are enabled per core, so these must run on the core which will
+    // service the ports.
+    void start_ports() {
+        stats::init();
         pio_offset = pio_add_program(ONELINE_PIO, &oneline_program);
         irq_set_exclusive_handler(ONELINE_IRQ, handle_irq);
+        irq_set_priority(ONELINE_IRQ, PICO_HIGHEST_IRQ_PRIORITY);
         irq_set_enabled(ONELINE_IRQ, true);
 
         setup_port(port_1, ONELINE_PIN_PORT_1);
         setup_port(port_2, ONELINE_PIN_PORT_2);
         setup_port(port_3, ONELINE_PIN_PORT_3);
         setup_port(port_4, ONELINE_PIN_PORT_4);
-
-        oneline_handler = handler;
     }
 
-    void uninit() {
-        oneline_handler = nullptr;
-
+    void stop_ports() {
         setdown_port(port_1);
         setdown_port(port_2);
         setdown_port(port_3);
@@ -95,6 +123,79 @@ namespace oneline {
         pio_remove_program(ONELINE_PIO, &oneline_program, pio_offset);
     }
 
+#ifdef ONELINE_USE_CORE1
+    enum Core1Message : uint32_t {
+        CORE1_STARTED = 0xC0DE0001,
+        CORE1_STOP = 0xC0DE0002,
+        CORE1_STOPPED = 0xC0DE0003,
+    };
+
+    // Core 1 owns the ports for as long as the device is loaded. It sleeps in
+    // the fifo wait between IRQs, and only wakes fully to shut down.
+    void core1_main() {
+        start_ports();
+        multicore_fifo_push_blocking(CORE1_STARTED);
+
+        while (multicore_fifo_pop_blocking() != CORE1_STOP) {}
+
+        stop_ports();
+        multicore_fifo_push_blocking(CORE1_STOPPED);
+    }
+#endif
+
+    void init(OnelineHandler* handler, uint ports) {
+        for (int x = port_1; x <= port_4; x++) {
+            if (ports & (1 << x)) { port_handlers[x] = handler; }
+        }
+        if (handler_count++ > 0) { return; }
+
+#ifdef ONELINE_USE_CORE1
+        multicore_reset_core1();
+        multicore_launch_core1(core1_main);
+        while (multicore_fifo_pop_blocking() != CORE1_STARTED) {}
+#else
+        start_ports();
+#endif
+    }
+
+    void set_reply_delay(int command, uint32_t ns) {
+        // The reader can't start any sooner, so that much is already counted.
+        uint32_t cycles = ns * oneline_F_PIO_MHZ / 1000;
+        cycles = cycles > oneline_REPLY_MIN_CYCLES ? cycles - oneline_REPLY_MIN_CYCLES : 0;
+        if (cycles > 0xFFF) { cycles = 0xFFF; }
+
+        if (command == all_commands) {
+            for (int x = 0; x < 256; x++) { reply_delays[x] = cycles; }
+        } else if (command >= 0 && command < 256) {
+            reply_delays[command] = cycles;
+        }
+
+        uint32_t shortest = 0xFFF;
+        for (int x = 0; x < 256; x++) {
+            if (reply_delays[x] < shortest) { shortest = reply_delays[x]; }
+        }
+        handover_loops = shortest / 2;
+    }
+
+    void set_handler(Port port, OnelineHandler* handler) {
+        port_handlers[port] = handler;
+    }
+
+    void uninit(OnelineHandler* handler) {
+        for (int x = port_1; x <= port_4; x++) {
+            if (port_handlers[x] == handler) { port_handlers[x] = nullptr; }
+        }
+        if (--handler_count > 0) { return; }
+
+#ifdef ONELINE_USE_CORE1
+        multicore_fifo_push_blocking(CORE1_STOP);
+        while (multicore_fifo_pop_blocking() != CORE1_STOPPED) {}
+        multicore_reset_core1();
+#else
+        stop_ports();
+#endif
+    }
+
 
     // Shortcut Methods
     inline bool can_read(Port port) { return !pio_sm_is_rx_fifo_empty(ONELINE_PIO, (uint)port); }
@@ -104,8 +205,25 @@ namespace oneline {
     inline void write_blocking(Port port, uint32_t data) { pio_sm_put_blocking(ONELINE_PIO, (uint)port, data); }
     inline void jump(Port port, uint offset) { pio_sm_exec(ONELINE_PIO, port, pio_encode_jmp(pio_offset + offset)); }
     inline void abort_read(Port port) { jump(port, oneline_offset_reset_bit); }
-    //inline void start_request(Port port, uint bits) { write(port, bits); jump(port, oneline_offset_write_request); }
-    inline void start_reply(Port port, uint bits) { write(port, bits); jump(port, oneline_offset_write_reply); }
+    // The reader picks the reply up by itself once the stop bit is over.
+    inline void start_reply(Port port, byte command, uint bits) {
+        uint32_t waited = port_handover_loops[port] * 2;
+        uint32_t turnaround = reply_delays[command] > waited ? reply_delays[command] - waited : 0;
+        write(port, (turnaround << 20) | (bits - 1));
+        STATS_RECORD(stats::IRQ_TO_REPLY, irq_start);
+    }
+    // Follows the last word, and sets the handover wait for the next stop bit.
+    // The console's stop bit raises the irq as well, so if it hasn't started
+    // yet it's waited for, and cleared along with the request's. Otherwise it
+    // would start another read while the reply goes out.
+    inline void end_reply(Port port) {
+        write_blocking(port, handover_loops);
+        port_handover_loops[port] = handover_loops;
+
+        uint start_time = time_us_32();
+        while (pio_sm_get_pc(ONELINE_PIO, (uint)port) == pio_offset + oneline_offset_fall_wait
+                && !TIMED_OUT(start_time, ONELINE_STOP_BIT_TIMEOUT_US)) {}
+    }
 
     const Port get_port() {
         if (pio_interrupt_get(ONELINE_PIO, (uint)port_1)) { return port_1; }
@@ -116,16 +234,21 @@ namespace oneline {
     }
 
     void handle_irq() {
-        if (oneline_handler == nullptr) {
-            return;
-        }
-
         DATASTREAM_START();
+#ifdef ENABLE_STATS
+        irq_start = stats::now();
+#endif
         Port port = get_port();
         if (port != port_invalid) {
-            oneline_handler->handle_oneline(port);
+            OnelineHandler* handler = port_handlers[port];
+            if (handler != nullptr) {
+                handler->handle_oneline(port);
+            } else {
+                read_discard(port);
+            }
             pio_interrupt_clear(ONELINE_PIO, port);
         }
+        STATS_RECORD(stats::IRQ_DURATION, irq_start);
         DATASTREAM_END();
     }
 
@@ -141,43 +264,37 @@ namespace oneline {
                 return (data <= 0xFF) ? (int)data : -1;
             }
         }
+
+        // The request came up short, and the reader is partway through it.
+        // Ending it here keeps its leftovers out of the next transaction.
+        abort_read(port);
+        read_discard(port);
         return -1;
     }
 
     int __time_critical_func(read_bytes_blocking)(byte buffer[], Port port, int count, int request_bytes) {
         // TODO: Assert count > 0, and request_bytes <= count.
-        int bytes = 0;
+        Decoder decoder(buffer, count, request_bytes);
         uint last_activity = time_us_32();
-        uint32_t last_read = 0;
+        STATS_START(read_start);
+        STATS_START(last_word);
+#ifdef ENABLE_STATS
+        uint32_t longest_gap = 0;
+#endif
 
         // Step 1: Read all data from pio.
         while(true) {
             if (can_read(port)) {
-                uint32_t data = read(port);
                 last_activity = time_us_32();
-
-                // Values higher than 255 represent the end of a command.
-                // This is a bit-inverted counter of how many bits were read.
-                if (data <= 0xFF) {
-                    // controller bytes need to be rotated left 1 bit.
-                    if (bytes >= request_bytes) { data <<= 1; }
-                    if (bytes > request_bytes && bytes <= count) { buffer[bytes-1] |= (data >> 8) & 1; }
-
-                    // Dont write past the end of the array.
-                    if (bytes < count) { buffer[bytes] = data; }
-                    last_read = data;
-                    bytes++;
-                } else {
-                    // We need to reprocess the last byte
-                    bytes--;
-                    last_read <<= (8 - (~data % 8)) % 8;
-
-                    if (bytes > request_bytes && bytes <= count) { buffer[bytes-1] |= (last_read >> 8) & 1; }
-                    if (bytes < count) { buffer[bytes] = last_read; }
-
-                    // Despite the bytes-- above, there will always be one "ghost" byte
-                    // added due to the handoff bit.
-                    return bytes;
+#ifdef ENABLE_STATS
+                uint32_t gap = stats::elapsed(last_word);
+                if (gap > longest_gap) { longest_gap = gap; }
+                last_word = stats::now();
+#endif
+                if (decoder.add(read(port))) {
+                    STATS_RECORD(stats::READ_SPIN, read_start);
+                    STATS_RECORD_CYCLES(stats::READ_GAP, longest_gap);
+                    return decoder.size();
                 }
             } else if (TIMED_OUT(last_activity, ONELINE_READ_TIMEOUT_US)) {
                 abort_read(port);
@@ -232,9 +349,44 @@ namespace oneline {
     //     write_bytes(port, buffer, count);
     // }
 
-    __time_critical_func(Writer::Writer)(Port port, int count) : port(port), bytes(count) {
+    void __time_critical_func(write_encoded_reply)(Port port, byte command, const uint32_t words[], int bytes) {
+        start_reply(port, command, bytes * 8);
+        for (int x = 0; x < (bytes + 3) / 4; x++) {
+            write_blocking(port, words[x]);
+        }
+        end_reply(port);
+    }
+
+    template <int bytes>
+    void __time_critical_func(write_encoded_reply)(Port port, byte command, const uint32_t words[]) {
+        start_reply(port, command, bytes * 8);
+        for (int x = 0; x < (bytes + 3) / 4; x++) {
+            write_blocking(port, words[x]);
+        }
+        end_reply(port);
+    }
+
+    template <int bytes>
+    void __time_critical_func(write_reply)(Port port, byte command, const byte data[]) {
+        uint32_t words[(bytes + 3) / 4];
+        encode_reply<bytes>(data, words);
+        write_encoded_reply<bytes>(port, command, words);
+    }
+
+    // The fixed reply sizes: a status or pack write ack, controller identity,
+    // N64 inputs, GameCube inputs and origin, and a pack block with its CRC.
+    template void write_reply<1>(Port port, byte command, const byte data[]);
+    template void write_reply<3>(Port port, byte command, const byte data[]);
+    template void write_reply<4>(Port port, byte command, const byte data[]);
+    template void write_reply<10>(Port port, byte command, const byte data[]);
+    template void write_reply<33>(Port port, byte command, const byte data[]);
+    template void write_encoded_reply<4>(Port port, byte command, const uint32_t words[]);
+    template void write_encoded_reply<8>(Port port, byte command, const uint32_t words[]);
+    template void write_encoded_reply<33>(Port port, byte command, const uint32_t words[]);
+
+    __time_critical_func(Writer::Writer)(Port port, byte command, int count) : port(port), bytes(count) {
         this->written = 0;
-        start_reply(this->port, bytes * 8);
+        start_reply(this->port, command, bytes * 8);
     }
 
     // TODO: To restore this, we need to find a way to add the final bit.
@@ -258,6 +410,7 @@ namespace oneline {
             this->data <<= (4 - (this->bytes % 4)) * 8;
             write_blocking(this->port, ~this->data);
         }
+        if (this->written == this->bytes) { end_reply(this->port); }
         return *this;
     }
 
@@ -273,9 +426,277 @@ namespace oneline {
     }
 
     Writer& __time_critical_func(Writer::write_zeros)() {
+        if (this->written >= this->bytes) { return *this; }
         for (; this->written < this->bytes; this->written += 4) {
             write_blocking(this->port, ~0);
         }
+        end_reply(this->port);
         return *this;
     }
+
+    // --------------------
+    // |     CAPTURE      |
+    // --------------------
+
+#ifdef ONELINE_DMA_CAPTURE
+    #define CAPTURE_RING_WORDS ((1 << ONELINE_CAPTURE_RING_BITS) / sizeof(uint32_t))
+    #define CAPTURE_TRANSFERS 0xFFFFFFFF
+    // A channel stops once its count runs out, so read_capture restarts it
+    // with a full count once it drops below this.
+    #define CAPTURE_REARM_BELOW 0x80000000
+
+    // The DMA ring wraps on the address, so each ring must be aligned to its size.
+    static uint32_t capture_ring[4][CAPTURE_RING_WORDS] __attribute__((aligned(1 << ONELINE_CAPTURE_RING_BITS)));
+    static int capture_channel[4];
+    // Free running count of words consumed from each ring.
+    static uint32_t capture_read[4];
+    // Words each channel wrote before it was last restarted.
+    static uint32_t capture_base[4];
+
+    // When each transaction started, latched by the IRQ along with where in
+    // the ring its words begin.
+    #define CAPTURE_STAMPS 64
+    struct CaptureStamp {
+        uint32_t position;
+        uint32_t time;
+    };
+    static CaptureStamp capture_stamps[4][CAPTURE_STAMPS];
+    static volatile uint32_t capture_stamp_head[4];
+    static uint32_t capture_stamp_tail[4];
+
+    static inline uint32_t capture_written(Port port) {
+        // The remaining transfer count tells us how far DMA has written.
+        return capture_base[port] + CAPTURE_TRANSFERS - dma_channel_hw_addr(capture_channel[port])->transfer_count;
+    }
+
+    // Carries on from the same ring address with a full count. Words that
+    // arrive meanwhile wait in the PIO's FIFO, and the IRQ is held off so it
+    // never sees the base and count out of step.
+    static void rearm_capture(Port port) {
+        int channel = capture_channel[port];
+        if (dma_channel_hw_addr(channel)->transfer_count >= CAPTURE_REARM_BELOW) { return; }
+
+        uint32_t interrupts = save_and_disable_interrupts();
+        dma_channel_abort(channel);
+        capture_base[port] += CAPTURE_TRANSFERS - dma_channel_hw_addr(channel)->transfer_count;
+        dma_channel_set_trans_count(channel, CAPTURE_TRANSFERS, true);
+        restore_interrupts(interrupts);
+    }
+
+    // Raised as each transaction starts. The words are still left to DMA, this
+    // only takes the time.
+    void handle_capture_irq() {
+        uint32_t time = time_us_32();
+        for (int x = port_1; x <= port_4; x++) {
+            if (pio_interrupt_get(ONELINE_PIO, x)) {
+                uint32_t head = capture_stamp_head[x];
+                capture_stamps[x][head % CAPTURE_STAMPS] = { capture_written((Port)x), time };
+                capture_stamp_head[x] = head + 1;
+                pio_interrupt_clear(ONELINE_PIO, x);
+            }
+        }
+    }
+
+    // Finds the stamp of the transaction at [start, end] in the ring,
+    // dropping those of transactions which were lost. Missed stamps fall
+    // back to now.
+    static uint32_t capture_stamp(Port port, uint32_t start, uint32_t end) {
+        uint32_t head = capture_stamp_head[port];
+        uint32_t tail = capture_stamp_tail[port];
+        if (head - tail > CAPTURE_STAMPS) { tail = head - CAPTURE_STAMPS; }
+
+        while (tail != head && (int32_t)(capture_stamps[port][tail % CAPTURE_STAMPS].position - start) < 0) { tail++; }
+
+        uint32_t time = time_us_32();
+        if (tail != head && (int32_t)(capture_stamps[port][tail % CAPTURE_STAMPS].position - end) <= 0) {
+            time = capture_stamps[port][tail % CAPTURE_STAMPS].time;
+            tail++;
+        }
+        capture_stamp_tail[port] = tail;
+        return time;
+    }
+
+    void setup_capture_port(Port port, uint pin) {
+        pio_gpio_init(ONELINE_PIO, pin);
+        pio_sm_set_consecutive_pindirs(ONELINE_PIO, (uint)port, pin, 1, false);
+
+        pio_sm_config capture_config = oneline_capture_program_get_default_config(pio_offset);
+        sm_config_set_clkdiv(&capture_config, (float)clock_get_hz(clk_sys) / (float)oneline_F_PIO);
+
+        sm_config_set_in_pins(&capture_config, pin);
+        sm_config_set_jmp_pin(&capture_config, pin);
+        sm_config_set_in_shift(&capture_config, false /*shift right*/, false /*auto push*/, 8 /*push size*/);
+
+        pio_sm_init(ONELINE_PIO, (uint)port, pio_offset, &capture_config);
+        pio_set_irq0_source_enabled(ONELINE_PIO, (pio_interrupt_source)(pis_interrupt0 + (uint)port), true);
+        // The first instruction pulls the idle timeout. Each idle loop is 2 cycles.
+        pio_sm_put(ONELINE_PIO, (uint)port, ONELINE_READ_TIMEOUT_US * oneline_F_PIO_MHZ / 2);
+
+        int channel = dma_claim_unused_channel(true);
+        dma_channel_config dma_config = dma_channel_get_default_config(channel);
+        channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+        channel_config_set_read_increment(&dma_config, false);
+        channel_config_set_write_increment(&dma_config, true);
+        channel_config_set_ring(&dma_config, true /*write*/, ONELINE_CAPTURE_RING_BITS);
+        channel_config_set_dreq(&dma_config, pio_get_dreq(ONELINE_PIO, (uint)port, false));
+        dma_channel_configure(channel, &dma_config, capture_ring[port], &ONELINE_PIO->rxf[port], CAPTURE_TRANSFERS, true);
+
+        capture_channel[port] = channel;
+        capture_read[port] = 0;
+        capture_base[port] = 0;
+        capture_stamp_head[port] = 0;
+        capture_stamp_tail[port] = 0;
+
+        pio_sm_set_enabled(ONELINE_PIO, (uint)port, true);
+    }
+
+    void setdown_capture_port(Port port) {
+        pio_sm_set_enabled(ONELINE_PIO, port, false);
+        dma_channel_abort(capture_channel[port]);
+        dma_channel_unclaim(capture_channel[port]);
+        pio_sm_clear_fifos(ONELINE_PIO, port);
+        pio_set_irq0_source_enabled(ONELINE_PIO, (pio_interrupt_source)(pis_interrupt0 + (uint)port), false);
+    }
+
+    void init_capture() {
+        pio_offset = pio_add_program(ONELINE_PIO, &oneline_capture_program);
+        irq_set_exclusive_handler(ONELINE_IRQ, handle_capture_irq);
+        irq_set_priority(ONELINE_IRQ, PICO_HIGHEST_IRQ_PRIORITY);
+        irq_set_enabled(ONELINE_IRQ, true);
+
+        setup_capture_port(port_1, ONELINE_PIN_PORT_1);
+        setup_capture_port(port_2, ONELINE_PIN_PORT_2);
+        setup_capture_port(port_3, ONELINE_PIN_PORT_3);
+        setup_capture_port(port_4, ONELINE_PIN_PORT_4);
+    }
+
+    void uninit_capture() {
+        setdown_capture_port(port_1);
+        setdown_capture_port(port_2);
+        setdown_capture_port(port_3);
+        setdown_capture_port(port_4);
+
+        irq_set_enabled(ONELINE_IRQ, false);
+        irq_remove_handler(ONELINE_IRQ, handle_capture_irq);
+        pio_remove_program(ONELINE_PIO, &oneline_capture_program, pio_offset);
+    }
+
+    int read_capture(Port port, uint32_t words[], int max_words, uint32_t* timestamp) {
+        rearm_capture(port);
+        uint32_t written = capture_written(port);
+        uint32_t read = capture_read[port];
+
+        if (written - read > CAPTURE_RING_WORDS) {
+            capture_read[port] = written;
+            return -1;
+        }
+
+        for (uint32_t position = read; position != written; position++) {
+            if (capture_ring[port][position % CAPTURE_RING_WORDS] > 0xFF) {
+                // Copy the transaction, keeping the end marker even if truncated.
+                int count = position - read + 1;
+                if (count > max_words) { count = max_words; }
+                for (int x = 0; x < count - 1; x++) {
+                    words[x] = capture_ring[port][(read + x) % CAPTURE_RING_WORDS];
+                }
+                words[count - 1] = capture_ring[port][position % CAPTURE_RING_WORDS];
+
+                *timestamp = capture_stamp(port, read, position);
+                capture_read[port] = position + 1;
+                return count;
+            }
+        }
+        return 0;
+    }
+#endif
+
+    // --------------------
+    // |     REQUESTS     |
+    // --------------------
+
+    uint request_offset = 0;
+    RequestHandler* request_handler = nullptr;
+
+    void handle_request_irq() {
+        for (int x = port_1; x <= port_4; x++) {
+            if (pio_interrupt_get(REQUEST_PIO, x)) {
+                request_handler->handle_reply((Port)x);
+                pio_interrupt_clear(REQUEST_PIO, x);
+            }
+        }
+    }
+
+    void setup_request_port(Port port, uint pin) {
+        pio_gpio_init(REQUEST_PIO, pin);
+        pio_sm_set_consecutive_pindirs(REQUEST_PIO, (uint)port, pin, 1, false);
+        pio_set_irq0_source_enabled(REQUEST_PIO, (pio_interrupt_source)(pis_interrupt0 + (uint)port), true);
+
+        pio_sm_config config = oneline_request_program_get_default_config(request_offset);
+        sm_config_set_clkdiv(&config, (float)clock_get_hz(clk_sys) / (float)oneline_F_PIO);
+
+        sm_config_set_in_pins(&config, pin);
+        sm_config_set_out_pins(&config, pin, 1);
+        sm_config_set_set_pins(&config, pin, 1);
+        sm_config_set_jmp_pin(&config, pin);
+
+        sm_config_set_in_shift(&config, false /*shift right*/, false /*auto push*/, 8 /*push size*/);
+        sm_config_set_out_shift(&config, false /*shift left*/, false /*auto pull*/, 32 /*pull size*/);
+
+        pio_sm_init(REQUEST_PIO, (uint)port, request_offset, &config);
+        pio_sm_set_enabled(REQUEST_PIO, (uint)port, true);
+    }
+
+    void setdown_request_port(Port port) {
+        pio_sm_set_enabled(REQUEST_PIO, port, false);
+        pio_sm_clear_fifos(REQUEST_PIO, port);
+        pio_set_irq0_source_enabled(REQUEST_PIO, (pio_interrupt_source)(pis_interrupt0 + (uint)port), false);
+    }
+
+    void init_requests(RequestHandler* handler) {
+        request_handler = handler;
+        request_offset = pio_add_program(REQUEST_PIO, &oneline_request_program);
+        irq_set_exclusive_handler(REQUEST_IRQ, handle_request_irq);
+        irq_set_enabled(REQUEST_IRQ, true);
+
+        setup_request_port(port_1, REALTIME_PIN_PORT_1);
+        setup_request_port(port_2, REALTIME_PIN_PORT_2);
+        setup_request_port(port_3, REALTIME_PIN_PORT_3);
+        setup_request_port(port_4, REALTIME_PIN_PORT_4);
+    }
+
+    void uninit_requests() {
+        setdown_request_port(port_1);
+        setdown_request_port(port_2);
+        setdown_request_port(port_3);
+        setdown_request_port(port_4);
+
+        irq_set_enabled(REQUEST_IRQ, false);
+        irq_remove_handler(REQUEST_IRQ, handle_request_irq);
+        pio_remove_program(REQUEST_PIO, &oneline_request_program, request_offset);
+        request_handler = nullptr;
+    }
+
+    void start_request(Port port, const byte data[], int bytes) {
+        uint32_t word = 0;
+        for (int x = 0; x < bytes; x++) {
+            word |= (uint32_t)data[x] << (24 - x * 8);
+        }
+        pio_sm_put(REQUEST_PIO, port, bytes * 8 - 1);
+        pio_sm_put(REQUEST_PIO, port, ~word);
+    }
+
+    void abort_request(Port port) {
+        pio_sm_exec(REQUEST_PIO, port, pio_encode_jmp(request_offset + oneline_request_offset_reply_end));
+    }
+
+    // The last words stall in the PIO until they are read, so this only
+    // waits on the PIO, never on the line.
+    int read_reply(Port port, byte buffer[], int count) {
+        Decoder decoder(buffer, count, count);
+        uint start_time = time_us_32();
+        while (!TIMED_OUT(start_time, ONELINE_READ_TIMEOUT_US)) {
+            if (!pio_sm_is_rx_fifo_empty(REQUEST_PIO, port) && decoder.add(pio_sm_get(REQUEST_PIO, port))) { break; }
+        }
+        return decoder.size();
+    }
 }
@@ -0,0 +1,318 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "consoles/common/recorder.h"
+
+#include <string.h>
+
+#include "helpers.h"
+#include "consoles/common/oneline.h"
+#include "events.h"
+#include "io.h"
+#include "labels.h"
+#include "stats.h"
+
+namespace oneline {
+    Recorder::Recorder(const char* console, const CommandSize commands[], int command_count, uint ports)
+#ifdef ONELINE_DMA_CAPTURE
+        : capture(ports == all_ports), commands(commands), command_count(command_count) {
+        if (this->capture) {
+            init_capture();
+        } else {
+            init(this, ports);
+        }
+#else
+        : commands(commands), command_count(command_count) {
+        init(this, ports);
+#endif
+        io::Info(labels::INFO_DEVICE_INIT).write(console).write(labels::DEVICE_TYPE_RECORD);
+    }
+
+    Recorder::~Recorder() {
+#ifdef ONELINE_DMA_CAPTURE
+        if (this->capture) {
+            uninit_capture();
+            return;
+        }
+#endif
+        uninit(this);
+    }
+
+#ifdef ONELINE_DMA_CAPTURE
+    // Turns complete transactions from the capture rings into records. This
+    // runs in thread context, so how long a transaction is no longer matters.
+    void Recorder::process_captures() {
+        uint32_t words[READER_BUFFER_SIZE + 2];
+        uint32_t timestamp;
+
+        for (int port = port_1; port <= port_4; port++) {
+            int count;
+            while ((count = read_capture((Port)port, words, READER_BUFFER_SIZE + 2, &timestamp)) != 0) {
+                if (count < 0) {
+                    io::Error(labels::ERROR_BUFFER_OVERFLOW).write(__FILE__).send();
+                    continue;
+                }
+
+                // A lone end marker is line noise, not a command.
+                if (count < 2) { continue; }
+
+                STATS_START(capture_start);
+                int command = words[0];
+                const CommandSize* size = find_command(this->commands, this->command_count, command);
+                int additional_request_bytes = size != nullptr ? size->request_bytes : READER_BUFFER_SIZE;
+                int data_bytes = size != nullptr ? size->request_bytes + size->response_bytes : READER_BUFFER_SIZE;
+
+                Decoder decoder(this->read_buffer + RECORD_HEADER_SIZE, data_bytes, additional_request_bytes);
+                for (int x = 1; x < count && !decoder.add(words[x]); x++) {}
+
+                if (size == nullptr) {
+                    additional_request_bytes = this->infer_request_bytes(command, this->read_buffer + RECORD_HEADER_SIZE, decoder.size());
+                    if (additional_request_bytes < 0) {
+                        this->last_invalid_command = command;
+                        continue;
+                    }
+                }
+
+                this->add_record((Port)port, command, additional_request_bytes, decoder.size(), timestamp);
+                STATS_RECORD(stats::RECORDER_CAPTURE, capture_start);
+            }
+        }
+    }
+#endif
+
+    // Commands missing from the table are read without realigning anything,
+    // so data[size] holds the last bit. The console's stop bit reads as a 1
+    // right after the request, so any request size where that bit is a 0 is
+    // ruled out. Replies to a command are always the same size, so after a
+    // few transactions only the real split is left. Returns the request size
+    // once it is known, after realigning the response, or -1 until then.
+    int Recorder::infer_request_bytes(int command, byte data[], int size) {
+        if (size <= 0 || size >= READER_BUFFER_SIZE) { return -1; }
+
+        uint64_t splits = 0;
+        for (int x = 0; x <= size; x++) {
+            if (data[x] & 0x80) { splits |= (uint64_t)1 << x; }
+        }
+
+        LearnedCommand* learned = nullptr;
+        for (LearnedCommand& entry : this->learned) {
+            if (entry.valid && entry.command == command && entry.size == size) { learned = &entry; }
+        }
+        if (learned == nullptr) {
+            learned = &this->learned[this->next_learned];
+            this->next_learned = (this->next_learned + 1) % RECORDER_LEARNED_COMMANDS;
+            learned->valid = true;
+            learned->command = command;
+            learned->size = size;
+            learned->splits = ~(uint64_t)0;
+        }
+
+        // Nothing left means the command isn't a fixed size. Start over.
+        learned->splits &= splits;
+        if (learned->splits == 0) { learned->splits = splits; }
+        if ((learned->splits & (learned->splits - 1)) != 0) { return -1; }
+
+        // Remove the stop bit, the same as oneline::Decoder would have.
+        int request_bytes = __builtin_ctzll(learned->splits);
+        for (int x = request_bytes; x < size; x++) {
+            data[x] = (data[x] << 1) | (data[x + 1] >> 7);
+        }
+        return request_bytes;
+    }
+
+    void Recorder::add_record(Port port, int command, int additional_request_bytes, int actual_data_count, uint32_t timestamp) {
+        // The whole record is published at once so update() never sees a
+        // header without its data.
+        this->read_buffer[0] = port;
+        this->read_buffer[1] = actual_data_count + 1;
+        this->read_buffer[2] = additional_request_bytes + 1;
+        this->read_buffer[3] = command;
+        this->read_buffer[4] = timestamp & 0xFF;
+        this->read_buffer[5] = (timestamp >> 8) & 0xFF;
+        this->read_buffer[6] = (timestamp >> 16) & 0xFF;
+        this->read_buffer[7] = (timestamp >> 24) & 0xFF;
+        this->reader_data.add_record(this->read_buffer, RECORD_HEADER_SIZE + actual_data_count);
+    }
+
+    static int write_varint(byte* buffer, uint32_t value) {
+        int count = 0;
+        while (value >= 0x80) {
+            buffer[count++] = (value & 0x7F) | 0x80;
+            value >>= 7;
+        }
+        buffer[count++] = value;
+        return count;
+    }
+
+    int Recorder::write_record(io::CommandWriter& writer, byte port, byte command, uint32_t timestamp,
+            const byte data[], int request_bytes, int data_size) {
+        // port/command, escaped command, 2 varints of up to 5 bytes
+        byte header[12];
+        int header_size = 0;
+        if (command < CAPTURE_COMMAND_REPEAT) {
+            header[header_size++] = (port << 6) | command;
+        } else {
+            header[header_size++] = (port << 6) | CAPTURE_COMMAND_ESCAPE;
+            header[header_size++] = command;
+        }
+        header_size += write_varint(header + header_size, timestamp - this->last_timestamp);
+        header_size += write_varint(header + header_size, request_bytes * 64 + (data_size - request_bytes));
+        this->last_timestamp = timestamp;
+
+        writer.write_bytes(header, header_size)
+            .write_bytes(data, data_size);
+        return header_size + data_size;
+    }
+
+#ifdef RECORDER_COLLAPSE_REPEATS
+    int Recorder::write_repeats(io::CommandWriter& writer, byte port) {
+        PortHistory& history = this->history[port];
+        if (history.repeats == 0) { return 0; }
+
+        // port/repeat, 3 varints of up to 5 bytes
+        byte header[16];
+        int header_size = 0;
+        header[header_size++] = (port << 6) | CAPTURE_COMMAND_REPEAT;
+        header_size += write_varint(header + header_size, history.first_repeat - this->last_timestamp);
+        header_size += write_varint(header + header_size, history.repeats);
+        header_size += write_varint(header + header_size, history.last_repeat - history.first_repeat);
+        this->last_timestamp = history.first_repeat;
+
+        history.repeats = 0;
+        writer.write_bytes(header, header_size);
+        return header_size;
+    }
+
+    bool Recorder::repeats_due() const {
+        for (int port = 0; port < RECORDER_PORT_COUNT; port++) {
+            if (this->history[port].repeats > 0 && TIMED_OUT(this->history[port].first_repeat, RECORDER_REPEAT_FLUSH_US)) {
+                return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    void Recorder::update() {
+#ifdef ONELINE_DMA_CAPTURE
+        if (this->capture) { this->process_captures(); }
+#endif
+
+#ifdef RECORDER_COLLAPSE_REPEATS
+        if (this->reader_data.gets_avaiable() > 0 || this->repeats_due()) {
+#else
+        if (this->reader_data.gets_avaiable() > 0) {
+#endif
+            io::CommandWriter writer(commands::device::CAPTURE_DATA);
+            int written = 0;
+
+            while (this->reader_data.gets_avaiable() > 0 && written < CAPTURE_FRAME_SIZE) {
+                byte record[RECORD_HEADER_SIZE];
+                byte data[READER_BUFFER_SIZE];
+                this->reader_data.get(record, RECORD_HEADER_SIZE);
+
+                byte port = record[0];
+                byte command = record[3];
+                int data_size = record[1] - 1;
+                int request_bytes = record[2] - 1;
+                if (request_bytes > data_size) { request_bytes = data_size; }
+                uint32_t timestamp = record[4] | (record[5] << 8) | (record[6] << 16) | ((uint32_t)record[7] << 24);
+                this->reader_data.get(data, data_size);
+
+#ifdef RECORDER_COLLAPSE_REPEATS
+                // Identical transactions on a port are only counted. The host
+                // repeats the last record it saw for that port.
+                PortHistory& history = this->history[port];
+                if (history.valid && history.command == command && history.request_bytes == request_bytes
+                        && history.data_size == data_size && memcmp(history.data, data, data_size) == 0) {
+                    if (history.repeats == 0) { history.first_repeat = timestamp; }
+                    history.repeats++;
+                    history.last_repeat = timestamp;
+
+                    if (history.repeats == RECORDER_MAX_REPEATS) {
+                        written += this->write_repeats(writer, port);
+                    }
+                    continue;
+                }
+
+                written += this->write_repeats(writer, port);
+                history.valid = true;
+                history.command = command;
+                history.request_bytes = request_bytes;
+                history.data_size = data_size;
+                memcpy(history.data, data, data_size);
+#endif
+
+                written += this->write_record(writer, port, command, timestamp, data, request_bytes, data_size);
+            }
+
+#ifdef RECORDER_COLLAPSE_REPEATS
+            // Long runs are sent periodically so the host is never too far behind.
+            for (int port = 0; port < RECORDER_PORT_COUNT; port++) {
+                if (TIMED_OUT(this->history[port].first_repeat, RECORDER_REPEAT_FLUSH_US)) {
+                    this->write_repeats(writer, port);
+                }
+            }
+#endif
+        }
+
+        if (this->reader_data.overflowed()) {
+            io::Error(labels::ERROR_BUFFER_OVERFLOW).write(__FILE__).send();
+        }
+
+        if (this->reader_data.underflowed()) {
+            io::Error(labels::ERROR_BUFFER_UNDERFLOW).write(__FILE__).send();
+        }
+
+        if (this->last_invalid_command) {
+            io::Warn(labels::WARN_UNKNOWN_CONSOLE_CMD).write_byte(this->last_invalid_command).send();
+            this->last_invalid_command = 0;
+        }
+    }
+    
+    void Recorder::handle_oneline(Port port) {
+        uint32_t timestamp = time_us_32();
+        STATS_START(capture_start);
+        int command = read_byte_blocking(port);
+
+        if (command == -1) {
+            return;
+        }
+
+        // Read the remaining data after the record header.
+        byte* data = this->read_buffer + RECORD_HEADER_SIZE;
+        const CommandSize* size = find_command(this->commands, this->command_count, command);
+        int additional_request_bytes, actual_data_count;
+        if (size != nullptr) {
+            additional_request_bytes = size->request_bytes;
+            actual_data_count = read_bytes_blocking(data, port,
+                additional_request_bytes + size->response_bytes, additional_request_bytes);
+        } else {
+            // Unknown commands. We need to know where the handoff bit is,
+            // otherwise the controller response will be bit shifted by one.
+            actual_data_count = read_bytes_blocking(data, port, READER_BUFFER_SIZE, READER_BUFFER_SIZE);
+            additional_request_bytes = this->infer_request_bytes(command, data, actual_data_count);
+            if (additional_request_bytes < 0) {
+                last_invalid_command = command;
+                return;
+            }
+        }
+
+        this->add_record(port, command, additional_request_bytes, actual_data_count, timestamp);
+        STATS_RECORD(stats::RECORDER_CAPTURE, capture_start);
+        events::signal(events::DEVICE);
+    }
+}
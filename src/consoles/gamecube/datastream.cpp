@@ -0,0 +1,265 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "consoles/gamecube/datastream.h"
+
+#include <string.h>
+
+#include "helpers.h"
+#include "consoles/common/oneline.h"
+#include "events.h"
+#include "io.h"
+#include "labels.h"
+#include "stats.h"
+
+#define GAMECUBE_IDENTIFY 0x00
+#define GAMECUBE_READ_INPUTS 0x40
+#define GAMECUBE_READ_ORIGIN 0x41
+#define GAMECUBE_CALIBRATE 0x42
+#define GAMECUBE_RESET 0xFF
+#define GAMECUBE_MOTOR_MASK 0x03
+
+namespace gamecube {
+    // No buttons, sticks centered, triggers released. The high bit of the
+    // second byte is always set.
+    static const byte neutral_frame[GAMECUBE_FRAME_SIZE] = { 0x00, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x00 };
+    // The origin is the neutral frame, followed by 2 reserved bytes.
+    static const byte origin[GAMECUBE_ORIGIN_SIZE] = { 0x00, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x00, 0x00, 0x00 };
+
+    Datastream::Datastream() {
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            controllers[x].connected = false;
+            for (int y = 0; y < (int)sizeof(controllers[x].header); y++) {
+                controllers[x].header[y] = 0;
+            }
+            oneline::encode_reply<GAMECUBE_FRAME_SIZE>(neutral_frame, this->current_frame[x]);
+        }
+
+        oneline::init(this);
+        oneline::set_reply_delay(oneline::all_commands, GAMECUBE_REPLY_DELAY_NS);
+        io::Info(labels::INFO_DEVICE_INIT).write(labels::CONSOLE_GAMECUBE).write(labels::DEVICE_TYPE_DATASTREAM);
+    }
+
+    Datastream::~Datastream() {
+        oneline::uninit(this);
+    }
+
+    int Datastream::next_connected_port(int port) const {
+        for (int x = 1; x <= GAMECUBE_CONTROLLER_COUNT; x++) {
+            int next = (port + x) % GAMECUBE_CONTROLLER_COUNT;
+            if (this->controllers[next].connected) { return next; }
+        }
+        return port;
+    }
+
+    // Datastream Request Format: Same as N64, with 8 byte frames.
+    // 2 bytes - additional bytes the host may send (little endian). Always whole
+    //           records of one frame for every connected port.
+    // 8 bytes - frames queued on each port (2 bytes each, little endian)
+    void Datastream::update() {
+        this->grant_credit();
+
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            byte rumble = this->rumble[x];
+            if (rumble != this->reported_rumble[x]) {
+                io::Info(labels::INFO_RUMBLE).write_byte(x).write_byte(rumble).send();
+                this->reported_rumble[x] = rumble;
+            }
+        }
+    }
+
+    void Datastream::grant_credit() {
+        int connected = 0;
+        int queued = 0;
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            if (!this->controllers[x].connected) { continue; }
+            connected++;
+            int frames = (this->databuffer[x].capacity() - this->databuffer[x].adds_available()) / GAMECUBE_FRAME_WORDS;
+            if (frames > queued) { queued = frames; }
+        }
+        if (connected == 0) { return; }
+
+        int record_size = connected * GAMECUBE_FRAME_SIZE;
+        int committed = queued + (this->credit + record_size - 1) / record_size;
+        if (committed < GAMECUBE_LOW_WATERMARK) {
+            uint grant = (GAMECUBE_HIGH_WATERMARK - committed) * record_size;
+            io::CommandWriter writer(commands::device::DATASTREAM_REQUEST);
+            writer.write_byte(grant & 0xFF).write_byte(grant >> 8);
+            for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+                int frames = (this->databuffer[x].capacity() - this->databuffer[x].adds_available()) / GAMECUBE_FRAME_WORDS;
+                writer.write_byte(frames & 0xFF).write_byte(frames >> 8);
+            }
+            this->credit += grant;
+        }
+    }
+
+    void Datastream::queue_frame(const byte frame[GAMECUBE_FRAME_SIZE]) {
+        uint32_t words[GAMECUBE_FRAME_WORDS];
+        oneline::encode_reply<GAMECUBE_FRAME_SIZE>(frame, words);
+        // Both words are published at once, so the IRQ never sees half a frame.
+        this->databuffer[this->stream_port].add(words, GAMECUBE_FRAME_WORDS);
+        this->stream_port = this->next_connected_port(this->stream_port);
+    }
+
+    // Datastream format:
+    // 1 byte - size of buffer. A grant may be sent as any number of these.
+    // n bytes - Data to send to the datastream. Each record is one 8 byte
+    //           frame for every connected port, in port order.
+    bool Datastream::frames_fit(int count) const {
+        int frames[GAMECUBE_CONTROLLER_COUNT] = {};
+        int port = this->stream_port;
+        for (int x = (this->partial_frame_size + count) / GAMECUBE_FRAME_SIZE; x > 0; x--) {
+            frames[port]++;
+            port = this->next_connected_port(port);
+        }
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            if (frames[x] * GAMECUBE_FRAME_WORDS > this->databuffer[x].adds_available()) { return false; }
+        }
+        return true;
+    }
+
+    void Datastream::handle_datastream() {
+        int count = io::read_byte();
+        const byte* data = io::read_bytes(count);
+        if (data == nullptr) { return; }
+
+        // Counted against the credit even if dropped, as the host counted it.
+        bool fits = this->frames_fit(count);
+        this->credit = (uint)count < this->credit ? this->credit - count : 0;
+
+        // Checked up front, so a payload that overruns its grant is dropped whole.
+        if (!fits) {
+            io::Error(labels::ERROR_BUFFER_OVERFLOW).write(__FILE__).send();
+            return;
+        }
+
+        // Whole frames are encoded straight from the payload; only ones split
+        // across packets are copied.
+        int offset = 0;
+        if (this->partial_frame_size > 0) {
+            offset = GAMECUBE_FRAME_SIZE - this->partial_frame_size;
+            if (offset > count) { offset = count; }
+            memcpy(this->partial_frame + this->partial_frame_size, data, offset);
+            this->partial_frame_size += offset;
+            if (this->partial_frame_size == GAMECUBE_FRAME_SIZE) {
+                this->queue_frame(this->partial_frame);
+                this->partial_frame_size = 0;
+            }
+        }
+        for (; offset + GAMECUBE_FRAME_SIZE <= count; offset += GAMECUBE_FRAME_SIZE) {
+            this->queue_frame(data + offset);
+        }
+        memcpy(this->partial_frame + this->partial_frame_size, data + offset, count - offset);
+        this->partial_frame_size += count - offset;
+    }
+
+    int Datastream::controller_config_size() const {
+        return GAMECUBE_CONTROLLER_COUNT * 4 + 1;
+    }
+
+    // Controller Config Protocol:
+    // 4x of the following:
+    //   1 byte  - controller info (0 disconnected)
+    //   3 bytes - controller header
+    // 1 byte  - polls per frame (0 is treated as 1)
+    // Streams restart from the first connected port.
+    void Datastream::handle_controller_config() {
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            this->controllers[x].connected = !!io::read_byte();
+            for (int n = 0; n < (int)sizeof(this->controllers[x].header); n++) {
+                this->controllers[x].header[n] = io::read_byte();
+            }
+        }
+        int polls = io::read_byte();
+        this->polls_per_frame = polls > 0 ? polls : 1;
+
+        // The new stream starts with the next frame queued on each port. The
+        // IRQ drops the frames queued before it, and starts a fresh frame, on
+        // each port's next poll. Credit already granted is kept, as the host
+        // still sends those bytes.
+        this->stream_port = this->next_connected_port(GAMECUBE_CONTROLLER_COUNT - 1);
+        this->partial_frame_size = 0;
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            this->stream_start[x] = this->databuffer[x].write_position();
+        }
+        this->stream_generation.fetch_add(1, std::memory_order_release);
+
+        for (int x = 0; x < GAMECUBE_CONTROLLER_COUNT; x++) {
+            io::Debug(labels::DEBUG_PORT_INFO)
+                .write_byte(x)
+                .write_byte(controllers[x].connected)
+                .write_bytes(controllers[x].header, sizeof(controllers[x].header));
+        }
+    }
+
+    void Datastream::handle_oneline(oneline::Port port) {
+        STATS_START(reply_start);
+        ControllerConfig *controller = &controllers[port];
+        if (!controller->connected) {
+            return oneline::read_discard(port);
+        }
+
+        int command = oneline::read_byte_blocking(port);
+
+        switch (command) {
+        case GAMECUBE_IDENTIFY:
+        case GAMECUBE_RESET:
+            oneline::write_reply<3>(port, command, controller->header);
+            break;
+        case GAMECUBE_READ_ORIGIN:
+            oneline::write_reply<GAMECUBE_ORIGIN_SIZE>(port, command, origin);
+            break;
+        case GAMECUBE_CALIBRATE:
+            // The 2 request bytes are ignored. Calibrating keeps the origin.
+            if (oneline::read_byte_blocking(port) == -1 || oneline::read_byte_blocking(port) == -1) { return; }
+            oneline::write_reply<GAMECUBE_ORIGIN_SIZE>(port, command, origin);
+            break;
+        case GAMECUBE_READ_INPUTS: {
+            // Analog mode, then the rumble motor state.
+            int mode = oneline::read_byte_blocking(port);
+            int motor = mode != -1 ? oneline::read_byte_blocking(port) : -1;
+            if (motor == -1) { return; }
+            this->rumble[port] = motor & GAMECUBE_MOTOR_MASK;
+
+            uint generation = this->stream_generation.load(std::memory_order_acquire);
+            if (generation != this->port_generation[port]) {
+                this->databuffer[port].skip_to(this->stream_start[port]);
+                this->polls_left[port] = 0;
+                this->port_generation[port] = generation;
+            }
+
+            // The next frame only starts once this one has had all its polls.
+            // On underflow, the current frame is held.
+            if (this->polls_left[port] == 0
+                    && this->databuffer[port].gets_avaiable() >= GAMECUBE_FRAME_WORDS) {
+                this->databuffer[port].get(this->current_frame[port], GAMECUBE_FRAME_WORDS);
+                this->polls_left[port] = this->polls_per_frame;
+            }
+            if (this->polls_left[port] > 0) { this->polls_left[port]--; }
+
+            oneline::write_encoded_reply<GAMECUBE_FRAME_SIZE>(port, command, this->current_frame[port]);
+            STATS_RECORD(stats::DATASTREAM_REPLY, reply_start);
+            // For refilling the queue, and reporting rumble.
+            events::signal(events::DEVICE);
+            break;
+        }
+        default:
+            // Unknown commands: Discard all the data
+            oneline::read_discard(port);
+            break;
+        }
+    }
+}
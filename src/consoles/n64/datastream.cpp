@@ -17,10 +17,14 @@
 #include "consoles/n64/datastream.h"
 
 #include <pico/multicore.h>
+#include <string.h>
 
 #include "helpers.h"
 #include "consoles/common/oneline.h"
+#include "events.h"
 #include "io.h"
+#include "labels.h"
+#include "stats.h"
 
 #ifdef LED_SHOWS_DATASTREAM_STATUS
 #define DATASTREAM_REQUEST_PENDING() LED_ON()
@@ -41,46 +45,251 @@ namespace n64 {
         }
 
         oneline::init(this);
+        oneline::set_reply_delay(oneline::all_commands, N64_REPLY_DELAY_NS);
         io::Info(labels::INFO_DEVICE_INIT).write(labels::CONSOLE_N64).write(labels::DEVICE_TYPE_DATASTREAM);
     }
 
     Datastream::~Datastream() {
-        oneline::uninit();
+        oneline::uninit(this);
     }
 
+    int Datastream::next_connected_port(int port) const {
+        for (int x = 1; x <= N64_CONTROLLER_COUNT; x++) {
+            int next = (port + x) % N64_CONTROLLER_COUNT;
+            if (this->controllers[next].connected) { return next; }
+        }
+        return port;
+    }
+
+    // Datastream Request Format:
+    // 2 bytes - additional bytes the host may send (little endian). Always whole
+    //           records of one frame for every connected port.
+    // 8 bytes - frames queued on each port (2 bytes each, little endian)
     void Datastream::update() {
-        if (!this->pending_data && this->databuffer.adds_available()) {
-            io::CommandWriter(commands::device::DATASTREAM_REQUEST)
-                .write_byte(this->databuffer.adds_available());
-            this->pending_data = true;
-            DATASTREAM_REQUEST_PENDING();
+        if (this->flash_playback) {
+            this->refill_from_flash();
+        } else {
+            this->grant_credit();
+        }
+
+        if (this->pack_address_errors) {
+            io::Warn(labels::WARN_PACK_ADDRESS_CRC).write_int(this->pack_address_errors).send();
+            this->pack_address_errors = 0;
+        }
+    }
+
+    void Datastream::grant_credit() {
+        // Packed data is only bounded by its own buffer.
+        if (this->packed) {
+            this->decode_packed();
+            uint committed = this->packed_data.gets_avaiable() + this->credit;
+            if (committed < DATASTREAM_PACKED_LOW_WATERMARK) {
+                uint grant = DATASTREAM_PACKED_BUFFER_SIZE - committed;
+                io::CommandWriter writer(commands::device::DATASTREAM_REQUEST);
+                writer.write_byte(grant & 0xFF).write_byte(grant >> 8);
+                for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+                    int frames = this->databuffer[x].capacity() - this->databuffer[x].adds_available();
+                    writer.write_byte(frames & 0xFF).write_byte(frames >> 8);
+                }
+                this->credit += grant;
+                DATASTREAM_REQUEST_PENDING();
+            }
+            return;
+        }
+
+        int connected = 0;
+        int queued = 0;
+        for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+            if (!this->controllers[x].connected) { continue; }
+            connected++;
+            int frames = this->databuffer[x].capacity() - this->databuffer[x].adds_available();
+            if (frames > queued) { queued = frames; }
+        }
+
+        // Frames are interleaved, so credit is granted in whole records. Data
+        // already in flight counts against the window, so several grants can
+        // be outstanding without ever overflowing the buffer.
+        int record_size = connected * DATASTREAM_FRAME_SIZE;
+        if (connected > 0) {
+            int committed = queued + (this->credit + record_size - 1) / record_size;
+            if (committed < DATASTREAM_LOW_WATERMARK) {
+                uint grant = (DATASTREAM_HIGH_WATERMARK - committed) * record_size;
+                io::CommandWriter writer(commands::device::DATASTREAM_REQUEST);
+                writer.write_byte(grant & 0xFF).write_byte(grant >> 8);
+                for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+                    int frames = this->databuffer[x].capacity() - this->databuffer[x].adds_available();
+                    writer.write_byte(frames & 0xFF).write_byte(frames >> 8);
+                }
+                this->credit += grant;
+                DATASTREAM_REQUEST_PENDING();
+            }
+        }
+    }
+
+    void Datastream::refill_from_flash() {
+        if (this->flash_next >= this->flash_end) { return; }
+
+        if (this->packed) {
+            while (this->flash_next < this->flash_end && this->can_decode()) {
+                this->decoder.add(*this->flash_next++, [this](const byte* frame) { this->queue_frame(frame); });
+            }
+        } else {
+            while (this->flash_next < this->flash_end) {
+                for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+                    if (this->controllers[x].connected && this->databuffer[x].adds_available() == 0) { return; }
+                }
+
+                for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+                    if (!this->controllers[x].connected) { continue; }
+                    this->databuffer[x].add(oneline::encode_reply_word(this->flash_next));
+                    this->flash_next += DATASTREAM_FRAME_SIZE;
+                }
+            }
+        }
+
+        if (this->flash_next >= this->flash_end) {
+            io::Info(labels::INFO_FLASH_MOVIE_END).write_int(flash_movie::header()->records).send();
+        }
+    }
+
+    void Datastream::queue_frame(const byte frame[DATASTREAM_FRAME_SIZE]) {
+        this->databuffer[this->stream_port].add(oneline::encode_reply_word(frame));
+        this->stream_port = this->next_connected_port(this->stream_port);
+    }
+
+    bool Datastream::can_decode() const {
+        for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+            if (this->controllers[x].connected && this->databuffer[x].adds_available() < INPUT_CODEC_MAX_RUN) { return false; }
+        }
+        return true;
+    }
+
+    void Datastream::decode_packed() {
+        while (this->packed_data.gets_avaiable() > 0 && this->can_decode()) {
+            this->decoder.add(this->packed_data.get(), [this](const byte* frame) { this->queue_frame(frame); });
         }
     }
 
     // Datastream format:
-    // 1 byte - size of buffer
-    // n bytes - Data to send to the datastream.
+    // 1 byte - size of buffer. A grant may be sent as any number of these.
+    // n bytes - Data to send to the datastream. Each record is one 4 byte
+    //           frame for every connected port, in port order.
+    bool Datastream::frames_fit(int count) const {
+        int frames[N64_CONTROLLER_COUNT] = {};
+        int port = this->stream_port;
+        for (int x = (this->partial_frame_size + count) / DATASTREAM_FRAME_SIZE; x > 0; x--) {
+            frames[port]++;
+            port = this->next_connected_port(port);
+        }
+        for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+            if (frames[x] > this->databuffer[x].adds_available()) { return false; }
+        }
+        return true;
+    }
+
     void Datastream::handle_datastream() {
-        int count = io::read_blocking();
-        for (int x = 0; x < count; x++) {
-            this->databuffer.add(io::read_blocking());
+        int count = io::read_byte();
+        const byte* data = io::read_bytes(count);
+        if (data == nullptr) { return; }
+
+        // The host spent credit on these bytes whether or not they are used,
+        // so they are taken off here too, or the next grant would be short.
+        bool fits = this->packed ? count <= this->packed_data.adds_available() : this->frames_fit(count);
+        this->credit = (uint)count < this->credit ? this->credit - count : 0;
+        if (this->credit == 0) { DATASTREAM_REQUEST_FILLED(); }
+
+        // The whole payload is checked before anything is queued, so one that
+        // overruns its grant is dropped rather than half applied.
+        if (!fits) {
+            io::Error(labels::ERROR_BUFFER_OVERFLOW).write(__FILE__).send();
+            return;
+        }
+
+        if (this->packed) {
+            this->packed_data.add(data, count);
+            this->decode_packed();
+        } else {
+            // Frames are packed into reply words here, so the IRQ only has to
+            // hand one word to the PIO. Whole frames are encoded straight from
+            // the payload, and only ones split across packets are copied.
+            int offset = 0;
+            if (this->partial_frame_size > 0) {
+                offset = DATASTREAM_FRAME_SIZE - this->partial_frame_size;
+                if (offset > count) { offset = count; }
+                memcpy(this->partial_frame + this->partial_frame_size, data, offset);
+                this->partial_frame_size += offset;
+                if (this->partial_frame_size == DATASTREAM_FRAME_SIZE) {
+                    this->queue_frame(this->partial_frame);
+                    this->partial_frame_size = 0;
+                }
+            }
+            for (; offset + DATASTREAM_FRAME_SIZE <= count; offset += DATASTREAM_FRAME_SIZE) {
+                this->queue_frame(data + offset);
+            }
+            memcpy(this->partial_frame + this->partial_frame_size, data + offset, count - offset);
+            this->partial_frame_size += count - offset;
         }
-        this->pending_data = false;
-        DATASTREAM_REQUEST_FILLED();
+    }
+
+    // Datastream Encoding Protocol:
+    // 1 byte - 0 for raw records, 1 for a packed stream (see input_codec.h)
+    // Applies to the data after it. Credit is granted in bytes of the packed
+    // buffer while packed.
+    void Datastream::handle_datastream_encoding() {
+        this->packed = io::read_byte() == 1;
+        this->restart_stream();
     }
 
     // Controller Config Protocol:
     // 4x of the following:
     //   1 byte  - controller info (0 disconnected)
     //   3 bytes - controller header
+    // Streams restart from the first connected port, and drop any packed data.
+    void Datastream::restart_stream() {
+        int connected = 0;
+        for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+            if (this->controllers[x].connected) { connected++; }
+        }
+
+        this->stream_port = this->next_connected_port(N64_CONTROLLER_COUNT - 1);
+        this->partial_frame_size = 0;
+        this->packed_data.skip(this->packed_data.gets_avaiable());
+        this->decoder.reset(connected);
+    }
+
+    int Datastream::controller_config_size() const {
+        return N64_CONTROLLER_COUNT * 4;
+    }
+
     void Datastream::handle_controller_config() {
+        byte config[N64_CONTROLLER_COUNT][4];
+        for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+            for (int n = 0; n < 4; n++) {
+                config[x][n] = io::read_byte();
+            }
+        }
+
+        // The host takes over from a flash movie.
+        this->flash_playback = false;
+        this->configure_controllers(config);
+    }
+
+    void Datastream::configure_controllers(const byte config[N64_CONTROLLER_COUNT][4]) {
         for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
-            this->controllers[x].connected = !!io::read_blocking();
+            this->controllers[x].connected = !!config[x][0];
             for (int n = 0; n < (int)sizeof(this->controllers[x].header); n++) {
-                this->controllers[x].header[n] = io::read_blocking();
+                this->controllers[x].header[n] = config[x][n + 1];
+            }
+
+            // Packs are never given back here, since the IRQ may be using one.
+            if (this->controllers[x].connected && this->controllers[x].header[2] == CONTROLLER_PACK_INSERTED
+                    && this->packs[x] == nullptr) {
+                this->packs[x] = &this->pack_slots[x];
             }
         }
 
+        this->restart_stream();
+
         io::Debug(labels::DEBUG_PORT_INFO)
             .write_byte(1)
             .write_byte(controllers[0].connected)
@@ -99,7 +308,88 @@ namespace n64 {
             .write_bytes(controllers[3].header, sizeof(controllers[3].header));
     }
 
+    // Controller Pack Write Protocol:
+    // 1 byte  - port
+    // 2 bytes - address (little endian)
+    // 1 byte  - count
+    // n bytes - data
+    void Datastream::handle_controller_pack_write() {
+        byte port = io::read_byte();
+        uint address = io::read_byte();
+        address |= io::read_byte() << 8;
+        int count = io::read_byte();
+
+        ControllerPack* pack = port < N64_CONTROLLER_COUNT ? this->packs[port] : nullptr;
+        for (int x = 0; x < count; x++) {
+            byte data = io::read_byte();
+            if (pack != nullptr && address + x < CONTROLLER_PACK_SIZE) {
+                pack->image[address + x] = data;
+            }
+        }
+
+        if (pack == nullptr) {
+            io::Error(labels::ERROR_NO_CONTROLLER_PACK).write_byte(port).send();
+        }
+    }
+
+    // Controller Pack Read Protocol:
+    // 1 byte  - port
+    // 2 bytes - address (little endian)
+    // 1 byte  - count
+    void Datastream::handle_controller_pack_read() {
+        byte port = io::read_byte();
+        uint address = io::read_byte();
+        address |= io::read_byte() << 8;
+        int count = io::read_byte();
+
+        ControllerPack* pack = port < N64_CONTROLLER_COUNT ? this->packs[port] : nullptr;
+        if (pack == nullptr) {
+            io::Error(labels::ERROR_NO_CONTROLLER_PACK).write_byte(port).send();
+            return;
+        }
+
+        if (address >= CONTROLLER_PACK_SIZE) { count = 0; }
+        else if (address + count > CONTROLLER_PACK_SIZE) { count = CONTROLLER_PACK_SIZE - address; }
+
+        io::CommandWriter(commands::device::CONTROLLER_PACK_DATA)
+            .write_byte(port)
+            .write_byte(address & 0xFF)
+            .write_byte(address >> 8)
+            .write_bytes(pack->image + address, count);
+    }
+
+    // Plays the movie stored in flash instead of asking the host for data.
+    // Its controller config replaces the current one.
+    void Datastream::handle_flash_movie_play() {
+        const flash_movie::Header* movie = flash_movie::header();
+        if (movie == nullptr || memcmp(movie->console, labels::CONSOLE_N64, sizeof(movie->console)) != 0) {
+            io::Error(labels::ERROR_NO_FLASH_MOVIE).send();
+            return;
+        }
+
+        this->configure_controllers(movie->controllers);
+        this->packed = movie->encoding == FLASH_MOVIE_PACKED;
+        this->restart_stream();
+
+        // Raw records are read a whole record at a time, so a trailing
+        // partial one is left off.
+        uint size = movie->size;
+        if (!this->packed) {
+            uint record_size = 0;
+            for (int x = 0; x < N64_CONTROLLER_COUNT; x++) {
+                if (this->controllers[x].connected) { record_size += DATASTREAM_FRAME_SIZE; }
+            }
+            size = record_size > 0 ? size - size % record_size : 0;
+        }
+        this->flash_next = flash_movie::records();
+        this->flash_end = this->flash_next + size;
+        this->flash_playback = true;
+        // Fills the buffers now, so the first poll already has input.
+        this->refill_from_flash();
+    }
+
     void Datastream::handle_oneline(oneline::Port port) {
+        STATS_START(reply_start);
         ControllerConfig *controller = &controllers[port];
         if (!controller->connected) {
             return oneline::read_discard(port);
@@ -107,45 +397,74 @@ namespace n64 {
 
         int command = oneline::read_byte_blocking(port);
 
-        // Note: Can't respond too quickly, or the N64 will not register the command.
         switch (command) {
         case 0: // Identify Controller
         case 0xFF: // Reset Controller
-            fast_wait_us(5);
-            oneline::Writer(port, 3)
-                .write(&controller->header[port * 3]);
+            oneline::write_reply<3>(port, command, controller->header);
             break;
         case 1: // Read Inputs
-            fast_wait_us(5);
-            this->last_input[0] = this->databuffer.get();
-            this->last_input[1] = this->databuffer.get();
-            this->last_input[2] = this->databuffer.get();
-            this->last_input[3] = this->databuffer.get(); 
+            // On underflow, the previous input is held.
+            this->databuffer[port].get(&this->last_reply[port], 1);
 
-            oneline::Writer(port, 4)
-                .write(this->last_input);
+            oneline::write_encoded_reply<DATASTREAM_FRAME_SIZE>(port, command, &this->last_reply[port]);
+            STATS_RECORD(stats::DATASTREAM_REPLY, reply_start);
 
             this->last_port = port;
             this->last_event++;
+            // A frame was used, so the queue may need refilling.
+            events::signal(events::DEVICE);
             break;
-        // case 2:
-        //     oneline::read_byte_blocking(port);
-        //     oneline::read_byte_blocking(port);
-        //     fast_wait_us(6);
-        //     writer.begin_reply(33);
-        //     for (int n = 0; n < 33; n++) {
-        //         writer.write(state->buffer.get());
-        //     }
-        //     break;
-        // case 3:
-        //     for (int x = 0; x < 34; x++) {
-        //         oneline::read_byte_blocking(port);
-        //     }
-        //
-        //     fast_wait_us(6);
-        //     writer.begin_reply(1);
-        //     writer.write_zeros();
-        //     break;
+        case 2: { // Read Controller Pack
+            // A failed read has already ended the transaction, so the next
+            // byte read would belong to another one.
+            int high = oneline::read_byte_blocking(port);
+            int low = high != -1 ? oneline::read_byte_blocking(port) : -1;
+            if (low == -1) { return; }
+            STATS_START(pack_start);
+
+            // 32 bytes of data and the CRC.
+            byte reply[CONTROLLER_PACK_BLOCK_SIZE + 1] = {};
+            uint16_t address = (high << 8) | low;
+
+            // Without a pack, the controller replies with an inverted CRC.
+            ControllerPack* pack = controller->header[2] == CONTROLLER_PACK_INSERTED ? this->packs[port] : nullptr;
+            if (pack != nullptr) {
+                pack->read_block(address, reply);
+                reply[CONTROLLER_PACK_BLOCK_SIZE] = ControllerPack::data_crc(reply);
+            } else {
+                reply[CONTROLLER_PACK_BLOCK_SIZE] = ~ControllerPack::data_crc(reply);
+            }
+
+            uint32_t words[(sizeof(reply) + 3) / 4];
+            oneline::encode_reply<sizeof(reply)>(reply, words);
+            STATS_RECORD(stats::PACK_READ, pack_start);
+            oneline::write_encoded_reply<sizeof(reply)>(port, command, words);
+
+            // Checked once the reply is on its way, as for writes.
+            if (!ControllerPack::check_address(address)) { this->pack_address_errors++; }
+            break;
+        }
+        case 3: { // Write Controller Pack
+            // The CRC is built as the data arrives, so the reply is ready
+            // as soon as the last byte is.
+            byte request[2 + CONTROLLER_PACK_BLOCK_SIZE];
+            byte crc = 0;
+            for (int x = 0; x < (int)sizeof(request); x++) {
+                int data = oneline::read_byte_blocking(port);
+                if (data == -1) { return; }
+                request[x] = data;
+                if (x >= 2) { crc = ControllerPack::data_crc_add(crc, data); }
+            }
+
+            ControllerPack* pack = controller->header[2] == CONTROLLER_PACK_INSERTED ? this->packs[port] : nullptr;
+            byte status = pack != nullptr ? crc : (byte)~crc;
+            oneline::write_reply<1>(port, command, &status);
+
+            uint16_t address = (request[0] << 8) | request[1];
+            if (!ControllerPack::check_address(address)) { this->pack_address_errors++; }
+            if (pack != nullptr) { pack->write_block(address, request + 2); }
+            break;
+        }
         default:
             // Unknown commands: Discard all the data
             oneline::read_discard(port);
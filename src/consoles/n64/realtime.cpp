@@ -0,0 +1,197 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "consoles/n64/realtime.h"
+#include "consoles/n64/controller_pack.h"
+
+#include <hardware/clocks.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "events.h"
+#include "io.h"
+#include "labels.h"
+#include "stats.h"
+
+#define N64_IDENTIFY 0x00
+#define N64_READ_INPUTS 0x01
+
+namespace n64 {
+    Realtime::Realtime() {
+        this->cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+        for (int x = 0; x < N64_REALTIME_PORT_COUNT; x++) {
+            this->controllers[x].device = this;
+            this->controllers[x].port = (oneline::Port)x;
+            // Identify every port straight away.
+            this->controllers[x].last_identify = time_us_32() - REALTIME_IDENTIFY_US;
+        }
+
+        oneline::init(this);
+        oneline::set_reply_delay(oneline::all_commands, N64_REPLY_DELAY_NS);
+        oneline::init_requests(this);
+        io::Info(labels::INFO_DEVICE_INIT).write(labels::CONSOLE_N64).write(labels::DEVICE_TYPE_REALTIME);
+    }
+
+    Realtime::~Realtime() {
+        for (Controller& controller : this->controllers) {
+            if (controller.armed) { cancel_alarm(controller.alarm); }
+        }
+        oneline::uninit_requests();
+        oneline::uninit(this);
+    }
+
+    void Realtime::update() {
+        for (Controller& controller : this->controllers) {
+            if (controller.requesting) {
+                // The reply handler still runs, and counts this as unplugged.
+                if (!controller.aborted && TIMED_OUT(controller.request_start, REALTIME_REPLY_TIMEOUT_US)) {
+                    controller.aborted = true;
+                    oneline::abort_request(controller.port);
+                }
+                continue;
+            }
+
+            if (controller.connected != controller.reported) {
+                controller.reported = controller.connected;
+                io::Debug(labels::DEBUG_PORT_INFO)
+                    .write_byte(controller.port)
+                    .write_byte(controller.connected)
+                    .write_bytes(controller.header, sizeof(controller.header));
+            }
+
+            if (!controller.connected) {
+                if (TIMED_OUT(controller.last_identify, REALTIME_IDENTIFY_US)) {
+                    controller.last_identify = time_us_32();
+                    this->start_request(controller, N64_IDENTIFY);
+                }
+            } else if (!controller.armed) {
+                this->schedule_poll(controller);
+            }
+        }
+    }
+
+    // Realtime Overlay Format:
+    // 1 byte  - port
+    // 4 bytes - bits of the controller's reply to keep
+    // 4 bytes - bits to set afterwards
+    void Realtime::handle_realtime_overlay() {
+        byte port = io::read_byte();
+        const byte* overlay = io::read_bytes(8);
+        if (overlay == nullptr || port >= N64_REALTIME_PORT_COUNT) { return; }
+
+        Controller& controller = this->controllers[port];
+        controller.overlay_keep = ((uint32_t)overlay[0] << 24) | ((uint32_t)overlay[1] << 16) | ((uint32_t)overlay[2] << 8) | overlay[3];
+        controller.overlay_set = ((uint32_t)overlay[4] << 24) | ((uint32_t)overlay[5] << 16) | ((uint32_t)overlay[6] << 8) | overlay[7];
+    }
+
+    void Realtime::start_request(Controller& controller, byte command) {
+        controller.request = command;
+        controller.aborted = false;
+        controller.request_start = time_us_32();
+        controller.requesting = true;
+        oneline::start_request(controller.port, &command, 1);
+    }
+
+    // While the console polls steadily, the controller is polled
+    // REALTIME_POLL_LEAD_US before the first expected console poll that its
+    // current state would not cover. It's never left longer than
+    // REALTIME_IDLE_POLL_US, for when the console's timing isn't known.
+    void Realtime::schedule_poll(Controller& controller) {
+        uint32_t now = time_us_32();
+        uint32_t period = controller.poll_period;
+        uint32_t last_poll = controller.last_poll;
+        uint32_t target = controller.fresh_at + REALTIME_IDLE_POLL_US;
+
+        if (period != 0 && now - last_poll < 2 * period) {
+            uint32_t expected = last_poll + period - REALTIME_POLL_LEAD_US;
+            int32_t behind = controller.fresh_at - expected;
+            if (behind >= 0) { expected += ((uint32_t)behind / period + 1) * period; }
+            if ((int32_t)(expected - target) < 0) { target = expected; }
+        }
+
+        int32_t delay = target - now;
+        controller.armed = true;
+        controller.alarm = add_alarm_in_us(delay > 0 ? delay : 0, poll_alarm, &controller, true);
+    }
+
+    int64_t Realtime::poll_alarm(alarm_id_t, void* user_data) {
+        Controller* controller = (Controller*)user_data;
+        controller->armed = false;
+        if (controller->connected && !controller->requesting) {
+            controller->device->start_request(*controller, N64_READ_INPUTS);
+        }
+        return 0;
+    }
+
+    // Runs in the pio1 IRQ.
+    void Realtime::handle_reply(oneline::Port port) {
+        Controller& controller = this->controllers[port];
+        byte reply[REALTIME_REPLY_SIZE] = {};
+        int size = oneline::read_reply(port, reply, sizeof(reply));
+
+        if (controller.request == N64_READ_INPUTS && size == REALTIME_REPLY_SIZE) {
+            uint32_t state = ((uint32_t)reply[0] << 24) | ((uint32_t)reply[1] << 16) | ((uint32_t)reply[2] << 8) | reply[3];
+            // Encoded as by oneline::encode_reply_word.
+            controller.reply = ~((state & controller.overlay_keep) | controller.overlay_set);
+            controller.fresh_at = time_us_32();
+        } else if (controller.request == N64_IDENTIFY && size == (int)sizeof(controller.header)) {
+            memcpy(controller.header, reply, sizeof(controller.header));
+            // Pack commands aren't passed through, so the console never sees one.
+            controller.header[2] = CONTROLLER_PACK_EMPTY;
+            controller.connected = true;
+        } else {
+            controller.connected = false;
+        }
+
+        controller.requesting = false;
+        events::signal(events::DEVICE);
+    }
+
+    void Realtime::handle_oneline(oneline::Port port) {
+        Controller& controller = this->controllers[port];
+        if (!controller.connected) {
+            return oneline::read_discard(port);
+        }
+
+        int command = oneline::read_byte_blocking(port);
+
+        switch (command) {
+        case N64_IDENTIFY:
+        case 0xFF: // Reset Controller
+            oneline::write_reply<3>(port, command, controller.header);
+            break;
+        case N64_READ_INPUTS: {
+            uint32_t reply = controller.reply;
+            oneline::write_encoded_reply<REALTIME_REPLY_SIZE>(port, command, &reply);
+
+            uint32_t now = time_us_32();
+            uint32_t since = now - controller.last_poll;
+            if (controller.last_poll == 0 || since >= REALTIME_MIN_PERIOD_US) {
+                controller.poll_period = controller.last_poll != 0 && since < REALTIME_MAX_PERIOD_US ? since : 0;
+                controller.last_poll = now;
+            }
+            if (controller.fresh_at != 0) {
+                STATS_RECORD_CYCLES(stats::REALTIME_AGE, (now - controller.fresh_at) * this->cycles_per_us);
+            }
+            break;
+        }
+        default:
+            // Controller Pack commands: Discard all the data
+            oneline::read_discard(port);
+            break;
+        }
+    }
+}
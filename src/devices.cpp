@@ -15,72 +15,157 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "devices.h"
-#include "io.h"
-#include "labels.h"
 
-#define UNSUPPORTED_DEVICE(DEVICE) current_device = new DummyDevice();\
-io::Error(labels::ERROR_UNSUPPORTED_DEVICE).write(DEVICE);
+#include <algorithm>
+#include <new>
+#include <utility>
 
-#define UNKNOWN_MODE(DEVICE, MODE) current_device = new DummyDevice();\
-io::Error(labels::ERROR_UNKNOWN_MODE).write(DEVICE).write_byte(MODE);
+#include "io.h"
+#include "labels.h"
+#include "flash_movie.h"
 
-BaseDevice *current_device = new DummyDevice();
+#include "consoles/common/mixed.h"
+#include "consoles/common/recorder.h"
+#ifdef N64_SUPPORT
+#include "consoles/n64/datastream.h"
+#include "consoles/n64/realtime.h"
+#include "consoles/n64/protocol.h"
+#endif
+#ifdef GAMECUBE_SUPPORT
+#include "consoles/gamecube/datastream.h"
+#include "consoles/gamecube/protocol.h"
+#endif
 
 enum DeviceType {
     PLAYBACK = 0,
     RECORD = 1,
     REALTIME = 2,
     DEVICE_SPECIFIC_1 = 3,
+    // Streams the configured ports and records the rest.
+    STREAM_AND_RECORD = 4,
 };
 
 #define MAKE_ID(VALUE) (((uint32_t)VALUE[0] << 16) | ((uint32_t)VALUE[1] << 8) | ((uint32_t)VALUE[2]))
 
+// Every device is built in place here, so switching modes never touches the
+// heap. Sized for the largest device compiled in.
+template <typename... Devices>
+struct DeviceArena {
+    static constexpr size_t size = std::max({ sizeof(Devices)... });
+    static constexpr size_t align = std::max({ alignof(Devices)... });
+};
+
+using Arena = DeviceArena<DummyDevice, oneline::Recorder
 #ifdef N64_SUPPORT
-#include "consoles/n64/datastream.h"
-#include "consoles/n64/recorder.h"
+    , n64::Datastream, n64::Realtime, oneline::MixedDevice<n64::Datastream>
 #endif
+#ifdef GAMECUBE_SUPPORT
+    , gamecube::Datastream, oneline::MixedDevice<gamecube::Datastream>
+#endif
+>;
+
+alignas(Arena::align) static byte arena[Arena::size];
+
+template <typename T, typename... Args>
+static BaseDevice* emplace(Args&&... args) {
+    static_assert(sizeof(T) <= Arena::size && alignof(T) <= Arena::align, "Device is missing from the arena");
+    return new (arena) T(std::forward<Args>(args)...);
+}
+
+BaseDevice *current_device = emplace<DummyDevice>();
+
+// The old device is torn down (IRQs and all) before the arena is reused.
+static void destroy_device() {
+    if (current_device != nullptr) {
+        current_device->~BaseDevice();
+        current_device = nullptr;
+    }
+}
+
+struct DeviceFactory {
+    uint32_t console;
+    byte type;
+    BaseDevice* (*create)();
+};
+
+static constexpr DeviceFactory factories[] = {
+#ifdef N64_SUPPORT
+    { MAKE_ID(labels::CONSOLE_N64), RECORD, [] { return emplace<oneline::Recorder>(labels::CONSOLE_N64, n64::commands); } },
+    { MAKE_ID(labels::CONSOLE_N64), REALTIME, [] { return emplace<n64::Realtime>(); } },
+    { MAKE_ID(labels::CONSOLE_N64), DEVICE_SPECIFIC_1, [] { return emplace<n64::Datastream>(); } },
+    { MAKE_ID(labels::CONSOLE_N64), STREAM_AND_RECORD, [] { return emplace<oneline::MixedDevice<n64::Datastream>>(labels::CONSOLE_N64, n64::commands); } },
+#endif
+#ifdef GAMECUBE_SUPPORT
+    { MAKE_ID(labels::CONSOLE_GAMECUBE), RECORD, [] { return emplace<oneline::Recorder>(labels::CONSOLE_GAMECUBE, gamecube::commands); } },
+    { MAKE_ID(labels::CONSOLE_GAMECUBE), DEVICE_SPECIFIC_1, [] { return emplace<gamecube::Datastream>(); } },
+    { MAKE_ID(labels::CONSOLE_GAMECUBE), STREAM_AND_RECORD, [] { return emplace<oneline::MixedDevice<gamecube::Datastream>>(labels::CONSOLE_GAMECUBE, gamecube::commands); } },
+#endif
+};
+
+// Every console the host may name, whether or not its support is compiled in.
+static constexpr const char* consoles[] = { labels::CONSOLE_N64, labels::CONSOLE_GAMECUBE };
+
+static const DeviceFactory* find_factory(uint32_t console, byte type) {
+    for (const DeviceFactory& factory : factories) {
+        if (factory.console == console && factory.type == type) { return &factory; }
+    }
+    return nullptr;
+}
 
 void load_new_device() {
-    delete current_device;
-    current_device = nullptr;
+    destroy_device();
 
     // Need to compare 3 bytes. Load them into device_identifier and cast that to an int.
     byte device_identifier[4];
-    device_identifier[0] = io::read_blocking();
-    device_identifier[1] = io::read_blocking();
-    device_identifier[2] = io::read_blocking();
+    device_identifier[0] = io::read_byte();
+    device_identifier[1] = io::read_byte();
+    device_identifier[2] = io::read_byte();
     device_identifier[3] = 0; // this is so we can use this as a string.
+    uint32_t id = MAKE_ID(device_identifier);
 
-    byte device_type = io::read_blocking();
+    byte device_type = io::read_byte();
+
+    const DeviceFactory* factory = find_factory(id, device_type);
+    if (factory != nullptr) {
+        current_device = factory->create();
+        return;
+    }
 
     // Validate that the device identifier is valid. Otherwise we may echo an invalid string
-    switch (MAKE_ID(device_identifier)) {
-    case MAKE_ID(labels::CONSOLE_N64):
-#ifdef N64_SUPPORT
-        switch (device_type) {
-        case RECORD:
-            current_device = new n64::Recorder();
-            return;
-        case DEVICE_SPECIFIC_1: 
-            current_device = new n64::Datastream();
-            return;
-        default:
-            UNKNOWN_MODE(labels::CONSOLE_N64, device_type);
-            break;
-        }
-#else
-        UNSUPPORTED_DEVICE(labels::CONSOLE_N64);
-#endif
-        break;
-    default:
-        io::Error(labels::ERROR_SUPPORT_DISABLED).send();
-    break;
+    const char* console = nullptr;
+    for (const char* known : consoles) {
+        if (MAKE_ID(known) == id) { console = known; }
+    }
+    bool supported = false;
+    for (const DeviceFactory& other : factories) {
+        if (other.console == id) { supported = true; }
     }
 
-    current_device = new DummyDevice();
+    if (console == nullptr) {
+        io::Error(labels::ERROR_SUPPORT_DISABLED).send();
+    } else if (supported) {
+        io::Error(labels::ERROR_UNKNOWN_MODE).write(console).write_byte(device_type);
+    } else {
+        io::Error(labels::ERROR_UNSUPPORTED_DEVICE).write(console);
+    }
+    current_device = emplace<DummyDevice>();
 }
 
 void reset_device() {
-    delete current_device;
-    current_device = new DummyDevice();
-}
\ No newline at end of file
+    destroy_device();
+    current_device = emplace<DummyDevice>();
+}
+
+void load_autoplay_device() {
+    const flash_movie::Header* movie = flash_movie::header();
+    if (movie == nullptr || !(movie->flags & FLASH_MOVIE_AUTOPLAY)) { return; }
+
+    // Only N64 streams can play from flash so far.
+    uint32_t console = MAKE_ID(movie->console);
+    const DeviceFactory* factory = find_factory(console, DEVICE_SPECIFIC_1);
+    if (factory == nullptr || console != MAKE_ID(labels::CONSOLE_N64)) { return; }
+
+    destroy_device();
+    current_device = factory->create();
+    current_device->handle_flash_movie_play();
+}
@@ -0,0 +1,54 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "events.h"
+
+namespace events {
+    volatile bool pending[EVENT_COUNT];
+    static repeating_timer_t housekeeping_timer;
+
+    static void chars_available(void*) { signal(HOST_RX); }
+    static bool housekeeping(repeating_timer_t*) {
+        signal(HOUSEKEEPING);
+        return true;
+    }
+
+    void init() {
+        stdio_set_chars_available_callback(chars_available, nullptr);
+        add_repeating_timer_us(EVENTS_HOUSEKEEPING_US, housekeeping, nullptr, &housekeeping_timer);
+        // Anything sent before the callback was set has to be read too.
+        signal(HOST_RX);
+    }
+
+    uint32_t wait() {
+        while (true) {
+            // Each flag is cleared before it's handled, so a signal racing
+            // this is kept for the next wait.
+            uint32_t signalled = 0;
+            for (int x = 0; x < EVENT_COUNT; x++) {
+                if (pending[x]) {
+                    pending[x] = false;
+                    signalled |= 1u << x;
+                }
+            }
+            if (signalled) { return signalled; }
+
+            // A signal since the check above leaves the event register set, so
+            // this returns straight away.
+            __wfe();
+        }
+    }
+}
@@ -0,0 +1,91 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "flash_movie.h"
+
+#include <string.h>
+#include <hardware/sync.h>
+
+#include "io.h"
+#include "labels.h"
+#include "devices.h"
+
+namespace flash_movie {
+    static const byte* const region = (const byte*)(XIP_BASE + FLASH_MOVIE_OFFSET);
+
+    const Header* header() {
+        const Header* stored = (const Header*)region;
+        if (memcmp(stored->magic, FLASH_MOVIE_MAGIC, sizeof(stored->magic)) != 0 || stored->version != FLASH_MOVIE_VERSION) {
+            return nullptr;
+        }
+        return stored;
+    }
+
+    const byte* records() {
+        return region + FLASH_PAGE_SIZE;
+    }
+
+    uint capacity() {
+        return PICO_FLASH_SIZE_BYTES - FLASH_MOVIE_OFFSET;
+    }
+
+    static uint read_int() {
+        uint value = io::read_byte();
+        value |= io::read_byte() << 8;
+        value |= io::read_byte() << 16;
+        value |= io::read_byte() << 24;
+        return value;
+    }
+
+    // Flash Erase Protocol:
+    // 4 bytes - bytes to erase (little endian), rounded up to whole sectors
+    // Replies with ACKNOWLEDGE once done.
+    void handle_erase() {
+        uint size = read_int();
+        if (size > capacity()) { size = capacity(); }
+        reset_device();
+
+        // Interrupts are only held off one sector at a time, to keep USB alive.
+        for (uint offset = 0; offset < size; offset += FLASH_SECTOR_SIZE) {
+            uint32_t interrupts = save_and_disable_interrupts();
+            flash_range_erase(FLASH_MOVIE_OFFSET + offset, FLASH_SECTOR_SIZE);
+            restore_interrupts(interrupts);
+        }
+
+        io::CommandWriter(commands::device::ACKNOWLEDGE).write_byte(commands::host::FLASH_MOVIE_ERASE);
+    }
+
+    // Flash Program Protocol:
+    // 4 bytes   - offset into the movie (little endian), page aligned
+    // 256 bytes - data
+    // Replies with ACKNOWLEDGE once done.
+    void handle_program() {
+        uint offset = read_int();
+        const byte* page = io::read_bytes(FLASH_PAGE_SIZE);
+
+        if (page == nullptr || offset % FLASH_PAGE_SIZE != 0 || offset + FLASH_PAGE_SIZE > capacity()) {
+            io::Error(labels::ERROR_FLASH_OFFSET).write_int(offset).send();
+            return;
+        }
+        reset_device();
+
+        uint32_t interrupts = save_and_disable_interrupts();
+        flash_range_program(FLASH_MOVIE_OFFSET + offset, page, FLASH_PAGE_SIZE);
+        restore_interrupts(interrupts);
+
+        io::CommandWriter(commands::device::ACKNOWLEDGE).write_byte(commands::host::FLASH_MOVIE_PROGRAM);
+    }
+}
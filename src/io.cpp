@@ -16,8 +16,11 @@
 #include "io.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <hardware/sync.h>
 
 #include "devices.h"
+#include "helpers.h"
 #include "labels.h"
 
 static constexpr char NIBLE_CHARACTER_MAPPING[] = {
@@ -28,111 +31,330 @@ static constexpr char NIBLE_CHARACTER_MAPPING[] = {
 };
 
 namespace io {
-    byte read_blocking() {
-        int data;
-        do {
-            if (current_device) { current_device->update(); }
-            data = getchar_timeout_us(0);
-        } while (data == PICO_ERROR_TIMEOUT);
-        
+    static byte output[IO_OUTPUT_BUFFER_SIZE];
+    static int output_length = 0;
+    static uint output_started = 0;
+    // Start of the frame being written, or -1 if no writer is open.
+    static int frame_start = -1;
+
+    // The host command being assembled, and how much of its payload is here.
+    static int command = -1;
+    static byte payload[IO_INPUT_BUFFER_SIZE];
+    static int received = 0;
+    static int read_position = 0;
+
+    // Payload bytes command needs, given the ones received so far. Variable
+    // length payloads are sized by their first bytes.
+    static int payload_size(byte command) {
+        switch (command) {
+        case commands::host::SET_DEVICE:
+        case commands::host::REPLY_DELAY:
+        case commands::host::FLASH_MOVIE_ERASE:
+        case commands::host::CONTROLLER_PACK_READ:
+            return 4;
+        case commands::host::REALTIME_OVERLAY:
+            return 9;
+        case commands::host::FLASH_MOVIE_PROGRAM:
+            return IO_INPUT_BUFFER_SIZE;
+        case commands::host::DATASTREAM_DATA:
+            return received < 1 ? 1 : 1 + payload[0];
+        case commands::host::DATASTREAM_ENCODING:
+            return 1;
+        case commands::host::CONTROLLER_CONFIG:
+            return current_device ? current_device->controller_config_size() : 0;
+        case commands::host::CONTROLLER_PACK_WRITE:
+            return received < 4 ? 4 : 4 + payload[3];
+        default:
+            return 0;
+        }
+    }
+
+    int receive() {
+        while (true) {
+            // A command is handed out as soon as its payload is complete, so
+            // the next command's size can depend on it (e.g. SET_DEVICE).
+            if (command != -1 && received == payload_size(command)) {
+                int complete = command;
+                command = -1;
+                read_position = 0;
+                return complete;
+            }
+
+            if (command == -1) {
+                int data = getchar_timeout_us(0);
+                if (data == PICO_ERROR_TIMEOUT) { return -1; }
+                command = data;
+                received = 0;
+                continue;
+            }
+
+            // Payloads are copied out of USB in bulk, as far as their size is
+            // known so far, rather than a byte per call.
+            int count = stdio_get_until((char*)payload + received, payload_size(command) - received, get_absolute_time());
+            if (count <= 0) { return -1; }
+            received += count;
+        }
+    }
+
+    byte read_byte() {
+        return read_position < received ? payload[read_position++] : 0;
+    }
+
+    const byte* read_bytes(int count) {
+        if (count < 0 || read_position + count > received) { return nullptr; }
+        const byte* data = payload + read_position;
+        read_position += count;
         return data;
     }
+
+    // Sends every closed frame in a single write. An open frame is moved to
+    // the front of the buffer. Frames are binary, so the SDK's CRLF
+    // translation is bypassed; it's on by default in its stdio.
+    void flush() {
+        int end = frame_start == -1 ? output_length : frame_start;
+        if (end > 0) {
+            stdio_put_string((const char*)output, end, false, false);
+        }
+
+        memmove(output, output + end, output_length - end);
+        output_length -= end;
+        if (frame_start != -1) { frame_start = 0; }
+        output_started = time_us_32();
+    }
+
+    static void flush_log_if_due();
+
+    void flush_if_due() {
+        flush_log_if_due();
+        if (output_length > 0 && frame_start == -1 && TIMED_OUT(output_started, IO_FLUSH_WINDOW_US)) {
+            flush();
+        }
+    }
+
+    static void append(const byte* data, int count) {
+        if (output_length + count > IO_OUTPUT_BUFFER_SIZE) {
+            flush();
+            // A single frame larger than the buffer is truncated.
+            if (output_length + count > IO_OUTPUT_BUFFER_SIZE) {
+                count = IO_OUTPUT_BUFFER_SIZE - output_length;
+            }
+        }
+
+        if (output_length == 0) { output_started = time_us_32(); }
+        memcpy(output + output_length, data, count);
+        output_length += count;
+    }
     
     CommandWriter::CommandWriter(commands::device::Command command) {
-        putchar_raw(command);
+        // Length is filled in when the frame is closed.
+        const byte header[] = { command, 0, 0 };
+        if (output_length + (int)sizeof(header) > IO_OUTPUT_BUFFER_SIZE) { flush(); }
+        frame_start = output_length;
+        append(header, sizeof(header));
+    }
+
+    CommandWriter::~CommandWriter() {
+        int length = output_length - frame_start - 3;
+        output[frame_start + 1] = length & 0xFF;
+        output[frame_start + 2] = (length >> 8) & 0xFF;
+
+#ifdef IO_FRAME_CHECKSUM
+        byte checksum = 0;
+        for (int x = frame_start; x < output_length; x++) {
+            checksum ^= output[x];
+        }
+        frame_start = -1;
+        append(&checksum, 1);
+#else
+        frame_start = -1;
+#endif
     }
 
     CommandWriter& CommandWriter::write_byte(byte data) {
-        putchar_raw(data);
+        append(&data, 1);
         return *this;
     }
     CommandWriter& CommandWriter::write_short(uint16_t data) {
-        putchar_raw(data & 0xFF);
-        putchar_raw((data >> 8) & 0xFF);
+        const byte bytes[] = { (byte)(data & 0xFF), (byte)((data >> 8) & 0xFF) };
+        append(bytes, sizeof(bytes));
         return *this;
     }
     CommandWriter& CommandWriter::write_int(uint32_t data) {
-        putchar_raw(data & 0xFF);
-        putchar_raw((data >> 8) & 0xFF);
-        putchar_raw((data >> 16) & 0xFF);
-        putchar_raw((data >> 24) & 0xFF);
+        const byte bytes[] = {
+            (byte)(data & 0xFF), (byte)((data >> 8) & 0xFF),
+            (byte)((data >> 16) & 0xFF), (byte)((data >> 24) & 0xFF)
+        };
+        append(bytes, sizeof(bytes));
         return *this;
     }
     CommandWriter& CommandWriter::write_bytes(const byte* data, int count) {
-        for (int x = 0; x < count; x++) {
-            putchar_raw(*(data + x));
-        }
+        append(data, count);
         return *this;
     }
-    CommandWriter& CommandWriter::write_bytes(CircularQueue<byte>* data, int count) {
-        for (int x = 0; x < count; x++) {
-            putchar_raw(data->get());
-        }
+    CommandWriter& CommandWriter::write_str(const char* message) { 
+        append((const byte*)message, strlen(message));
         return *this;
     }
-    CommandWriter& CommandWriter::write_str(const char* message) { 
-        while (*message) {
-            CommandWriter::write_byte(*message);
-            message++;
+
+
+#ifdef IO_BINARY_LOGS
+    // Messages logged since the last LOG frame. Identical ones share a slot.
+    struct LogSlot {
+        byte id;
+        byte length;
+        uint16_t count;
+        byte arguments[IO_LOG_ARGUMENT_SIZE];
+    };
+    static LogSlot log_slots[IO_LOG_SLOTS];
+    static int log_used = 0;
+    static uint16_t log_dropped = 0;
+    static uint32_t log_sent = 0;
+    static spin_lock_t* log_lock = nullptr;
+
+    void init() {
+        log_lock = spin_lock_init(spin_lock_claim_unused(true));
+    }
+
+    static void flush_log_if_due() {
+        if ((log_used == 0 && log_dropped == 0) || !TIMED_OUT(log_sent, IO_LOG_INTERVAL_US)) { return; }
+
+        // Copied out first, so IRQs aren't held off while the frame is built.
+        LogSlot slots[IO_LOG_SLOTS];
+        uint32_t interrupts = spin_lock_blocking(log_lock);
+        int used = log_used;
+        uint16_t dropped = log_dropped;
+        memcpy(slots, log_slots, used * sizeof(LogSlot));
+        log_used = 0;
+        log_dropped = 0;
+        spin_unlock(log_lock, interrupts);
+
+        CommandWriter writer(commands::device::LOG);
+        writer.write_short(dropped);
+        for (int x = 0; x < used; x++) {
+            writer.write_byte(slots[x].id).write_byte(slots[x].length).write_short(slots[x].count)
+                .write_bytes(slots[x].arguments, slots[x].length);
         }
-        return *this;
+        log_sent = time_us_32();
     }
 
+    // The level is part of the message ID.
+    LogWriter::LogWriter(commands::device::Command, const labels::Message& message) : id(message.id) {}
+
+    LogWriter::~LogWriter() {
+        uint32_t interrupts = spin_lock_blocking(log_lock);
+        LogSlot* slot = nullptr;
+        for (int x = 0; x < log_used; x++) {
+            if (log_slots[x].id == this->id && log_slots[x].length == this->length
+                    && memcmp(log_slots[x].arguments, this->arguments, this->length) == 0) {
+                slot = &log_slots[x];
+                break;
+            }
+        }
+
+        if (slot != nullptr) {
+            if (slot->count < 0xFFFF) { slot->count++; }
+        } else if (log_used < IO_LOG_SLOTS) {
+            slot = &log_slots[log_used++];
+            slot->id = this->id;
+            slot->length = this->length;
+            slot->count = 1;
+            memcpy(slot->arguments, this->arguments, this->length);
+        } else if (log_dropped < 0xFFFF) {
+            log_dropped++;
+        }
+        spin_unlock(log_lock, interrupts);
+    }
+
+    void LogWriter::append(const byte* data, int count) {
+        if (count > IO_LOG_ARGUMENT_SIZE - this->length) { count = IO_LOG_ARGUMENT_SIZE - this->length; }
+        memcpy(this->arguments + this->length, data, count);
+        this->length += count;
+    }
+
+    LogWriter& LogWriter::write(const char* message) {
+        // Long strings keep their end, which is the useful part of a path.
+        int room = IO_LOG_ARGUMENT_SIZE - this->length;
+        int size = strlen(message) + 1;
+        if (size > room) { message += size - room; }
+        append((const byte*)message, size > room ? room : size);
+        return *this;
+    }
+    LogWriter& LogWriter::write_byte(byte data) {
+        append(&data, 1);
+        return *this;
+    }
+    LogWriter& LogWriter::write_short(uint16_t data) {
+        const byte bytes[] = { (byte)(data & 0xFF), (byte)((data >> 8) & 0xFF) };
+        append(bytes, sizeof(bytes));
+        return *this;
+    }
+    LogWriter& LogWriter::write_int(uint32_t data) {
+        const byte bytes[] = {
+            (byte)(data & 0xFF), (byte)((data >> 8) & 0xFF),
+            (byte)((data >> 16) & 0xFF), (byte)((data >> 24) & 0xFF)
+        };
+        append(bytes, sizeof(bytes));
+        return *this;
+    }
+    LogWriter& LogWriter::write_bytes(const byte* data, int count) {
+        append(data, count);
+        return *this;
+    }
+#else
+    void init() {}
+    static void flush_log_if_due() {}
 
-    LogWriter::LogWriter(commands::device::Command command, const char* msg) 
-    : CommandWriter(command) {
-        write(msg);
+    LogWriter::LogWriter(commands::device::Command command, const labels::Message& message)
+    : writer(command) {
+        write(message.text);
     }
     LogWriter::~LogWriter() {
-        CommandWriter::write_byte('\n');
+        this->writer.write_byte('\n');
     }
 
-    LogWriter& LogWriter::write(const char* message) { 
-        CommandWriter::write_byte(' ');
-        while (*message) {
-            CommandWriter::write_byte(*message);
-            message++;
+    // Writes a space, then the value as hex, most significant nibble first.
+    static void append_hex(uint32_t data, int nibbles) {
+        byte text[9];
+        text[0] = ' ';
+        for (int x = 0; x < nibbles; x++) {
+            text[nibbles - x] = NIBLE_CHARACTER_MAPPING[(data >> (x * 4)) & 0xF];
         }
+        append(text, nibbles + 1);
+    }
+
+    LogWriter& LogWriter::write(const char* message) { 
+        this->writer.write_byte(' ');
+        this->writer.write_str(message);
         return *this;
     }
     LogWriter& LogWriter::write_byte(byte data) {
-        CommandWriter::write_byte(' ');
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 4) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 0) & 0xF]);
+        append_hex(data, 2);
         return *this;
     }
     LogWriter& LogWriter::write_short(uint16_t data) {
-        CommandWriter::write_byte(' ');
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 12) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >>  8) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >>  4) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >>  0) & 0xF]);
+        append_hex(data, 4);
         return *this;
     }
     LogWriter& LogWriter::write_int(uint32_t data) {
-        CommandWriter::write_byte(' ');
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 28) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 24) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 20) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 16) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >> 12) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >>  8) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >>  4) & 0xF]);
-        CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(data >>  0) & 0xF]);
+        append_hex(data, 8);
         return *this;
     }
     LogWriter& LogWriter::write_bytes(const byte* data, int count) {
-        CommandWriter::write_byte(' ');
+        this->writer.write_byte(' ');
         for (int x = 0; x < count; x++) {
-            CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(*(data + x) >> 4) & 0xF]);
-            CommandWriter::write_byte(NIBLE_CHARACTER_MAPPING[(*(data + x) >> 0) & 0xF]);
+            const byte text[] = {
+                (byte)NIBLE_CHARACTER_MAPPING[(data[x] >> 4) & 0xF],
+                (byte)NIBLE_CHARACTER_MAPPING[(data[x] >> 0) & 0xF]
+            };
+            append(text, sizeof(text));
         }
         return *this;
     }
+#endif
     void LogWriter::send() {}
 
-    Debug::Debug(const char* message) : LogWriter(commands::device::DEBUG, message) {};
-    Info::Info(const char* message) : LogWriter(commands::device::INFO, message) {};
-    Warn::Warn(const char* message) : LogWriter(commands::device::WARN, message) {};
-    Error::Error(const char* message) : LogWriter(commands::device::ERROR, message) {};
+    Debug::Debug(const labels::Message& message) : LogWriter(commands::device::DEBUG, message) {};
+    Info::Info(const labels::Message& message) : LogWriter(commands::device::INFO, message) {};
+    Warn::Warn(const labels::Message& message) : LogWriter(commands::device::WARN, message) {};
+    Error::Error(const labels::Message& message) : LogWriter(commands::device::ERROR, message) {};
 }
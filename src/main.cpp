@@ -21,52 +21,115 @@
 #include "io.h"
 #include "labels.h"
 #include "devices.h"
+#include "stats.h"
+#include "events.h"
+#include "flash_movie.h"
+#include "consoles/common/oneline.h"
 
 
+// Runs once the command's whole payload has arrived.
+static void handle_command(byte cmd) {
+    switch (cmd) {
+    case commands::host::NOP: 
+    case commands::host::NOP_CR:
+    case commands::host::NOP_LF:
+        // Hides errors when interacting via serial.
+        break;
+
+    case commands::host::INFO:
+    case commands::host::INFO_ALT:
+    case commands::host::INFO_ALT2:
+        io::CommandWriter(commands::device::REPLY)
+            .write_str(labels::DEVICE_INFO).write_byte('\n');
+        break;
+
+    case commands::host::SET_DEVICE:
+        load_new_device();
+        break;
+
+    case commands::host::STOP_DEVICE:
+        reset_device();
+        break;
+
+    case commands::host::REPLY_DELAY: {
+        bool all = io::read_byte();
+        byte command = io::read_byte();
+        uint32_t ns = io::read_byte();
+        ns |= io::read_byte() << 8;
+        oneline::set_reply_delay(all ? oneline::all_commands : command, ns);
+        break;
+    }
+
+    case commands::host::REALTIME_OVERLAY:
+        current_device->handle_realtime_overlay();
+        break;
+
+    case commands::host::DATASTREAM_DATA:
+        current_device->handle_datastream();
+        break;
+
+    case commands::host::DATASTREAM_ENCODING:
+        current_device->handle_datastream_encoding();
+        break;
+
+    case commands::host::CONTROLLER_CONFIG:
+        current_device->handle_controller_config();
+        break;
+
+    case commands::host::CONTROLLER_PACK_WRITE:
+        current_device->handle_controller_pack_write();
+        break;
+
+    case commands::host::CONTROLLER_PACK_READ:
+        current_device->handle_controller_pack_read();
+        break;
+
+    case commands::host::FLASH_MOVIE_ERASE:
+        flash_movie::handle_erase();
+        break;
+
+    case commands::host::FLASH_MOVIE_PROGRAM:
+        flash_movie::handle_program();
+        break;
+
+    case commands::host::FLASH_MOVIE_PLAY:
+        current_device->handle_flash_movie_play();
+        break;
+
+    case commands::host::GET_STATS:
+        stats::send_and_reset();
+        break;
+
+    default:
+        // Anything typeable should be considered the user typing in a serial program.
+        if (cmd > 0x79) {
+            io::Error(labels::ERROR_UNKNOWN_COMMAND).write_byte(cmd);
+        }
+    }
+}
+
 int main() {
     gpio_init(PICO_DEFAULT_LED_PIN);
     gpio_set_dir(PICO_DEFAULT_LED_PIN, GPIO_OUT);
 
     stdio_init_all();
+    io::init();
+    stats::init();
+    events::init();
+    load_autoplay_device();
     
     while(true) {
-        // The blocking loop for reading will update the device.
-        byte cmd = io::read_blocking();
-        switch (cmd) {
-        case commands::host::NOP: 
-        case commands::host::NOP_CR:
-        case commands::host::NOP_LF:
-            // Hides errors when interacting via serial.
-            break;
-
-        case commands::host::INFO:
-        case commands::host::INFO_ALT:
-        case commands::host::INFO_ALT2:
-            io::CommandWriter(commands::device::REPLY)
-                .write_str(labels::DEVICE_INFO).write_byte('\n');
-            break;
-
-        case commands::host::SET_DEVICE:
-            load_new_device();
-            break;
-
-        case commands::host::STOP_DEVICE:
-            reset_device();
-            break;
-
-        case commands::host::DATASTREAM_DATA:
-            current_device->handle_datastream();
-            break;
-
-        case commands::host::CONTROLLER_CONFIG:
-            current_device->handle_controller_config();
-            break;
-
-        default:
-            // Anything typeable should be considered the user typing in a serial program.
-            if (cmd > 0x79) {
-                io::Error(labels::ERROR_UNKNOWN_COMMAND).write_byte(cmd);
+        // Sleeps until the host sends something, the oneline IRQ rings, or
+        // housekeeping is due. The device updates once per wake.
+        uint32_t signalled = events::wait();
+        if (signalled & (1u << events::HOST_RX)) {
+            int cmd;
+            while ((cmd = io::receive()) != -1) {
+                handle_command(cmd);
             }
         }
+
+        if (current_device) { current_device->update(); }
+        io::flush_if_due();
     }
 }
@@ -0,0 +1,77 @@
+// Open TAS Controller - Connects to game consoles via a Raspberry Pi Pico
+// Copyright (C) 2022  Russell Small
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "stats.h"
+
+#include <hardware/clocks.h>
+
+#include "io.h"
+#include "commands.h"
+
+namespace stats {
+    struct Histogram {
+        uint32_t count;
+        uint32_t max;
+        uint32_t buckets[STATS_BUCKET_COUNT];
+    };
+
+    static Histogram histograms[PROBE_COUNT];
+
+    inline byte bucket_shift(Probe probe) {
+        return probe == REALTIME_AGE ? STATS_WIDE_BUCKET_SHIFT : STATS_BUCKET_SHIFT;
+    }
+
+    void init() {
+        // Processor clock, no interrupt, full 24 bit reload.
+        systick_hw->rvr = 0xFFFFFF;
+        systick_hw->cvr = 0;
+        systick_hw->csr = 0x5;
+    }
+
+    void __time_critical_func(record_cycles)(Probe probe, uint32_t cycles) {
+        Histogram& histogram = histograms[probe];
+        uint32_t bucket = cycles >> bucket_shift(probe);
+
+        histogram.count++;
+        histogram.buckets[bucket < STATS_BUCKET_COUNT ? bucket : STATS_BUCKET_COUNT - 1]++;
+        if (cycles > histogram.max) { histogram.max = cycles; }
+    }
+
+    // Stats Format:
+    // 1 byte  - probe count
+    // 1 byte  - bucket count
+    // 4 bytes - system clock in Hz
+    // For each probe:
+    //   1 byte  - bucket shift (bucket width is 2^shift cycles)
+    //   4 bytes - samples
+    //   4 bytes - max cycles
+    //   4 bytes each - bucket counts
+    void send_and_reset() {
+        io::CommandWriter writer(commands::device::STATS);
+        writer.write_byte(PROBE_COUNT)
+            .write_byte(STATS_BUCKET_COUNT)
+            .write_int(clock_get_hz(clk_sys));
+
+        for (int probe = 0; probe < PROBE_COUNT; probe++) {
+            Histogram& histogram = histograms[probe];
+            writer.write_byte(bucket_shift((Probe)probe)).write_int(histogram.count).write_int(histogram.max);
+            for (int bucket = 0; bucket < STATS_BUCKET_COUNT; bucket++) {
+                writer.write_int(histogram.buckets[bucket]);
+            }
+            histogram = {};
+        }
+    }
+}